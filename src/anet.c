@@ -47,6 +47,12 @@
 
 #include "anet.h"
 
+/* accept4() creates the socket already in non blocking mode, saving the
+ * fcntl(2) calls of anetNonBlock(). */
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+#define HAVE_ACCEPT4 1
+#endif
+
 static void anetSetError(char *err, const char *fmt, ...)
 {
     va_list ap;
@@ -106,22 +112,41 @@ int anetTcpKeepAlive(char *err, int fd)
     return ANET_OK;
 }
 
-int anetResolve(char *err, char *host, char *ipbuf)
+/* Convert the IPv4 or IPv6 address of 'sa' into a string, and optionally
+ * return its port. */
+static void anetSockaddrToString(struct sockaddr_storage *sa, char *ip,
+                                 size_t ip_len, int *port)
 {
-    struct sockaddr_in sa;
+    if (sa->ss_family == AF_INET) {
+        struct sockaddr_in *s = (struct sockaddr_in *)sa;
 
-    sa.sin_family = AF_INET;
-    if (inet_aton(host, &sa.sin_addr) == 0) {
-        struct hostent *he;
+        if (ip) inet_ntop(AF_INET,(void*)&(s->sin_addr),ip,ip_len);
+        if (port) *port = ntohs(s->sin_port);
+    } else {
+        struct sockaddr_in6 *s = (struct sockaddr_in6 *)sa;
 
-        he = gethostbyname(host);
-        if (he == NULL) {
-            anetSetError(err, "can't resolve: %s", host);
-            return ANET_ERR;
-        }
-        memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
+        if (ip) inet_ntop(AF_INET6,(void*)&(s->sin6_addr),ip,ip_len);
+        if (port) *port = ntohs(s->sin6_port);
     }
-    strcpy(ipbuf,inet_ntoa(sa.sin_addr));
+}
+
+/* Resolve 'host' into an IPv4 or IPv6 address string. 'ipbuf' should be
+ * at least ANET_IP_STR_LEN bytes. */
+int anetResolve(char *err, char *host, char *ipbuf, size_t ipbuf_len)
+{
+    struct addrinfo hints, *info;
+    int rv;
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rv = getaddrinfo(host, NULL, &hints, &info)) != 0) {
+        anetSetError(err, "can't resolve %s: %s", host, gai_strerror(rv));
+        return ANET_ERR;
+    }
+    anetSockaddrToString((struct sockaddr_storage*)info->ai_addr,
+                         ipbuf,ipbuf_len,NULL);
+    freeaddrinfo(info);
     return ANET_OK;
 }
 
@@ -143,40 +168,47 @@ static int anetCreateSocket(char *err, int domain) {
 
 #define ANET_CONNECT_NONE 0
 #define ANET_CONNECT_NONBLOCK 1
+/* Connect to 'addr', that can be an IPv4 or IPv6 address or a host name.
+ * All the addresses the name resolves to are tried in order, until a
+ * socket can be created and connected (or the connection is in progress
+ * for non blocking connects). */
 static int anetTcpGenericConnect(char *err, char *addr, int port, int flags)
 {
-    int s;
-    struct sockaddr_in sa;
-
-    if ((s = anetCreateSocket(err,AF_INET)) == ANET_ERR)
-        return ANET_ERR;
+    int s = ANET_ERR, rv;
+    char portstr[6];  /* strlen("65535") + 1; */
+    struct addrinfo hints, *servinfo, *p;
 
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    if (inet_aton(addr, &sa.sin_addr) == 0) {
-        struct hostent *he;
+    snprintf(portstr,sizeof(portstr),"%d",port);
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
 
-        he = gethostbyname(addr);
-        if (he == NULL) {
-            anetSetError(err, "can't resolve: %s", addr);
+    if ((rv = getaddrinfo(addr,portstr,&hints,&servinfo)) != 0) {
+        anetSetError(err, "can't resolve %s: %s", addr, gai_strerror(rv));
+        return ANET_ERR;
+    }
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if ((s = anetCreateSocket(err,p->ai_family)) == ANET_ERR)
+            continue;
+        if (flags & ANET_CONNECT_NONBLOCK &&
+            anetNonBlock(err,s) != ANET_OK)
+        {
             close(s);
-            return ANET_ERR;
+            s = ANET_ERR;
+            break;
         }
-        memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
-    }
-    if (flags & ANET_CONNECT_NONBLOCK) {
-        if (anetNonBlock(err,s) != ANET_OK)
-            return ANET_ERR;
-    }
-    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
-        if (errno == EINPROGRESS &&
-            flags & ANET_CONNECT_NONBLOCK)
-            return s;
+        if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
+            if (errno == EINPROGRESS && flags & ANET_CONNECT_NONBLOCK)
+                break;
 
-        anetSetError(err, "connect: %s", strerror(errno));
-        close(s);
-        return ANET_ERR;
+            anetSetError(err, "connect: %s", strerror(errno));
+            close(s);
+            s = ANET_ERR;
+            continue;
+        }
+        break; /* Connected. */
     }
+    freeaddrinfo(servinfo);
     return s;
 }
 
@@ -274,28 +306,92 @@ static int anetListen(char *err, int s, struct sockaddr *sa, socklen_t len) {
     return ANET_OK;
 }
 
-int anetTcpServer(char *err, int port, char *bindaddr)
-{
-    int s;
-    struct sockaddr_in sa;
+/* Options of a listening socket, that must be set before bind(2). */
+static int anetSetListenOptions(char *err, int s, int af, int reuseport) {
+    if (af == AF_INET6) {
+        int yes = 1;
 
-    if ((s = anetCreateSocket(err,AF_INET)) == ANET_ERR)
-        return ANET_ERR;
+        /* Listen on IPv6 only, IPv4 addresses are bound separately. */
+        if (setsockopt(s,IPPROTO_IPV6,IPV6_V6ONLY,&yes,sizeof(yes)) == -1) {
+            anetSetError(err, "setsockopt IPV6_V6ONLY: %s", strerror(errno));
+            close(s);
+            return ANET_ERR;
+        }
+    }
 
-    memset(&sa,0,sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    sa.sin_addr.s_addr = htonl(INADDR_ANY);
-    if (bindaddr && inet_aton(bindaddr, &sa.sin_addr) == 0) {
-        anetSetError(err, "invalid bind address");
+    /* With SO_REUSEPORT multiple processes can listen on the same address
+     * and port, the kernel balances the incoming connections among them. */
+    if (reuseport) {
+#ifdef SO_REUSEPORT
+        int on = 1;
+
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+            close(s);
+            return ANET_ERR;
+        }
+#else
+        anetSetError(err, "SO_REUSEPORT is not supported on this system");
         close(s);
         return ANET_ERR;
+#endif
     }
-    if (anetListen(err,s,(struct sockaddr*)&sa,sizeof(sa)) == ANET_ERR)
+    return ANET_OK;
+}
+
+/* Create a TCP listening socket for the address family 'af', bound to
+ * 'bindaddr' or to all the interfaces if 'bindaddr' is NULL. */
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af,
+                          int reuseport)
+{
+    int s = ANET_ERR, rv;
+    char portstr[6];  /* strlen("65535") + 1; */
+    struct addrinfo hints, *servinfo, *p;
+
+    snprintf(portstr,sizeof(portstr),"%d",port);
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = af;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;    /* No effect if bindaddr != NULL */
+
+    if ((rv = getaddrinfo(bindaddr,portstr,&hints,&servinfo)) != 0) {
+        anetSetError(err, "%s", gai_strerror(rv));
         return ANET_ERR;
+    }
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if ((s = anetCreateSocket(err,p->ai_family)) == ANET_ERR)
+            continue;
+        if (anetSetListenOptions(err,s,af,reuseport) == ANET_ERR ||
+            anetListen(err,s,p->ai_addr,p->ai_addrlen) == ANET_ERR)
+        {
+            s = ANET_ERR; /* The socket was already closed. */
+        }
+        break;
+    }
+    freeaddrinfo(servinfo);
     return s;
 }
 
+int anetTcpServer(char *err, int port, char *bindaddr)
+{
+    return _anetTcpServer(err,port,bindaddr,AF_INET,0);
+}
+
+int anetTcp6Server(char *err, int port, char *bindaddr)
+{
+    return _anetTcpServer(err,port,bindaddr,AF_INET6,0);
+}
+
+int anetTcpReusePortServer(char *err, int port, char *bindaddr)
+{
+    return _anetTcpServer(err,port,bindaddr,AF_INET,1);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr)
+{
+    return _anetTcpServer(err,port,bindaddr,AF_INET6,1);
+}
+
 int anetUnixServer(char *err, char *path, mode_t perm)
 {
     int s;
@@ -314,71 +410,125 @@ int anetUnixServer(char *err, char *path, mode_t perm)
     return s;
 }
 
-static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
+#define ANET_ACCEPT_NONE 0
+#define ANET_ACCEPT_NONBLOCK 1
+
+/* Note that when the listening socket is non blocking and there are no
+ * pending connections ANET_ERR is returned with errno set to EAGAIN, so
+ * the caller can tell it from a real error. */
+static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len, int flags) {
     int fd;
     while(1) {
+#ifdef HAVE_ACCEPT4
+        fd = accept4(s,sa,len,
+                     (flags & ANET_ACCEPT_NONBLOCK) ? SOCK_NONBLOCK : 0);
+#else
         fd = accept(s,sa,len);
+#endif
         if (fd == -1) {
             if (errno == EINTR)
                 continue;
             else {
+                int saved_errno = errno;
+
                 anetSetError(err, "accept: %s", strerror(errno));
+                errno = saved_errno;
                 return ANET_ERR;
             }
         }
         break;
     }
+#ifndef HAVE_ACCEPT4
+    if (flags & ANET_ACCEPT_NONBLOCK && anetNonBlock(err,fd) != ANET_OK) {
+        close(fd);
+        return ANET_ERR;
+    }
+#endif
     return fd;
 }
 
-int anetTcpAccept(char *err, int s, char *ip, int *port) {
+static int anetGenericTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port, int flags) {
     int fd;
-    struct sockaddr_in sa;
+    struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
-    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen)) == ANET_ERR)
+    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen,flags)) == ANET_ERR)
         return ANET_ERR;
 
-    if (ip) strcpy(ip,inet_ntoa(sa.sin_addr));
-    if (port) *port = ntohs(sa.sin_port);
+    anetSockaddrToString(&sa,ip,ip_len,port);
     return fd;
 }
 
-int anetUnixAccept(char *err, int s) {
-    int fd;
+int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
+    return anetGenericTcpAccept(err,s,ip,ip_len,port,ANET_ACCEPT_NONE);
+}
+
+int anetTcpNonBlockAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
+    return anetGenericTcpAccept(err,s,ip,ip_len,port,ANET_ACCEPT_NONBLOCK);
+}
+
+static int anetGenericUnixAccept(char *err, int s, int flags) {
     struct sockaddr_un sa;
     socklen_t salen = sizeof(sa);
-    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen)) == ANET_ERR)
-        return ANET_ERR;
 
-    return fd;
+    return anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen,flags);
+}
+
+int anetUnixAccept(char *err, int s) {
+    return anetGenericUnixAccept(err,s,ANET_ACCEPT_NONE);
 }
 
-int anetPeerToString(int fd, char *ip, int *port) {
-    struct sockaddr_in sa;
+int anetUnixNonBlockAccept(char *err, int s) {
+    return anetGenericUnixAccept(err,s,ANET_ACCEPT_NONBLOCK);
+}
+
+int anetPeerToString(int fd, char *ip, size_t ip_len, int *port) {
+    struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
 
-    if (getpeername(fd,(struct sockaddr*)&sa,&salen) == -1) {
-        *port = 0;
-        ip[0] = '?';
-        ip[1] = '\0';
+    if (getpeername(fd,(struct sockaddr*)&sa,&salen) == -1 ||
+        (sa.ss_family != AF_INET && sa.ss_family != AF_INET6))
+    {
+        if (port) *port = 0;
+        if (ip) {
+            ip[0] = '?';
+            ip[1] = '\0';
+        }
         return -1;
     }
-    if (ip) strcpy(ip,inet_ntoa(sa.sin_addr));
-    if (port) *port = ntohs(sa.sin_port);
+    anetSockaddrToString(&sa,ip,ip_len,port);
     return 0;
 }
 
-int anetSockName(int fd, char *ip, int *port) {
-    struct sockaddr_in sa;
+int anetSockName(int fd, char *ip, size_t ip_len, int *port) {
+    struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
 
-    if (getsockname(fd,(struct sockaddr*)&sa,&salen) == -1) {
-        *port = 0;
-        ip[0] = '?';
-        ip[1] = '\0';
+    if (getsockname(fd,(struct sockaddr*)&sa,&salen) == -1 ||
+        (sa.ss_family != AF_INET && sa.ss_family != AF_INET6))
+    {
+        if (port) *port = 0;
+        if (ip) {
+            ip[0] = '?';
+            ip[1] = '\0';
+        }
         return -1;
     }
-    if (ip) strcpy(ip,inet_ntoa(sa.sin_addr));
-    if (port) *port = ntohs(sa.sin_port);
+    anetSockaddrToString(&sa,ip,ip_len,port);
     return 0;
 }
+
+/* Format an address as "ip:port", or "[ip]:port" for IPv6 addresses so
+ * that the port can still be told apart. */
+int anetFormatAddr(char *buf, size_t buf_len, char *ip, int port) {
+    return snprintf(buf,buf_len,strchr(ip,':') ? "[%s]:%d" : "%s:%d",
+                    ip,port);
+}
+
+/* Like anetFormatAddr() but for the remote address of the socket. */
+int anetFormatPeer(int fd, char *buf, size_t buf_len) {
+    char ip[ANET_IP_STR_LEN];
+    int port;
+
+    anetPeerToString(fd,ip,sizeof(ip),&port);
+    return anetFormatAddr(buf,buf_len,ip,port);
+}
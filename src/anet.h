@@ -35,6 +35,11 @@
 #define ANET_ERR -1
 #define ANET_ERR_LEN 256
 
+/* Enough for IPv6 addresses, see INET6_ADDRSTRLEN. */
+#define ANET_IP_STR_LEN 46
+/* IP address plus brackets, colon and port, see anetFormatAddr(). */
+#define ANET_ADDR_STR_LEN (ANET_IP_STR_LEN+8)
+
 #if defined(__sun)
 #define AF_LOCAL AF_UNIX
 #endif
@@ -44,15 +49,23 @@ int anetTcpNonBlockConnect(char *err, char *addr, int port);
 int anetUnixConnect(char *err, char *path);
 int anetUnixNonBlockConnect(char *err, char *path);
 int anetRead(int fd, char *buf, int count);
-int anetResolve(char *err, char *host, char *ipbuf);
+int anetResolve(char *err, char *host, char *ipbuf, size_t ipbuf_len);
 int anetTcpServer(char *err, int port, char *bindaddr);
+int anetTcp6Server(char *err, int port, char *bindaddr);
+int anetTcpReusePortServer(char *err, int port, char *bindaddr);
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr);
 int anetUnixServer(char *err, char *path, mode_t perm);
-int anetTcpAccept(char *err, int serversock, char *ip, int *port);
+int anetTcpAccept(char *err, int serversock, char *ip, size_t ip_len, int *port);
+int anetTcpNonBlockAccept(char *err, int serversock, char *ip, size_t ip_len, int *port);
 int anetUnixAccept(char *err, int serversock);
+int anetUnixNonBlockAccept(char *err, int serversock);
 int anetWrite(int fd, char *buf, int count);
 int anetNonBlock(char *err, int fd);
 int anetTcpNoDelay(char *err, int fd);
 int anetTcpKeepAlive(char *err, int fd);
-int anetPeerToString(int fd, char *ip, int *port);
+int anetPeerToString(int fd, char *ip, size_t ip_len, int *port);
+int anetSockName(int fd, char *ip, size_t ip_len, int *port);
+int anetFormatAddr(char *buf, size_t buf_len, char *ip, int port);
+int anetFormatPeer(int fd, char *buf, size_t buf_len);
 
 #endif
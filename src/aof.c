@@ -415,8 +415,10 @@ struct redisClient *createFakeClient(void) {
     c->fd = -1;
     c->querybuf = sdsempty();
     c->querybuf_peak = 0;
+    c->qb_pos = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
     c->bufpos = 0;
     c->flags = 0;
     /* We set the fake client as a slave waiting for the synchronization
@@ -424,6 +426,7 @@ struct redisClient *createFakeClient(void) {
     c->replstate = REDIS_REPL_WAIT_BGSAVE_START;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->mem_usage = 0;
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     listSetFreeMethod(c->reply,decrRefCount);
@@ -440,6 +443,148 @@ void freeFakeClient(struct redisClient *c) {
     zfree(c);
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF loading.
+ *
+ * Reading and parsing the AOF is performed by a dedicated thread, while the
+ * main thread executes the commands, so that the two things can overlap.
+ * The reader thread groups the parsed commands into batches that are handed
+ * to the main thread using a bounded queue: when the queue is full the reader
+ * waits for the main thread to catch up, so at most AOF_LOAD_MAX_BATCHES
+ * batches of parsed (but not yet executed) commands are kept in memory.
+ *
+ * Commands are always executed by the main thread in the same order they
+ * appear in the file, so MULTI/EXEC blocks and commands touching multiple
+ * keys don't need any special handling.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_LOAD_BATCH_CMDS 1024    /* Max number of commands per batch. */
+#define AOF_LOAD_MAX_BATCHES 64     /* Max number of batches in the queue. */
+
+/* Return values of aofReadCommand() and status of an aofLoadBatch. */
+#define AOF_LOAD_OK 0       /* More commands to read. */
+#define AOF_LOAD_EOF 1      /* End of file reached without errors. */
+#define AOF_LOAD_READERR 2  /* Read error or truncated file. */
+#define AOF_LOAD_FMTERR 3   /* Bad file format. */
+
+typedef struct aofLoadCommand {
+    int argc;
+    robj **argv;
+} aofLoadCommand;
+
+typedef struct aofLoadBatch {
+    aofLoadCommand cmds[AOF_LOAD_BATCH_CMDS];
+    int numcmds;
+    int status;     /* AOF_LOAD_OK if more batches will follow. */
+    int read_errno; /* errno of the reader thread on AOF_LOAD_READERR. */
+    off_t pos;      /* File offset after the last command of the batch. */
+} aofLoadBatch;
+
+static struct aofLoader {
+    FILE *fp;
+    list *batches;              /* Parsed batches waiting to be executed. */
+    pthread_mutex_t mutex;
+    pthread_cond_t notempty;    /* Signaled when a batch is queued. */
+    pthread_cond_t notfull;     /* Signaled when a batch is dequeued. */
+} aofLoader;
+
+/* Read a single command in the Redis protocol format from the AOF.
+ * On success AOF_LOAD_OK is returned and the command arguments are stored
+ * in *argcp and *argvp. Otherwise one of the other AOF_LOAD_* codes. */
+static int aofReadCommand(FILE *fp, int *argcp, robj ***argvp) {
+    int argc, j;
+    unsigned long len;
+    robj **argv;
+    char buf[128];
+    sds argsds;
+
+    if (fgets(buf,sizeof(buf),fp) == NULL)
+        return feof(fp) ? AOF_LOAD_EOF : AOF_LOAD_READERR;
+    if (buf[0] != '*') return AOF_LOAD_FMTERR;
+    argc = atoi(buf+1);
+    if (argc < 1) return AOF_LOAD_FMTERR;
+
+    argv = zmalloc(sizeof(robj*)*argc);
+    for (j = 0; j < argc; j++) {
+        int err = AOF_LOAD_FMTERR;
+
+        if (fgets(buf,sizeof(buf),fp) == NULL) {
+            err = AOF_LOAD_READERR;
+            goto cleanup;
+        }
+        if (buf[0] != '$') goto cleanup;
+        len = strtol(buf+1,NULL,10);
+        argsds = sdsnewlen(NULL,len);
+        if (len && fread(argsds,len,1,fp) == 0) {
+            sdsfree(argsds);
+            goto cleanup;
+        }
+        argv[j] = createObject(REDIS_STRING,argsds);
+        if (fread(buf,2,1,fp) == 0) { /* discard CRLF */
+            j++;
+            goto cleanup;
+        }
+        continue;
+
+cleanup:
+        while(j--) decrRefCount(argv[j]);
+        zfree(argv);
+        return err;
+    }
+    *argcp = argc;
+    *argvp = argv;
+    return AOF_LOAD_OK;
+}
+
+/* Body of the reader thread: parse the file into batches of commands until
+ * the end of the file or an error is reached. */
+static void *aofLoadReaderThread(void *arg) {
+    REDIS_NOTUSED(arg);
+
+    while(1) {
+        aofLoadBatch *batch = zmalloc(sizeof(*batch));
+        int status = AOF_LOAD_OK;
+
+        batch->numcmds = 0;
+        while(batch->numcmds < AOF_LOAD_BATCH_CMDS) {
+            aofLoadCommand *cmd = batch->cmds+batch->numcmds;
+
+            status = aofReadCommand(aofLoader.fp,&cmd->argc,&cmd->argv);
+            if (status != AOF_LOAD_OK) break;
+            batch->numcmds++;
+        }
+        batch->status = status;
+        batch->read_errno = (status == AOF_LOAD_READERR) ? errno : 0;
+        batch->pos = ftello(aofLoader.fp);
+
+        pthread_mutex_lock(&aofLoader.mutex);
+        while (listLength(aofLoader.batches) >= AOF_LOAD_MAX_BATCHES)
+            pthread_cond_wait(&aofLoader.notfull,&aofLoader.mutex);
+        listAddNodeTail(aofLoader.batches,batch);
+        pthread_cond_signal(&aofLoader.notempty);
+        pthread_mutex_unlock(&aofLoader.mutex);
+
+        if (status != AOF_LOAD_OK) break;
+    }
+    return NULL;
+}
+
+/* Wait for the next batch parsed by the reader thread. */
+static aofLoadBatch *aofLoadNextBatch(void) {
+    aofLoadBatch *batch;
+    listNode *ln;
+
+    pthread_mutex_lock(&aofLoader.mutex);
+    while (listLength(aofLoader.batches) == 0)
+        pthread_cond_wait(&aofLoader.notempty,&aofLoader.mutex);
+    ln = listFirst(aofLoader.batches);
+    batch = ln->value;
+    listDelNode(aofLoader.batches,ln);
+    pthread_cond_signal(&aofLoader.notfull);
+    pthread_mutex_unlock(&aofLoader.mutex);
+    return batch;
+}
+
 /* Replay the append log file. On error REDIS_OK is returned. On non fatal
  * error (the append only file is zero-length) REDIS_ERR is returned. On
  * fatal error an error message is logged and the program exists. */
@@ -449,6 +594,8 @@ int loadAppendOnlyFile(char *filename) {
     struct redis_stat sb;
     int old_aof_state = server.aof_state;
     long loops = 0;
+    pthread_t reader;
+    int status, read_errno = 0;
 
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
         server.aof_current_size = 0;
@@ -468,63 +615,67 @@ int loadAppendOnlyFile(char *filename) {
     fakeClient = createFakeClient();
     startLoading(fp);
 
-    while(1) {
-        int argc, j;
-        unsigned long len;
-        robj **argv;
-        char buf[128];
-        sds argsds;
-        struct redisCommand *cmd;
-
-        /* Serve the clients from time to time */
-        if (!(loops++ % 1000)) {
-            loadingProgress(ftello(fp));
-            aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
-        }
+    /* Start the reader thread. */
+    aofLoader.fp = fp;
+    aofLoader.batches = listCreate();
+    pthread_mutex_init(&aofLoader.mutex,NULL);
+    pthread_cond_init(&aofLoader.notempty,NULL);
+    pthread_cond_init(&aofLoader.notfull,NULL);
+    if (pthread_create(&reader,NULL,aofLoadReaderThread,NULL) != 0) {
+        redisLog(REDIS_WARNING,"Fatal error: can't create the AOF reader thread");
+        exit(1);
+    }
 
-        if (fgets(buf,sizeof(buf),fp) == NULL) {
-            if (feof(fp))
-                break;
-            else
-                goto readerr;
-        }
-        if (buf[0] != '*') goto fmterr;
-        argc = atoi(buf+1);
-        if (argc < 1) goto fmterr;
-
-        argv = zmalloc(sizeof(robj*)*argc);
-        for (j = 0; j < argc; j++) {
-            if (fgets(buf,sizeof(buf),fp) == NULL) goto readerr;
-            if (buf[0] != '$') goto fmterr;
-            len = strtol(buf+1,NULL,10);
-            argsds = sdsnewlen(NULL,len);
-            if (len && fread(argsds,len,1,fp) == 0) goto fmterr;
-            argv[j] = createObject(REDIS_STRING,argsds);
-            if (fread(buf,2,1,fp) == 0) goto fmterr; /* discard CRLF */
-        }
+    do {
+        aofLoadBatch *batch = aofLoadNextBatch();
+        int i, j;
+
+        for (i = 0; i < batch->numcmds; i++) {
+            int argc = batch->cmds[i].argc;
+            robj **argv = batch->cmds[i].argv;
+            struct redisCommand *cmd;
 
-        /* Command lookup */
-        cmd = lookupCommand(argv[0]->ptr);
-        if (!cmd) {
-            redisLog(REDIS_WARNING,"Unknown command '%s' reading the append only file", argv[0]->ptr);
-            exit(1);
+            /* Serve the clients from time to time */
+            if (!(loops++ % 1000))
+                processEventsWhileBlocked();
+
+            /* Command lookup */
+            cmd = lookupCommand(argv[0]->ptr);
+            if (!cmd) {
+                redisLog(REDIS_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
+                exit(1);
+            }
+            /* Run the command in the context of a fake client */
+            fakeClient->argc = argc;
+            fakeClient->argv = argv;
+            cmd->proc(fakeClient);
+
+            /* The fake client should not have a reply */
+            redisAssert(fakeClient->bufpos == 0 && listLength(fakeClient->reply) == 0);
+            /* The fake client should never get blocked */
+            redisAssert((fakeClient->flags & REDIS_BLOCKED) == 0);
+
+            /* Clean up. Command code may have changed argv/argc so we use the
+             * argv/argc of the client instead of the local variables. */
+            for (j = 0; j < fakeClient->argc; j++)
+                decrRefCount(fakeClient->argv[j]);
+            zfree(fakeClient->argv);
         }
-        /* Run the command in the context of a fake client */
-        fakeClient->argc = argc;
-        fakeClient->argv = argv;
-        cmd->proc(fakeClient);
-
-        /* The fake client should not have a reply */
-        redisAssert(fakeClient->bufpos == 0 && listLength(fakeClient->reply) == 0);
-        /* The fake client should never get blocked */
-        redisAssert((fakeClient->flags & REDIS_BLOCKED) == 0);
-
-        /* Clean up. Command code may have changed argv/argc so we use the
-         * argv/argc of the client instead of the local variables. */
-        for (j = 0; j < fakeClient->argc; j++)
-            decrRefCount(fakeClient->argv[j]);
-        zfree(fakeClient->argv);
-    }
+        loadingProgress(batch->pos);
+        status = batch->status;
+        read_errno = batch->read_errno;
+        zfree(batch);
+    } while(status == AOF_LOAD_OK);
+
+    /* The reader thread already exited or is exiting, as the last batch
+     * was received. */
+    pthread_join(reader,NULL);
+    listRelease(aofLoader.batches);
+    pthread_mutex_destroy(&aofLoader.mutex);
+    pthread_cond_destroy(&aofLoader.notempty);
+    pthread_cond_destroy(&aofLoader.notfull);
+    if (status == AOF_LOAD_READERR) goto readerr;
+    if (status == AOF_LOAD_FMTERR) goto fmterr;
 
     /* This point can only be reached when EOF is reached without errors.
      * If the client is in the middle of a MULTI/EXEC, log error and quit. */
@@ -542,7 +693,7 @@ readerr:
     if (feof(fp)) {
         redisLog(REDIS_WARNING,"Unexpected end of file reading the append only file");
     } else {
-        redisLog(REDIS_WARNING,"Unrecoverable error reading the append only file: %s", strerror(errno));
+        redisLog(REDIS_WARNING,"Unrecoverable error reading the append only file: %s", strerror(read_errno));
     }
     exit(1);
 fmterr:
@@ -924,15 +1075,23 @@ int rewriteAppendOnlyFileBackground(void) {
     long long start;
 
     if (server.aof_child_pid != -1) return REDIS_ERR;
+    openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
         char tmpfile[256];
 
         /* Child */
-        if (server.ipfd > 0) close(server.ipfd);
-        if (server.sofd > 0) close(server.sofd);
+        closeListeningSockets();
         snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());
         if (rewriteAppendOnlyFile(tmpfile) == REDIS_OK) {
+            size_t private_dirty = zmalloc_get_private_dirty();
+
+            if (private_dirty) {
+                redisLog(REDIS_NOTICE,
+                    "AOF rewrite: %zu MB of memory used by copy-on-write",
+                    private_dirty/(1024*1024));
+            }
+            sendChildInfo(REDIS_CHILD_INFO_TYPE_AOF,private_dirty);
             exitFromChild(0);
         } else {
             exitFromChild(1);
@@ -941,13 +1100,15 @@ int rewriteAppendOnlyFileBackground(void) {
         /* Parent */
         server.stat_fork_time = ustime()-start;
         if (childpid == -1) {
+            closeChildInfoPipe();
             redisLog(REDIS_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
             return REDIS_ERR;
         }
         redisLog(REDIS_NOTICE,
-            "Background append only file rewriting started by pid %d",childpid);
+            "Background append only file rewriting started by pid %d "
+            "(fork took %lld usec)",childpid,server.stat_fork_time);
         server.aof_rewrite_scheduled = 0;
         server.aof_rewrite_time_start = time(NULL);
         server.aof_child_pid = childpid;
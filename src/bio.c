@@ -1,10 +1,11 @@
 /* Background I/O service for Redis.
  *
  * This file implements operations that we need to perform in the background.
- * Currently there is only a single operation, that is a background close(2)
- * system call. This is needed as when the process is the last owner of a
- * reference to a file closing it means unlinking it, and the deletion of the
- * file is slow, blocking the server.
+ * The first operation implemented was a background close(2) system call.
+ * This is needed as when the process is the last owner of a reference to a
+ * file closing it means unlinking it, and the deletion of the file is slow,
+ * blocking the server. The AOF fsync(2) and the rewrite of the Redis Cluster
+ * nodes configuration file are performed in background as well.
  *
  * In the future we'll either continue implementing new things we need or
  * we'll switch to libeio. However there are probably long term uses for this
@@ -140,6 +141,10 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == REDIS_BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == REDIS_BIO_CLUSTER_SAVE) {
+            clusterWriteConfigFile(job->arg1,job->arg2);
+            zfree(job->arg1);
+            sdsfree(job->arg2);
         } else {
             redisPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -0,0 +1,112 @@
+/* Child -> parent information channel.
+ *
+ * Children created with fork() in order to produce an RDB file or to rewrite
+ * the AOF perform their work against a copy-on-write snapshot of the parent
+ * memory. The amount of memory duplicated because of copy-on-write is only
+ * visible from the child itself (it is the private dirty memory of the child
+ * process), so before exiting the child reports it to the parent using a pipe
+ * created just before calling fork().
+ *
+ * Copyright (c) 2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+
+#include <unistd.h>
+
+/* Open a child-parent channel used in order to move information about the
+ * RDB / AOF saving process from the child to the parent (for instance
+ * the amount of copy on write memory used). If the pipe can't be created
+ * the channel is simply disabled, as this information is not vital.
+ *
+ * An RDB child and an AOF rewrite child may be active at the same time, in
+ * that case they share the same pipe: messages are smaller than PIPE_BUF so
+ * writes are atomic, and every message is tagged with the process type. */
+void openChildInfoPipe(void) {
+    if (server.child_info_pipe[0] != -1) return; /* Already open. */
+    if (pipe(server.child_info_pipe) == -1) {
+        /* On error our two file descriptors should be still set to -1,
+         * but we call closeChildInfoPipe() anyway since it can't hurt. */
+        closeChildInfoPipe();
+    } else if (anetNonBlock(NULL,server.child_info_pipe[0]) != ANET_OK) {
+        closeChildInfoPipe();
+    } else {
+        memset(&server.child_info_data,0,sizeof(server.child_info_data));
+    }
+}
+
+/* Close the pipes opened with openChildInfoPipe(). The pipe is only closed
+ * when no child is using it anymore. */
+void closeChildInfoPipe(void) {
+    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) return;
+    if (server.child_info_pipe[0] != -1 ||
+        server.child_info_pipe[1] != -1)
+    {
+        close(server.child_info_pipe[0]);
+        close(server.child_info_pipe[1]);
+        server.child_info_pipe[0] = -1;
+        server.child_info_pipe[1] = -1;
+    }
+}
+
+/* Send COW data to the parent. The child calls this function just before
+ * exiting, once its work is done, so that the private dirty memory measured
+ * is the peak copy-on-write memory used during the whole saving process.
+ * The caller measures it with zmalloc_get_private_dirty() and passes it as
+ * 'cow_size', since it also logs it and reading smaps is not cheap.
+ * The checksum of the RDB file written is sent as well, since it is used
+ * to identify the base file of delta RDB files. */
+void sendChildInfo(int ptype, size_t cow_size) {
+    ssize_t wlen = sizeof(server.child_info_data);
+
+    if (server.child_info_pipe[1] == -1) return;
+    server.child_info_data.magic = REDIS_CHILD_INFO_MAGIC;
+    server.child_info_data.process_type = ptype;
+    server.child_info_data.cow_size = cow_size;
+    server.child_info_data.rdb_cksum = server.rdb_save_cksum;
+    if (write(server.child_info_pipe[1],&server.child_info_data,wlen) != wlen) {
+        /* Nothing to do on error, this will be detected by the other side. */
+    }
+}
+
+/* Receive COW data from the child. Called by the parent once a child
+ * terminated with success, so all the data is already in the pipe. */
+void receiveChildInfo(void) {
+    ssize_t wlen = sizeof(server.child_info_data);
+
+    if (server.child_info_pipe[0] == -1) return;
+    while (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen) {
+        if (server.child_info_data.magic != REDIS_CHILD_INFO_MAGIC) continue;
+        if (server.child_info_data.process_type == REDIS_CHILD_INFO_TYPE_RDB) {
+            server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
+            server.rdb_child_cksum = server.child_info_data.rdb_cksum;
+            server.rdb_child_cksum_received = 1;
+        } else if (server.child_info_data.process_type == REDIS_CHILD_INFO_TYPE_AOF)
+            server.stat_aof_cow_bytes = server.child_info_data.cow_size;
+    }
+}
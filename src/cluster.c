@@ -1,5 +1,6 @@
 #include "redis.h"
 #include "endianconv.h"
+#include "bio.h"
 
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -46,8 +47,9 @@ int clusterLoadConfig(char *filename) {
             n = createClusterNode(argv[0],0);
             clusterAddNode(n);
         }
-        /* Address and port */
-        if ((p = strchr(argv[1],':')) == NULL) goto fmterr;
+        /* Address and port. Search the last colon, since IPv6 addresses
+         * contain colons as well. */
+        if ((p = strrchr(argv[1],':')) == NULL) goto fmterr;
         *p = '\0';
         memcpy(n->ip,argv[1],strlen(argv[1])+1);
         n->port = atoi(p+1);
@@ -154,24 +156,80 @@ fmterr:
 
 /* Cluster node configuration is exactly the same as CLUSTER NODES output.
  *
- * This function writes the node config and returns 0, on error -1
- * is returned. */
-int clusterSaveConfig(void) {
-    sds ci = clusterGenNodesDescription();
-    int fd;
-    
-    if ((fd = open(server.cluster.configfile,O_WRONLY|O_CREAT|O_TRUNC,0644))
-        == -1) goto err;
-    if (write(fd,ci,sdslen(ci)) != (ssize_t)sdslen(ci)) goto err;
+ * The config is written in a temporary file that is then renamed, so that
+ * a crash while saving can't leave a truncated file around. This function
+ * is also called by the bio.c thread, so it must only use thread safe calls.
+ *
+ * On success 0 is returned, otherwise -1 is returned and errno is set. */
+static int clusterWriteConfig(char *filename, sds config) {
+    sds tmpfile = sdscatprintf(sdsempty(),"%s.tmp-%d",filename,(int)getpid());
+    int fd, saved_errno;
+
+    if ((fd = open(tmpfile,O_WRONLY|O_CREAT|O_TRUNC,0644)) == -1) goto err;
+    if (write(fd,config,sdslen(config)) != (ssize_t)sdslen(config) ||
+        aof_fsync(fd) == -1)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        goto err;
+    }
     close(fd);
-    sdsfree(ci);
+    if (rename(tmpfile,filename) == -1) goto err;
+    sdsfree(tmpfile);
     return 0;
 
 err:
-    sdsfree(ci);
+    saved_errno = errno;
+    unlink(tmpfile);
+    sdsfree(tmpfile);
+    errno = saved_errno;
     return -1;
 }
 
+/* Protects the save error state shared with the bio.c thread. */
+static pthread_mutex_t cluster_save_err_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Entry point of the REDIS_BIO_CLUSTER_SAVE background job. Errors are
+ * only flagged here together with the errno: logging is not thread safe,
+ * so the main thread will log and exit in clusterBeforeSleep(). */
+void clusterWriteConfigFile(char *filename, sds config) {
+    if (clusterWriteConfig(filename,config) == -1) {
+        int saved_errno = errno;
+
+        pthread_mutex_lock(&cluster_save_err_mutex);
+        server.cluster.save_config_err = 1;
+        server.cluster.save_config_errno = saved_errno;
+        pthread_mutex_unlock(&cluster_save_err_mutex);
+    }
+}
+
+/* Exit if the last background save of the config failed. */
+static void clusterCheckSaveError(void) {
+    int err, saved_errno;
+
+    pthread_mutex_lock(&cluster_save_err_mutex);
+    err = server.cluster.save_config_err;
+    saved_errno = server.cluster.save_config_errno;
+    pthread_mutex_unlock(&cluster_save_err_mutex);
+    if (err) {
+        redisLog(REDIS_WARNING,"Error saving the cluster config file %s: %s",
+            server.cluster.configfile, strerror(saved_errno));
+        redisLog(REDIS_WARNING,"Fatal: can't update cluster config file.");
+        exit(1);
+    }
+}
+
+/* Save the cluster config synchronously. This function returns 0 on
+ * success, otherwise -1 is returned. */
+int clusterSaveConfig(void) {
+    sds ci = clusterGenNodesDescription();
+    int retval = clusterWriteConfig(server.cluster.configfile,ci);
+
+    sdsfree(ci);
+    return retval;
+}
+
 void clusterSaveConfigOrDie(void) {
     if (clusterSaveConfig() == -1) {
         redisLog(REDIS_WARNING,"Fatal: can't update cluster config file.");
@@ -179,8 +237,41 @@ void clusterSaveConfigOrDie(void) {
     }
 }
 
+/* Flag the config as changed: it will be saved in background before
+ * returning to the event loop, so that a burst of updates, like many nodes
+ * changing state while processing the same batch of packets, results in a
+ * single write. */
+void clusterSaveConfigLater(void) {
+    server.cluster.todo_save_config = 1;
+}
+
+/* Called before entering the event loop. If the config changed we generate
+ * it here, in the main thread, and leave the disk I/O to the bio.c thread.
+ * While a save is still in progress the new one is delayed, so that no more
+ * than a single job is ever queued: the next save will include all the
+ * changes happened meanwhile. */
+void clusterBeforeSleep(void) {
+    clusterCheckSaveError();
+    if (!server.cluster.todo_save_config) return;
+    if (bioPendingJobsOfType(REDIS_BIO_CLUSTER_SAVE)) return;
+    bioCreateBackgroundJob(REDIS_BIO_CLUSTER_SAVE,
+        zstrdup(server.cluster.configfile),clusterGenNodesDescription(),NULL);
+    server.cluster.todo_save_config = 0;
+}
+
+/* Wait for the background save in progress, if any, and save the config
+ * synchronously if there are changes not yet saved. Used on shutdown. */
+void clusterFlushConfig(void) {
+    while(bioPendingJobsOfType(REDIS_BIO_CLUSTER_SAVE)) usleep(1000);
+    clusterCheckSaveError();
+    if (server.cluster.todo_save_config) {
+        clusterSaveConfigOrDie();
+        server.cluster.todo_save_config = 0;
+    }
+}
+
 void clusterInit(void) {
-    int saveconf = 0;
+    int saveconf = 0, j;
 
     server.cluster.myself = NULL;
     server.cluster.state = REDIS_CLUSTER_FAIL;
@@ -192,6 +283,9 @@ void clusterInit(void) {
         sizeof(server.cluster.importing_slots_from));
     memset(server.cluster.slots,0,
         sizeof(server.cluster.slots));
+    server.cluster.todo_save_config = 0;
+    server.cluster.save_config_err = 0;
+    server.cluster.save_config_errno = 0;
     if (clusterLoadConfig(server.cluster.configfile) == REDIS_ERR) {
         /* No configuration found. We will just use the random name provided
          * by the createClusterNode() function. */
@@ -202,16 +296,22 @@ void clusterInit(void) {
         saveconf = 1;
     }
     if (saveconf) clusterSaveConfigOrDie();
-    /* We need a listening TCP port for our cluster messaging needs */
-    server.cfd = anetTcpServer(server.neterr,
-            server.port+REDIS_CLUSTER_PORT_INCR, server.bindaddr);
-    if (server.cfd == -1) {
-        redisLog(REDIS_WARNING, "Opening cluster TCP port: %s", server.neterr);
+    /* We need a listening TCP port for our cluster messaging needs, on the
+     * same addresses the server is bound to. */
+    server.cfd_count = 0;
+    if (listenToPort(server.port+REDIS_CLUSTER_PORT_INCR,
+        server.cfd,&server.cfd_count) == REDIS_ERR)
+    {
         exit(1);
     }
-    if (aeCreateFileEvent(server.el, server.cfd, AE_READABLE,
-        clusterAcceptHandler, NULL) == AE_ERR) redisPanic("Unrecoverable error creating Redis Cluster file event.");
-    server.cluster.slots_to_keys = zslCreate();
+    for (j = 0; j < server.cfd_count; j++) {
+        if (aeCreateFileEvent(server.el, server.cfd[j], AE_READABLE,
+            clusterAcceptHandler, NULL) == AE_ERR)
+            redisPanic("Unrecoverable error creating Redis Cluster "
+                       "file event.");
+    }
+    memset(server.cluster.slots_to_keys,0,
+        sizeof(server.cluster.slots_to_keys));
 }
 
 /* -----------------------------------------------------------------------------
@@ -224,6 +324,7 @@ clusterLink *createClusterLink(clusterNode *node) {
     link->rcvbuf = sdsempty();
     link->node = node;
     link->fd = -1;
+    link->peer_slots_digest = 0; /* Digest of an empty slots bitmap. */
     return link;
 }
 
@@ -245,14 +346,14 @@ void freeClusterLink(clusterLink *link) {
 
 void clusterAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cport, cfd;
-    char cip[128];
+    char cip[REDIS_IP_STR_LEN];
     clusterLink *link;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
     REDIS_NOTUSED(privdata);
 
-    cfd = anetTcpAccept(server.neterr, fd, cip, &cport);
-    if (cfd == AE_ERR) {
+    cfd = anetTcpAccept(server.neterr,fd,cip,sizeof(cip),&cport);
+    if (cfd == ANET_ERR) {
         redisLog(REDIS_VERBOSE,"Accepting cluster node: %s", server.neterr);
         return;
     }
@@ -269,12 +370,6 @@ void clusterAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  * Key space handling
  * -------------------------------------------------------------------------- */
 
-/* We have 4096 hash slots. The hash slot of a given key is obtained
- * as the least significant 12 bits of the crc16 of the key. */
-unsigned int keyHashSlot(char *key, int keylen) {
-    return crc16(key,keylen) & 0x0FFF;
-}
-
 /* -----------------------------------------------------------------------------
  * CLUSTER node API
  * -------------------------------------------------------------------------- */
@@ -442,7 +537,7 @@ void clusterProcessGossipSection(clusterMsg *hdr, clusterLink *link) {
                 /* Broadcast the failing node name to everybody */
                 clusterSendFail(node->name);
                 clusterUpdateState();
-                clusterSaveConfigOrDie();
+                clusterSaveConfigLater();
             }
         } else {
             /* If it's not in NOADDR state and we don't have it, we
@@ -467,14 +562,11 @@ void clusterProcessGossipSection(clusterMsg *hdr, clusterLink *link) {
     }
 }
 
-/* IP -> string conversion. 'buf' is supposed to at least be 16 bytes. */
+/* IP -> string conversion. 'buf' is supposed to at least be
+ * REDIS_IP_STR_LEN bytes. */
 void nodeIp2String(char *buf, clusterLink *link) {
-    struct sockaddr_in sa;
-    socklen_t salen = sizeof(sa);
-
-    if (getpeername(link->fd, (struct sockaddr*) &sa, &salen) == -1)
+    if (anetPeerToString(link->fd,buf,REDIS_IP_STR_LEN,NULL) == -1)
         redisPanic("getpeername() failed.");
-    strncpy(buf,inet_ntoa(sa.sin_addr),sizeof(link->node->ip));
 }
 
 
@@ -484,6 +576,44 @@ void nodeUpdateAddress(clusterNode *node, clusterLink *link, int port) {
     /* TODO */
 }
 
+/* Return the length of the slots section of a PING, PONG or MEET message
+ * accordingly to its header, or -1 if the encoding is invalid. */
+static int clusterMsgSlotsLen(clusterMsg *hdr) {
+    switch(hdr->slots_encoding) {
+    case CLUSTERMSG_SLOTS_NONE: return 0;
+    case CLUSTERMSG_SLOTS_RANGES:
+        return ntohs(hdr->slots_count)*sizeof(clusterMsgSlotRange);
+    case CLUSTERMSG_SLOTS_BITMAP: return REDIS_CLUSTER_SLOTS/8;
+    default: return -1;
+    }
+}
+
+/* Decode the slots section of a PONG message into the 'slots' bitmap.
+ * Returns 0 if the message does not include the slots, since the sender
+ * knows we already have them, otherwise 1. */
+static int clusterMsgGetSlots(clusterMsg *hdr, unsigned char *slots) {
+    unsigned char *p = (unsigned char*) hdr->data.ping.gossip +
+        ntohs(hdr->count)*sizeof(clusterMsgDataGossip);
+    clusterMsgSlotRange *r = (clusterMsgSlotRange*) p;
+    int count, j;
+
+    if (hdr->slots_encoding == CLUSTERMSG_SLOTS_NONE) return 0;
+    if (hdr->slots_encoding == CLUSTERMSG_SLOTS_BITMAP) {
+        memcpy(slots,p,REDIS_CLUSTER_SLOTS/8);
+        return 1;
+    }
+    memset(slots,0,REDIS_CLUSTER_SLOTS/8);
+    count = ntohs(hdr->slots_count);
+    while(count--) {
+        int start = ntohs(r->start), end = ntohs(r->end);
+
+        if (end >= REDIS_CLUSTER_SLOTS) end = REDIS_CLUSTER_SLOTS-1;
+        for (j = start; j <= end; j++) slots[j/8] |= 1<<(j&7);
+        r++;
+    }
+    return 1;
+}
+
 /* When this function is called, there is a packet to process starting
  * at node->rcvbuf. Releasing the buffer is up to the caller, so this
  * function should just handle the higher level stuff of processing the
@@ -511,8 +641,11 @@ int clusterProcessPacket(clusterLink *link) {
         uint16_t count = ntohs(hdr->count);
         uint32_t explen; /* expected length of this packet */
 
+        int slotslen = clusterMsgSlotsLen(hdr);
+
+        if (slotslen == -1) return 1;
         explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
-        explen += (sizeof(clusterMsgDataGossip)*count);
+        explen += (sizeof(clusterMsgDataGossip)*count) + slotslen;
         if (totlen != explen) return 1;
     }
     if (type == CLUSTERMSG_TYPE_FAIL) {
@@ -553,14 +686,17 @@ int clusterProcessPacket(clusterLink *link) {
         /* Get info from the gossip section */
         clusterProcessGossipSection(hdr,link);
 
-        /* Anyway reply with a PONG */
+        /* Anyway reply with a PONG, including our slots only if the
+         * sender does not know them already. */
+        link->peer_slots_digest = hdr->slots_digest;
         clusterSendPing(link,CLUSTERMSG_TYPE_PONG);
 
         /* Update config if needed */
-        if (update_config) clusterSaveConfigOrDie();
+        if (update_config) clusterSaveConfigLater();
     } else if (type == CLUSTERMSG_TYPE_PONG) {
         int update_state = 0;
         int update_config = 0;
+        unsigned char slots[REDIS_CLUSTER_SLOTS/8];
 
         redisLog(REDIS_DEBUG,"Pong packet received: %p", link->node);
         if (link->node) {
@@ -623,12 +759,13 @@ int clusterProcessPacket(clusterLink *link) {
 
         /* Update our info about served slots if this new node is serving
          * slots that are not served from our point of view. */
-        if (sender && sender->flags & REDIS_NODE_MASTER) {
+        if (sender && sender->flags & REDIS_NODE_MASTER &&
+            clusterMsgGetSlots(hdr,slots))
+        {
             int newslots, j;
 
-            newslots =
-                memcmp(sender->slots,hdr->myslots,sizeof(hdr->myslots)) != 0;
-            memcpy(sender->slots,hdr->myslots,sizeof(hdr->myslots));
+            newslots = memcmp(sender->slots,slots,sizeof(slots)) != 0;
+            memcpy(sender->slots,slots,sizeof(slots));
             if (newslots) {
                 for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) {
                     if (clusterNodeGetSlotBit(sender,j)) {
@@ -649,7 +786,7 @@ int clusterProcessPacket(clusterLink *link) {
 
         /* Update the cluster state if needed */
         if (update_state) clusterUpdateState();
-        if (update_config) clusterSaveConfigOrDie();
+        if (update_config) clusterSaveConfigLater();
     } else if (type == CLUSTERMSG_TYPE_FAIL && sender) {
         clusterNode *failing;
 
@@ -662,7 +799,7 @@ int clusterProcessPacket(clusterLink *link) {
             failing->flags |= REDIS_NODE_FAIL;
             failing->flags &= ~REDIS_NODE_PFAIL;
             clusterUpdateState();
-            clusterSaveConfigOrDie();
+            clusterSaveConfigLater();
         }
     } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
         robj *channel, *message;
@@ -797,8 +934,6 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
     memset(hdr,0,sizeof(*hdr));
     hdr->type = htons(type);
     memcpy(hdr->sender,server.cluster.myself->name,REDIS_CLUSTER_NAMELEN);
-    memcpy(hdr->myslots,server.cluster.myself->slots,
-        sizeof(hdr->myslots));
     memset(hdr->slaveof,0,REDIS_CLUSTER_NAMELEN);
     if (server.cluster.myself->slaveof != NULL) {
         memcpy(hdr->slaveof,server.cluster.myself->slaveof->name,
@@ -816,12 +951,58 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
     /* For PING, PONG, and MEET, fixing the totlen field is up to the caller */
 }
 
+/* Return the digest of a slots bitmap. PING and MEET packets carry the
+ * digest of the slots of the receiver as known by the sender, so that the
+ * receiver can omit its slots from the PONG if they are already known. */
+static uint64_t clusterSlotsDigest(unsigned char *slots) {
+    return intrev64ifbe(crc64(0,slots,REDIS_CLUSTER_SLOTS/8));
+}
+
+/* Append the slots served by this node to the message at offset 'len',
+ * setting the encoding fields of the header. Ranges are used unless the
+ * bitmap is smaller, so the buffer needs to have REDIS_CLUSTER_SLOTS/8
+ * bytes available after 'len'. Returns the new length of the message. */
+static uint32_t clusterMsgAddSlots(clusterMsg *hdr, uint32_t len) {
+    clusterNode *myself = server.cluster.myself;
+    clusterMsgSlotRange *r = (clusterMsgSlotRange*) ((char*)hdr+len);
+    int j, count = 0;
+
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) {
+        if (clusterNodeGetSlotBit(myself,j) &&
+            (j == 0 || !clusterNodeGetSlotBit(myself,j-1))) count++;
+    }
+    if (count*sizeof(clusterMsgSlotRange) >= sizeof(myself->slots)) {
+        hdr->slots_encoding = CLUSTERMSG_SLOTS_BITMAP;
+        memcpy((char*)hdr+len,myself->slots,sizeof(myself->slots));
+        return len+sizeof(myself->slots);
+    }
+
+    hdr->slots_encoding = CLUSTERMSG_SLOTS_RANGES;
+    hdr->slots_count = htons(count);
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) {
+        if (!clusterNodeGetSlotBit(myself,j)) continue;
+        r->start = htons(j);
+        while(j+1 < REDIS_CLUSTER_SLOTS && clusterNodeGetSlotBit(myself,j+1))
+            j++;
+        r->end = htons(j);
+        r++;
+    }
+    return len+count*sizeof(clusterMsgSlotRange);
+}
+
 /* Send a PING or PONG packet to the specified node, making sure to add enough
- * gossip informations. */
+ * gossip informations.
+ *
+ * The number of nodes in the gossip section grows with the size of the
+ * cluster (a tenth of the known nodes, but at least REDIS_CLUSTER_MIN_GOSSIP)
+ * so that in big clusters the information about every node still spreads
+ * in a few ping periods. PONG packets also carry our slots, unless the
+ * PING we are replying to shows the receiver already knows them. */
 void clusterSendPing(clusterLink *link, int type) {
-    unsigned char buf[1024];
-    clusterMsg *hdr = (clusterMsg*) buf;
-    int gossipcount = 0, totlen;
+    unsigned char *buf;
+    clusterMsg *hdr;
+    int gossipcount = 0, wanted;
+    uint32_t totlen;
     /* freshnodes is the number of nodes we can still use to populate the
      * gossip section of the ping packet. Basically we start with the nodes
      * we have in memory minus two (ourself and the node we are sending the
@@ -830,12 +1011,23 @@ void clusterSendPing(clusterLink *link, int type) {
      * send. */
     int freshnodes = dictSize(server.cluster.nodes)-2;
 
+    wanted = dictSize(server.cluster.nodes)/10;
+    if (wanted < REDIS_CLUSTER_MIN_GOSSIP) wanted = REDIS_CLUSTER_MIN_GOSSIP;
+    if (wanted > freshnodes) wanted = freshnodes > 0 ? freshnodes : 0;
+
+    totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
+    buf = zcalloc(totlen+sizeof(clusterMsgDataGossip)*wanted+
+                  REDIS_CLUSTER_SLOTS/8);
+    hdr = (clusterMsg*) buf;
+
     if (link->node && type == CLUSTERMSG_TYPE_PING)
         link->node->ping_sent = time(NULL);
     clusterBuildMessageHdr(hdr,type);
-        
+    if (type != CLUSTERMSG_TYPE_PONG && link->node)
+        hdr->slots_digest = clusterSlotsDigest(link->node->slots);
+
     /* Populate the gossip fields */
-    while(freshnodes > 0 && gossipcount < 3) {
+    while(freshnodes > 0 && gossipcount < wanted) {
         struct dictEntry *de = dictGetRandomKey(server.cluster.nodes);
         clusterNode *this = dictGetVal(de);
         clusterMsgDataGossip *gossip;
@@ -867,11 +1059,16 @@ void clusterSendPing(clusterLink *link, int type) {
         gossip->flags = htons(this->flags);
         gossipcount++;
     }
-    totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
     totlen += (sizeof(clusterMsgDataGossip)*gossipcount);
+    if (type == CLUSTERMSG_TYPE_PONG && link->peer_slots_digest !=
+        clusterSlotsDigest(server.cluster.myself->slots))
+    {
+        totlen = clusterMsgAddSlots(hdr,totlen);
+    }
     hdr->count = htons(gossipcount);
     hdr->totlen = htonl(totlen);
     clusterSendMessage(link,buf,totlen);
+    zfree(buf);
 }
 
 /* Send a PUBLISH message.
@@ -1007,6 +1204,23 @@ void clusterCron(void) {
         clusterSendPing(min_ping_node->link, CLUSTERMSG_TYPE_PING);
     }
 
+    /* In big clusters the random sampling above may take a long time to
+     * select a given node, so we also ping every node we did not hear from
+     * in the last half node timeout, if no ping is already in flight.
+     * Otherwise it could be flagged as failing just because we did not
+     * ping it recently enough. */
+    di = dictGetIterator(server.cluster.nodes);
+    while((de = dictNext(di)) != NULL) {
+        clusterNode *node = dictGetVal(de);
+
+        if (node->link == NULL || node == min_ping_node) continue;
+        if (node->flags & (REDIS_NODE_MYSELF|REDIS_NODE_HANDSHAKE)) continue;
+        if (node->ping_sent > node->pong_received) continue;
+        if (time(NULL) - node->pong_received > server.cluster.node_timeout/2)
+            clusterSendPing(node->link, CLUSTERMSG_TYPE_PING);
+    }
+    dictReleaseIterator(di);
+
     /* Iterate nodes to check if we need to flag something as failing */
     di = dictGetIterator(server.cluster.nodes);
     while((de = dictNext(di)) != NULL) {
@@ -1182,7 +1396,7 @@ sds clusterGenNodesDescription(void) {
                 if (start == -1) start = j;
             }
             if (start != -1 && (!bit || j == REDIS_CLUSTER_SLOTS-1)) {
-                if (j == REDIS_CLUSTER_SLOTS-1) j++;
+                if (bit && j == REDIS_CLUSTER_SLOTS-1) j++;
 
                 if (start == j-1) {
                     ci = sdscatprintf(ci," %d",start);
@@ -1233,11 +1447,16 @@ void clusterCommand(redisClient *c) {
 
     if (!strcasecmp(c->argv[1]->ptr,"meet") && c->argc == 4) {
         clusterNode *n;
-        struct sockaddr_in sa;
+        struct sockaddr_storage sa;
         long port;
+        int af;
 
         /* Perform sanity checks on IP/port */
-        if (inet_aton(c->argv[2]->ptr,&sa.sin_addr) == 0) {
+        af = strchr(c->argv[2]->ptr,':') ? AF_INET6 : AF_INET;
+        if (inet_pton(af,c->argv[2]->ptr,
+            af == AF_INET ? (void*)&((struct sockaddr_in*)&sa)->sin_addr :
+                            (void*)&((struct sockaddr_in6*)&sa)->sin6_addr) != 1)
+        {
             addReplyError(c,"Invalid IP address in MEET");
             return;
         }
@@ -1251,7 +1470,11 @@ void clusterCommand(redisClient *c) {
         /* Finally add the node to the cluster with a random name, this 
          * will get fixed in the first handshake (ping/pong). */
         n = createClusterNode(NULL,REDIS_NODE_HANDSHAKE|REDIS_NODE_MEET);
-        strncpy(n->ip,inet_ntoa(sa.sin_addr),sizeof(n->ip));
+        /* Store the address in its canonical form. */
+        inet_ntop(af,
+            af == AF_INET ? (void*)&((struct sockaddr_in*)&sa)->sin_addr :
+                            (void*)&((struct sockaddr_in6*)&sa)->sin6_addr,
+            n->ip,sizeof(n->ip));
         n->port = port;
         clusterAddNode(n);
         addReply(c,shared.ok);
@@ -1311,7 +1534,7 @@ void clusterCommand(redisClient *c) {
         }
         zfree(slots);
         clusterUpdateState();
-        clusterSaveConfigOrDie();
+        clusterSaveConfigLater();
         addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"setslot") && c->argc >= 4) {
         /* SETSLOT 10 MIGRATING <node ID> */
@@ -1361,13 +1584,7 @@ void clusterCommand(redisClient *c) {
             if (server.cluster.slots[slot] == server.cluster.myself &&
                 n != server.cluster.myself)
             {
-                int numkeys;
-                robj **keys;
-
-                keys = zmalloc(sizeof(robj*)*1);
-                numkeys = GetKeysInSlot(slot, keys, 1);
-                zfree(keys);
-                if (numkeys != 0) {
+                if (CountKeysInSlot(slot) != 0) {
                     addReplyErrorFormat(c, "Can't assign hashslot %d to a different node while I still hold keys for this hash slot.", slot);
                     return;
                 }
@@ -1390,7 +1607,7 @@ void clusterCommand(redisClient *c) {
             addReplyError(c,"Invalid CLUSTER SETSLOT action or number of arguments");
             return;
         }
-        clusterSaveConfigOrDie();
+        clusterSaveConfigLater();
         addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"info") && c->argc == 2) {
         char *statestr[] = {"ok","fail","needhelp"};
@@ -1436,7 +1653,7 @@ void clusterCommand(redisClient *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"getkeysinslot") && c->argc == 4) {
         long long maxkeys, slot;
         unsigned int numkeys, j;
-        robj **keys;
+        sds *keys;
 
         if (getLongLongFromObjectOrReply(c,c->argv[2],&slot,NULL) != REDIS_OK)
             return;
@@ -1448,11 +1665,22 @@ void clusterCommand(redisClient *c) {
             return;
         }
 
-        keys = zmalloc(sizeof(robj*)*maxkeys);
+        keys = zmalloc(sizeof(sds)*maxkeys);
         numkeys = GetKeysInSlot(slot, keys, maxkeys);
         addReplyMultiBulkLen(c,numkeys);
-        for (j = 0; j < numkeys; j++) addReplyBulk(c,keys[j]);
+        for (j = 0; j < numkeys; j++)
+            addReplyBulkCBuffer(c,keys[j],sdslen(keys[j]));
         zfree(keys);
+    } else if (!strcasecmp(c->argv[1]->ptr,"countkeysinslot") && c->argc == 3) {
+        long long slot;
+
+        if (getLongLongFromObjectOrReply(c,c->argv[2],&slot,NULL) != REDIS_OK)
+            return;
+        if (slot < 0 || slot >= REDIS_CLUSTER_SLOTS) {
+            addReplyError(c,"Invalid slot");
+            return;
+        }
+        addReplyLongLong(c,CountKeysInSlot(slot));
     } else {
         addReplyError(c,"Wrong CLUSTER subcommand or number of arguments");
     }
@@ -1582,14 +1810,186 @@ void restoreCommand(redisClient *c) {
     server.dirty++;
 }
 
-/* MIGRATE host port key dbid timeout */
-void migrateCommand(redisClient *c) {
+/* -----------------------------------------------------------------------------
+ * MIGRATE connections cache
+ *
+ * Resharding a slot means calling MIGRATE many times against the same target
+ * node, so connections are cached and reused across calls. Connections not
+ * used for REDIS_MIGRATE_SOCKET_TTL seconds are closed by serverCron().
+ * -------------------------------------------------------------------------- */
+
+typedef struct migrateCachedSocket {
+    int fd;
+    long last_dbid;         /* DB currently selected in the connection. */
+    time_t last_use_time;
+} migrateCachedSocket;
+
+/* Return a connection to host:port, creating and caching it if needed.
+ * On error NULL is returned, and an error is replied to the client. */
+static migrateCachedSocket *migrateGetSocket(redisClient *c, robj *host,
+                                             robj *port, long timeout)
+{
     int fd;
+    sds name = sdsempty();
+    migrateCachedSocket *cs;
+
+    name = sdscatlen(name,host->ptr,sdslen(host->ptr));
+    name = sdscatlen(name,":",1);
+    name = sdscatlen(name,port->ptr,sdslen(port->ptr));
+    cs = dictFetchValue(server.migrate_cached_sockets,name);
+    if (cs) {
+        sdsfree(name);
+        cs->last_use_time = server.unixtime;
+        return cs;
+    }
+
+    /* Too many items, drop one at random. */
+    if (dictSize(server.migrate_cached_sockets) == REDIS_MIGRATE_SOCKET_CACHE_ITEMS) {
+        dictEntry *de = dictGetRandomKey(server.migrate_cached_sockets);
+        cs = dictGetVal(de);
+        close(cs->fd);
+        zfree(cs);
+        dictDelete(server.migrate_cached_sockets,dictGetKey(de));
+    }
+
+    /* Connect */
+    fd = anetTcpNonBlockConnect(server.neterr,host->ptr,atoi(port->ptr));
+    if (fd == -1) {
+        sdsfree(name);
+        addReplyErrorFormat(c,"Can't connect to target node: %s",
+            server.neterr);
+        return NULL;
+    }
+    anetTcpNoDelay(server.neterr,fd);
+    if ((aeWait(fd,AE_WRITABLE,timeout) & AE_WRITABLE) == 0) {
+        sdsfree(name);
+        addReplySds(c,sdsnew("-IOERR error or timeout connecting to the client\r\n"));
+        close(fd);
+        return NULL;
+    }
+
+    cs = zmalloc(sizeof(*cs));
+    cs->fd = fd;
+    cs->last_dbid = -1;
+    cs->last_use_time = server.unixtime;
+    dictAdd(server.migrate_cached_sockets,name,cs);
+    return cs;
+}
+
+/* Close the cached connection to host:port, if any. */
+static void migrateCloseSocket(robj *host, robj *port) {
+    sds name = sdsempty();
+    migrateCachedSocket *cs;
+
+    name = sdscatlen(name,host->ptr,sdslen(host->ptr));
+    name = sdscatlen(name,":",1);
+    name = sdscatlen(name,port->ptr,sdslen(port->ptr));
+    cs = dictFetchValue(server.migrate_cached_sockets,name);
+    if (cs) {
+        close(cs->fd);
+        zfree(cs);
+        dictDelete(server.migrate_cached_sockets,name);
+    }
+    sdsfree(name);
+}
+
+void migrateCloseTimedoutSockets(void) {
+    dictIterator *di = dictGetSafeIterator(server.migrate_cached_sockets);
+    dictEntry *de;
+
+    while((de = dictNext(di)) != NULL) {
+        migrateCachedSocket *cs = dictGetVal(de);
+
+        if ((server.unixtime - cs->last_use_time) > REDIS_MIGRATE_SOCKET_TTL) {
+            close(cs->fd);
+            zfree(cs);
+            dictDelete(server.migrate_cached_sockets,dictGetKey(de));
+        }
+    }
+    dictReleaseIterator(di);
+}
+
+/* Read a reply line from the target node. What is read is accumulated in
+ * '*rbuf', so that the replies of the pipelined commands are read with as
+ * few read(2) calls as possible. Returns the length of the line, without
+ * the trailing CRLF, or -1 on error or timeout. */
+static ssize_t migrateReadLine(int fd, sds *rbuf, char *line, size_t size,
+                               long long timeout)
+{
+    long long start = mstime();
+
+    while(1) {
+        char *nl = memchr(*rbuf,'\n',sdslen(*rbuf));
+        char buf[REDIS_IOBUF_LEN];
+        long long elapsed;
+        ssize_t nread;
+
+        if (nl) {
+            size_t len = nl-*rbuf;
+
+            if (len && (*rbuf)[len-1] == '\r') len--;
+            if (len >= size) len = size-1;
+            memcpy(line,*rbuf,len);
+            line[len] = '\0';
+            sdsrange(*rbuf,(nl-*rbuf)+1,-1);
+            return len;
+        }
+
+        nread = read(fd,buf,sizeof(buf));
+        if (nread == 0) return -1;
+        if (nread > 0) {
+            *rbuf = sdscatlen(*rbuf,buf,nread);
+            continue;
+        }
+        if (errno != EAGAIN) return -1;
+        elapsed = mstime()-start;
+        if (elapsed >= timeout) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        aeWait(fd,AE_READABLE,timeout-elapsed);
+    }
+}
+
+/* MIGRATE host port key dbid timeout [KEYS key1 key2 ... keyN]
+ *
+ * When the KEYS option is given the key argument must be the empty string,
+ * and all the keys are migrated in a single call: the RESTORE commands are
+ * pipelined, so the whole transfer costs a single round trip. The reply is
+ * +NOKEY if none of the keys exist, otherwise +OK, or the first error
+ * returned by the target node (in that case only the keys for which RESTORE
+ * failed are not deleted from the source node). */
+void migrateCommand(redisClient *c) {
+    migrateCachedSocket *cs;
     long timeout;
     long dbid;
-    long long ttl = 0, expireat;
-    robj *o;
+    long long ttl, expireat;
+    robj **ov; /* Objects to migrate. */
+    robj **kv; /* Key names. */
+    robj **newargv = NULL; /* Used to rewrite the command as DEL ... keys ... */
     rio cmd, payload;
+    sds rbuf = NULL;
+    int may_retry = 1, select, write_error = 0;
+    int first_key = 3, num_keys = 1, j, oi, del_idx = 1;
+    char *error_from_target = NULL;
+
+    /* Parse additional options */
+    for (j = 6; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"keys")) {
+            if (sdslen(c->argv[3]->ptr) != 0) {
+                addReplyError(c,
+                    "When using MIGRATE KEYS option, the key argument"
+                    " must be set to the empty string");
+                return;
+            }
+            first_key = j+1;
+            num_keys = c->argc - j - 1;
+            break; /* All the remaining args are keys. */
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
 
     /* Sanity check */
     if (getLongFromObjectOrReply(c,c->argv[5],&timeout,NULL) != REDIS_OK)
@@ -1598,52 +1998,69 @@ void migrateCommand(redisClient *c) {
         return;
     if (timeout <= 0) timeout = 1;
 
-    /* Check if the key is here. If not we reply with success as there is
-     * nothing to migrate (for instance the key expired in the meantime), but
-     * we include such information in the reply string. */
-    if ((o = lookupKeyRead(c->db,c->argv[3])) == NULL) {
-        addReplySds(c,sdsnew("+NOKEY\r\n"));
-        return;
+    /* Check if the keys are here. If none of the keys exist we reply with
+     * success as there is nothing to migrate (for instance the key expired
+     * in the meantime), but we include such information in the reply. */
+    ov = zmalloc(sizeof(robj*)*num_keys);
+    kv = zmalloc(sizeof(robj*)*num_keys);
+    oi = 0;
+    for (j = 0; j < num_keys; j++) {
+        if ((ov[oi] = lookupKeyRead(c->db,c->argv[first_key+j])) != NULL) {
+            kv[oi] = c->argv[first_key+j];
+            oi++;
+        }
     }
-    
-    /* Connect */
-    fd = anetTcpNonBlockConnect(server.neterr,c->argv[1]->ptr,
-                atoi(c->argv[2]->ptr));
-    if (fd == -1) {
-        addReplyErrorFormat(c,"Can't connect to target node: %s",
-            server.neterr);
+    num_keys = oi;
+    if (num_keys == 0) {
+        zfree(ov); zfree(kv);
+        addReplySds(c,sdsnew("+NOKEY\r\n"));
         return;
     }
-    if ((aeWait(fd,AE_WRITABLE,timeout*1000) & AE_WRITABLE) == 0) {
-        addReplySds(c,sdsnew("-IOERR error or timeout connecting to the client\r\n"));
-        return;
+
+try_again:
+    /* Connect, or reuse the cached connection. */
+    cs = migrateGetSocket(c,c->argv[1],c->argv[2],timeout);
+    if (cs == NULL) {
+        zfree(ov); zfree(kv);
+        return; /* error sent to the client by migrateGetSocket() */
     }
 
-    /* Create RESTORE payload and generate the protocol to call the command. */
+    /* Create RESTORE payloads and generate the protocol to call the
+     * commands, preceded by SELECT if the connection has another DB
+     * selected. */
     rioInitWithBuffer(&cmd,sdsempty());
-    redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SELECT",6));
-    redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,dbid));
-
-    expireat = getExpire(c->db,c->argv[3]);
-    if (expireat != -1) {
-        ttl = expireat-mstime();
-        if (ttl < 1) ttl = 1;
-    }
-    redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',4));
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"RESTORE",7));
-    redisAssertWithInfo(c,NULL,c->argv[3]->encoding == REDIS_ENCODING_RAW);
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,c->argv[3]->ptr,sdslen(c->argv[3]->ptr)));
-    redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
-
-    /* Finally the last argument that is the serailized object payload
-     * in the DUMP format. */
-    createDumpPayload(&payload,o);
-    redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,payload.io.buffer.ptr,
-                                sdslen(payload.io.buffer.ptr)));
-    sdsfree(payload.io.buffer.ptr);
+    select = cs->last_dbid != dbid;
+    if (select) {
+        redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SELECT",6));
+        redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,dbid));
+    }
+
+    for (j = 0; j < num_keys; j++) {
+        ttl = 0;
+        expireat = getExpire(c->db,kv[j]);
+        if (expireat != -1) {
+            ttl = expireat-mstime();
+            if (ttl < 1) ttl = 1;
+        }
+        redisAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',4));
+        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"RESTORE",7));
+        redisAssertWithInfo(c,NULL,kv[j]->encoding == REDIS_ENCODING_RAW);
+        redisAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,kv[j]->ptr,
+                                                      sdslen(kv[j]->ptr)));
+        redisAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
+
+        /* Finally the last argument that is the serialized object payload
+         * in the DUMP format. */
+        createDumpPayload(&payload,ov[j]);
+        redisAssertWithInfo(c,NULL,
+            rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                               sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+    }
 
-    /* Tranfer the query to the other node in 64K chunks. */
+    /* Transfer the query to the other node in 64K chunks. */
+    errno = 0;
     {
         sds buf = cmd.io.buffer.ptr;
         size_t pos = 0, towrite;
@@ -1651,54 +2068,120 @@ void migrateCommand(redisClient *c) {
 
         while ((towrite = sdslen(buf)-pos) > 0) {
             towrite = (towrite > (64*1024) ? (64*1024) : towrite);
-            nwritten = syncWrite(fd,buf+pos,towrite,timeout);
-            if (nwritten != (signed)towrite) goto socket_wr_err;
+            nwritten = syncWrite(cs->fd,buf+pos,towrite,timeout);
+            if (nwritten != (signed)towrite) {
+                write_error = 1;
+                goto socket_err;
+            }
             pos += nwritten;
         }
     }
 
-    /* Read back the reply. */
+    /* Read back the replies: one for the SELECT, if sent, and one for
+     * every RESTORE. */
+    rbuf = sdsempty();
     {
-        char buf1[1024];
-        char buf2[1024];
-
-        /* Read the two replies */
-        if (syncReadLine(fd, buf1, sizeof(buf1), timeout) <= 0)
-            goto socket_rd_err;
-        if (syncReadLine(fd, buf2, sizeof(buf2), timeout) <= 0)
-            goto socket_rd_err;
-        if (buf1[0] == '-' || buf2[0] == '-') {
-            addReplyErrorFormat(c,"Target instance replied with error: %s",
-                (buf1[0] == '-') ? buf1+1 : buf2+1);
-        } else {
-            robj *aux;
+        char buf[1024];
+
+        if (select) {
+            if (migrateReadLine(cs->fd,&rbuf,buf,sizeof(buf),timeout) <= 0)
+                goto socket_err;
+            if (buf[0] == '-') {
+                error_from_target = zstrdup(buf+1);
+                cs->last_dbid = -1;
+            } else {
+                cs->last_dbid = dbid;
+            }
+        }
 
-            dbDelete(c->db,c->argv[3]);
-            signalModifiedKey(c->db,c->argv[3]);
-            addReply(c,shared.ok);
-            server.dirty++;
+        /* Allocate the new argument vector that will replace the current
+         * command, to propagate the MIGRATE as a DEL command. We allocate
+         * num_keys+1 because the additional argument is for "DEL" command
+         * name itself. */
+        newargv = zmalloc(sizeof(robj*)*(num_keys+1));
+        del_idx = 1;
+        for (j = 0; j < num_keys; j++) {
+            if (migrateReadLine(cs->fd,&rbuf,buf,sizeof(buf),timeout) <= 0)
+                goto socket_err;
+            /* If SELECT failed the keys may have been restored in another
+             * DB of the target, don't delete them. */
+            if (error_from_target) continue;
+            if (buf[0] == '-') {
+                if (!error_from_target) error_from_target = zstrdup(buf+1);
+            } else {
+                dbDelete(c->db,kv[j]);
+                signalModifiedKey(c->db,kv[j]);
+                server.dirty++;
 
-            /* Translate MIGRATE as DEL for replication/AOF. */
-            aux = createStringObject("DEL",3);
-            rewriteClientCommandVector(c,2,aux,c->argv[3]);
-            decrRefCount(aux);
+                /* Populate the argument vector to replace the old one. */
+                newargv[del_idx++] = kv[j];
+                incrRefCount(kv[j]);
+            }
         }
     }
 
-    sdsfree(cmd.io.buffer.ptr);
-    close(fd);
-    return;
+    if (error_from_target) {
+        addReplyErrorFormat(c,"Target instance replied with error: %s",
+            error_from_target);
+        zfree(error_from_target);
+    } else {
+        addReply(c,shared.ok);
+    }
+
+    /* Translate MIGRATE as DEL for replication/AOF. Note that we do
+     * this only for the keys for which we received an acknowledgement
+     * from the receiving Redis server, by using the del_idx index. */
+    if (del_idx > 1) {
+        newargv[0] = createStringObject("DEL",3);
+        /* Note that the following call takes ownership of newargv. */
+        replaceClientCommandVector(c,del_idx,newargv);
+        newargv = NULL; /* Make sure to free it only once. */
+    }
 
-socket_wr_err:
-    addReplySds(c,sdsnew("-IOERR error or timeout writing to target instance\r\n"));
+    /* Everything was consumed, unless the target sent unexpected data:
+     * in that case the connection is not reused. */
+    if (sdslen(rbuf)) migrateCloseSocket(c->argv[1],c->argv[2]);
+    sdsfree(rbuf);
     sdsfree(cmd.io.buffer.ptr);
-    close(fd);
+    zfree(ov); zfree(kv); zfree(newargv);
     return;
 
-socket_rd_err:
-    addReplySds(c,sdsnew("-IOERR error or timeout reading from target node\r\n"));
+socket_err:
+    /* Cleanup the dynamically allocated things. Note that keys were not
+     * deleted yet if an error happened reading the replies of a cached
+     * connection, except keys already acknowledged by the target. */
+    sdsfree(rbuf);
+    rbuf = NULL;
     sdsfree(cmd.io.buffer.ptr);
-    close(fd);
+    if (newargv) {
+        /* Keys acknowledged before the error were already deleted, make
+         * sure to propagate their deletion anyway. */
+        if (del_idx > 1) {
+            newargv[0] = createStringObject("DEL",3);
+            replaceClientCommandVector(c,del_idx,newargv);
+        } else {
+            zfree(newargv);
+        }
+        newargv = NULL;
+        may_retry = 0; /* Some keys may be already restored. */
+    }
+    if (error_from_target) zfree(error_from_target);
+    error_from_target = NULL;
+    migrateCloseSocket(c->argv[1],c->argv[2]);
+
+    /* Retry only if it's not a timeout and we never attempted a retry
+     * (or the code jumping here did not set may_retry to zero): a cached
+     * connection may have been closed by the target in the meantime. */
+    if (errno != ETIMEDOUT && may_retry) {
+        may_retry = 0;
+        write_error = 0;
+        goto try_again;
+    }
+
+    addReplySds(c,sdsnew(write_error ?
+        "-IOERR error or timeout writing to target instance\r\n" :
+        "-IOERR error or timeout reading from target node\r\n"));
+    zfree(ov); zfree(kv);
     return;
 }
 
@@ -1781,7 +2264,6 @@ clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **arg
                 /* If it is not the first key, make sure it is exactly
                  * the same key as the first we saw. */
                 if (!equalStringObjects(firstkey,margv[keyindex[j]])) {
-                    decrRefCount(firstkey);
                     getKeysFreeResult(keyindex);
                     return NULL;
                 }
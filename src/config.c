@@ -55,8 +55,19 @@ void loadServerConfigFromString(char *config) {
             if (server.port < 0 || server.port > 65535) {
                 err = "Invalid port"; goto loaderr;
             }
-        } else if (!strcasecmp(argv[0],"bind") && argc == 2) {
-            server.bindaddr = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"bind") && argc >= 2) {
+            int j, addresses = argc-1;
+
+            if (addresses > REDIS_BINDADDR_MAX) {
+                err = "Too many bind addresses specified."; goto loaderr;
+            }
+            for (j = 0; j < addresses; j++)
+                server.bindaddr[j] = zstrdup(argv[j+1]);
+            server.bindaddr_count = addresses;
+        } else if (!strcasecmp(argv[0],"tcp-reuseport") && argc == 2) {
+            if ((server.tcp_reuseport = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"unixsocket") && argc == 2) {
             server.unixsocket = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"unixsocketperm") && argc == 2) {
@@ -160,6 +171,17 @@ void loadServerConfigFromString(char *config) {
             }
         } else if (!strcasecmp(argv[0],"maxmemory") && argc == 2) {
             server.maxmemory = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"maxmemory-clients") && argc == 2) {
+            server.maxmemory_clients = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"maxmemory-clients-policy") && argc == 2) {
+            if (!strcasecmp(argv[1],"keys-only")) {
+                server.maxmemory_clients_policy = REDIS_MAXMEMORY_CLIENTS_KEYS_ONLY;
+            } else if (!strcasecmp(argv[1],"clients-first")) {
+                server.maxmemory_clients_policy = REDIS_MAXMEMORY_CLIENTS_FIRST;
+            } else {
+                err = "Invalid maxmemory-clients policy";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"maxmemory-policy") && argc == 2) {
             if (!strcasecmp(argv[1],"volatile-lru")) {
                 server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_LRU;
@@ -209,6 +231,14 @@ void loadServerConfigFromString(char *config) {
             if ((server.repl_slave_ro = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"slave-reader-thread") && argc == 2) {
+            if ((server.slave_reader_thread = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"repl-compression") && argc == 2) {
+            if ((server.repl_compression = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbcompression") && argc == 2) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -217,6 +247,28 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-key-index") && argc == 2) {
+            if ((server.rdb_key_index = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-delta-tracking") && argc == 2) {
+            if ((server.rdb_delta_tracking = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-fsync-bytes") && argc == 2) {
+            server.rdb_save_fsync_bytes = memtoll(argv[1],NULL);
+            if (server.rdb_save_fsync_bytes < 0) {
+                err = "Invalid rdb-save-fsync-bytes"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-drop-cache") && argc == 2) {
+            if ((server.rdb_save_drop_cache = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-rate-limit") && argc == 2) {
+            server.rdb_save_rate_limit = memtoll(argv[1],NULL);
+            if (server.rdb_save_rate_limit < 0) {
+                err = "Invalid rdb-save-rate-limit"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -328,6 +380,10 @@ void loadServerConfigFromString(char *config) {
             server.slowlog_log_slower_than = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"tracking-table-max-keys") &&
+                   argc == 2)
+        {
+            server.tracking_table_max_keys = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
                    argc == 5)
         {
@@ -446,6 +502,18 @@ void configSetCommand(redisClient *c) {
             ll < 0) goto badfmt;
         server.maxmemory = ll;
         if (server.maxmemory) freeMemoryIfNeeded();
+    } else if (!strcasecmp(c->argv[2]->ptr,"maxmemory-clients")) {
+        if (getLongLongFromObject(o,&ll) == REDIS_ERR ||
+            ll < 0) goto badfmt;
+        server.maxmemory_clients = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"maxmemory-clients-policy")) {
+        if (!strcasecmp(o->ptr,"keys-only")) {
+            server.maxmemory_clients_policy = REDIS_MAXMEMORY_CLIENTS_KEYS_ONLY;
+        } else if (!strcasecmp(o->ptr,"clients-first")) {
+            server.maxmemory_clients_policy = REDIS_MAXMEMORY_CLIENTS_FIRST;
+        } else {
+            goto badfmt;
+        }
     } else if (!strcasecmp(c->argv[2]->ptr,"maxmemory-policy")) {
         if (!strcasecmp(o->ptr,"volatile-lru")) {
             server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_LRU;
@@ -548,6 +616,16 @@ void configSetCommand(redisClient *c) {
 
         if (yn == -1) goto badfmt;
         server.repl_slave_ro = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"slave-reader-thread")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        server.slave_reader_thread = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"repl-compression")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        server.repl_compression = yn;
     } else if (!strcasecmp(c->argv[2]->ptr,"dir")) {
         if (chdir((char*)o->ptr) == -1) {
             addReplyErrorFormat(c,"Changing directory: %s", strerror(errno));
@@ -583,6 +661,9 @@ void configSetCommand(redisClient *c) {
     } else if (!strcasecmp(c->argv[2]->ptr,"slowlog-max-len")) {
         if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll < 0) goto badfmt;
         server.slowlog_max_len = (unsigned)ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"tracking-table-max-keys")) {
+        if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll < 0) goto badfmt;
+        server.tracking_table_max_keys = ll;
     } else if (!strcasecmp(c->argv[2]->ptr,"loglevel")) {
         if (!strcasecmp(o->ptr,"warning")) {
             server.verbosity = REDIS_WARNING;
@@ -668,6 +749,37 @@ void configSetCommand(redisClient *c) {
 
         if (yn == -1) goto badfmt;
         server.rdb_checksum = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rdb-key-index")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        server.rdb_key_index = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rdb-delta-tracking")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        /* Changes performed while tracking was off are unknown. */
+        if (yn != server.rdb_delta_tracking) rdbDeltaNeedFullSave();
+        server.rdb_delta_tracking = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rdb-save-fsync-bytes")) {
+        int err;
+
+        /* Units are accepted like in the config file. */
+        ll = memtoll(o->ptr,&err);
+        if (err || ll < 0) goto badfmt;
+        server.rdb_save_fsync_bytes = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rdb-save-drop-cache")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        server.rdb_save_drop_cache = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rdb-save-rate-limit")) {
+        int err;
+
+        /* Units are accepted like in the config file. */
+        ll = memtoll(o->ptr,&err);
+        if (err || ll < 0) goto badfmt;
+        server.rdb_save_rate_limit = ll;
     } else if (!strcasecmp(c->argv[2]->ptr,"slave-priority")) {
         if (getLongLongFromObject(o,&ll) == REDIS_ERR ||
             ll <= 0) goto badfmt;
@@ -723,19 +835,23 @@ void configGetCommand(redisClient *c) {
     config_get_string_field("dbfilename",server.rdb_filename);
     config_get_string_field("requirepass",server.requirepass);
     config_get_string_field("masterauth",server.requirepass);
-    config_get_string_field("bind",server.bindaddr);
     config_get_string_field("unixsocket",server.unixsocket);
     config_get_string_field("logfile",server.logfile);
     config_get_string_field("pidfile",server.pidfile);
 
     /* Numerical values */
     config_get_numerical_field("maxmemory",server.maxmemory);
+    config_get_numerical_field("maxmemory-clients",server.maxmemory_clients);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("auto-aof-rewrite-percentage",
             server.aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
             server.aof_rewrite_min_size);
+    config_get_numerical_field("rdb-save-fsync-bytes",
+            server.rdb_save_fsync_bytes);
+    config_get_numerical_field("rdb-save-rate-limit",
+            server.rdb_save_rate_limit);
     config_get_numerical_field("hash-max-ziplist-entries",
             server.hash_max_ziplist_entries);
     config_get_numerical_field("hash-max-ziplist-value",
@@ -755,6 +871,8 @@ void configGetCommand(redisClient *c) {
             server.slowlog_log_slower_than);
     config_get_numerical_field("slowlog-max-len",
             server.slowlog_max_len);
+    config_get_numerical_field("tracking-table-max-keys",
+            server.tracking_table_max_keys);
     config_get_numerical_field("port",server.port);
     config_get_numerical_field("databases",server.dbnum);
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
@@ -770,11 +888,19 @@ void configGetCommand(redisClient *c) {
             server.repl_serve_stale_data);
     config_get_bool_field("slave-read-only",
             server.repl_slave_ro);
+    config_get_bool_field("repl-compression",
+            server.repl_compression);
+    config_get_bool_field("slave-reader-thread",
+            server.slave_reader_thread);
     config_get_bool_field("stop-writes-on-bgsave-error",
             server.stop_writes_on_bgsave_err);
     config_get_bool_field("daemonize", server.daemonize);
+    config_get_bool_field("tcp-reuseport", server.tcp_reuseport);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-key-index", server.rdb_key_index);
+    config_get_bool_field("rdb-save-drop-cache", server.rdb_save_drop_cache);
+    config_get_bool_field("rdb-delta-tracking", server.rdb_delta_tracking);
     config_get_bool_field("activerehashing", server.activerehashing);
 
     /* Everything we can't handle with macros follows. */
@@ -810,6 +936,13 @@ void configGetCommand(redisClient *c) {
         addReplyBulkCString(c,s);
         matches++;
     }
+    if (stringmatch(pattern,"maxmemory-clients-policy",0)) {
+        addReplyBulkCString(c,"maxmemory-clients-policy");
+        addReplyBulkCString(c,
+            server.maxmemory_clients_policy == REDIS_MAXMEMORY_CLIENTS_FIRST ?
+            "clients-first" : "keys-only");
+        matches++;
+    }
     if (stringmatch(pattern,"appendfsync",0)) {
         char *policy;
 
@@ -871,6 +1004,19 @@ void configGetCommand(redisClient *c) {
         sdsfree(buf);
         matches++;
     }
+    if (stringmatch(pattern,"bind",0)) {
+        sds aux = sdsempty();
+        int j;
+
+        for (j = 0; j < server.bindaddr_count; j++) {
+            if (j) aux = sdscatlen(aux," ",1);
+            aux = sdscat(aux,server.bindaddr[j]);
+        }
+        addReplyBulkCString(c,"bind");
+        addReplyBulkCString(c,aux);
+        sdsfree(aux);
+        matches++;
+    }
     if (stringmatch(pattern,"unixsocketperm",0)) {
         char buf[32];
         snprintf(buf,sizeof(buf),"%o",server.unixsocketperm);
@@ -907,8 +1053,11 @@ void configCommand(redisClient *c) {
         server.stat_numcommands = 0;
         server.stat_numconnections = 0;
         server.stat_expiredkeys = 0;
+        server.stat_evictedclients = 0;
         server.stat_rejected_conn = 0;
         server.stat_fork_time = 0;
+        server.stat_reply_pool_hits = 0;
+        server.stat_reply_pool_misses = 0;
         server.aof_delayed_fsync = 0;
         resetCommandTableStats();
         addReply(c,shared.ok);
@@ -60,6 +60,11 @@
 #define rdb_fsync_range(fd,off,size) fsync(fd)
 #endif
 
+/* Test for posix_fadvise() */
+#ifdef __linux__
+#define HAVE_FADVISE 1
+#endif
+
 /* Byte ordering detection */
 #include <sys/types.h> /* This will likely define BYTE_ORDER */
 
@@ -1,4 +1,6 @@
-#include "redis.h"
+#include "crc16.h"
+
+#include <stdint.h>
 
 /*      
  * Copyright 2001-2010 Georges Menie (www.menie.org)
@@ -85,3 +87,9 @@ uint16_t crc16(const char *buf, int len) {
             crc = (crc<<8) ^ crc16tab[((crc>>8) ^ *buf++)&0x00FF];
     return crc;
 }
+
+/* We have 4096 hash slots. The hash slot of a given key is obtained
+ * as the least significant 12 bits of the crc16 of the key. */
+unsigned int keyHashSlot(char *key, int keylen) {
+    return crc16(key,keylen) & (REDIS_CLUSTER_SLOTS-1);
+}
@@ -3,8 +3,9 @@
 #include <signal.h>
 #include <ctype.h>
 
-void SlotToKeyAdd(robj *key);
+void SlotToKeyAdd(sds key);
 void SlotToKeyDel(robj *key);
+void SlotToKeyFlush(void);
 
 /*-----------------------------------------------------------------------------
  * C-level DB API
@@ -35,6 +36,9 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
         server.stat_keyspace_misses++;
     else
         server.stat_keyspace_hits++;
+    if (server.current_client &&
+        server.current_client->flags & REDIS_TRACKING)
+        trackingRememberKey(server.current_client,key);
     return val;
 }
 
@@ -64,7 +68,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
     int retval = dictAdd(db->dict, copy, val);
 
     redisAssertWithInfo(NULL,key,retval == REDIS_OK);
-    if (server.cluster_enabled) SlotToKeyAdd(key);
+    if (server.cluster_enabled) SlotToKeyAdd(copy);
+    rdbDeltaTrackKey(db,key);
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -131,8 +136,12 @@ int dbDelete(redisDb *db, robj *key) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    /* The slot dictionaries reference the sds of the main dictionary, so the
+     * key is removed from them before it is freed. */
+    if (server.cluster_enabled) SlotToKeyDel(key);
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) SlotToKeyDel(key);
+        rdbDeltaTrackKey(db,key);
+        trackingInvalidateKey(key);
         return 1;
     } else {
         return 0;
@@ -148,6 +157,11 @@ long long emptyDb() {
         dictEmpty(server.db[j].dict);
         dictEmpty(server.db[j].expires);
     }
+    if (server.cluster_enabled) SlotToKeyFlush();
+    rdbDeltaNeedFullSave();
+    /* The whole dataset is replaced by FLUSHALL, a full resync with the
+     * master or DEBUG RELOAD: the tracking clients must drop their cache. */
+    trackingInvalidateAll();
     return removed;
 }
 
@@ -169,10 +183,13 @@ int selectDb(redisClient *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    rdbDeltaTrackKey(db,key);
+    trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    rdbDeltaNeedFullSave();
 }
 
 /*-----------------------------------------------------------------------------
@@ -182,8 +199,10 @@ void signalFlushedDb(int dbid) {
 void flushdbCommand(redisClient *c) {
     server.dirty += dictSize(c->db->dict);
     signalFlushedDb(c->db->id);
+    trackingInvalidateAll();
     dictEmpty(c->db->dict);
     dictEmpty(c->db->expires);
+    if (server.cluster_enabled) SlotToKeyFlush();
     addReply(c,shared.ok);
 }
 
@@ -425,7 +444,11 @@ int removeExpire(redisDb *db, robj *key) {
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
     redisAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    if (dictDelete(db->expires,key->ptr) == DICT_OK) {
+        rdbDeltaTrackKey(db,key);
+        return 1;
+    }
+    return 0;
 }
 
 void setExpire(redisDb *db, robj *key, long long when) {
@@ -436,6 +459,7 @@ void setExpire(redisDb *db, robj *key, long long when) {
     redisAssertWithInfo(NULL,key,kde != NULL);
     de = dictReplaceRaw(db->expires,dictGetKey(kde));
     dictSetSignedIntegerVal(de,when);
+    rdbDeltaTrackKey(db,key);
 }
 
 /* Return the expire time of the specified key, or -1 if no expire
@@ -691,32 +715,62 @@ int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *num
 
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
- * while rehashing the cluster. */
-void SlotToKeyAdd(robj *key) {
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+ * while rehashing the cluster.
+ *
+ * Every hash slot has its own dictionary of keys, created when the first
+ * key of the slot is added. The dictionaries don't copy the keys: they
+ * reference the sds strings used as keys in the DB dictionary, so every key
+ * costs just a dictionary entry, and adding or removing a key is O(1). */
+static dict *slotToKeyDict(unsigned int hashslot, int create) {
+    dict **d = server.cluster.slots_to_keys+hashslot;
+
+    if (*d == NULL && create) *d = dictCreate(&slotToKeyDictType,NULL);
+    return *d;
+}
+
+void SlotToKeyAdd(sds key) {
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
 
-    zslInsert(server.cluster.slots_to_keys,hashslot,key);
-    incrRefCount(key);
+    dictAdd(slotToKeyDict(hashslot,1),key,NULL);
 }
 
 void SlotToKeyDel(robj *key) {
     unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    dict *d = slotToKeyDict(hashslot,0);
 
-    zslDelete(server.cluster.slots_to_keys,hashslot,key);
+    if (d) dictDelete(d,key->ptr);
 }
 
-unsigned int GetKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    zskiplistNode *n;
-    zrangespec range;
-    int j = 0;
+/* Called when the DB is flushed. */
+void SlotToKeyFlush(void) {
+    int j;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-    
-    n = zslFirstInRange(server.cluster.slots_to_keys, range);
-    while(n && n->score == hashslot && count--) {
-        keys[j++] = n->obj;
-        n = n->level[0].forward;
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) {
+        dict *d = server.cluster.slots_to_keys[j];
+
+        if (d && dictSize(d)) dictEmpty(d);
     }
+}
+
+/* Populate 'keys' with up to 'count' keys of the specified hash slot,
+ * returning the number of keys found. The keys are not copied, they are
+ * only valid until the key space is modified. */
+unsigned int GetKeysInSlot(unsigned int hashslot, sds *keys, unsigned int count) {
+    dict *d = slotToKeyDict(hashslot,0);
+    dictIterator *di;
+    dictEntry *de;
+    unsigned int j = 0;
+
+    if (d == NULL || count == 0) return 0;
+    di = dictGetIterator(d);
+    while(j < count && (de = dictNext(di)) != NULL)
+        keys[j++] = dictGetKey(de);
+    dictReleaseIterator(di);
     return j;
 }
+
+unsigned int CountKeysInSlot(unsigned int hashslot) {
+    dict *d = slotToKeyDict(hashslot,0);
+
+    return d ? dictSize(d) : 0;
+}
@@ -227,6 +227,14 @@ int dictExpand(dict *d, unsigned long size)
 int dictRehash(dict *d, int n) {
     if (!dictIsRehashing(d)) return 0;
 
+    /* When resizing is disabled (there is a child process performing a
+     * copy-on-write snapshot of the memory) moving entries from the old
+     * to the new table would dirty a lot of pages for no good reason: the
+     * rehashing is paused, unless the new table is so much bigger than the
+     * old one that lookups on the old table became too slow. */
+    if (!dict_can_resize &&
+        d->ht[1].size / d->ht[0].size < dict_force_resize_ratio) return 0;
+
     while(n--) {
         dictEntry *de, *nextde;
 
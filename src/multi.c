@@ -157,7 +157,7 @@ void execCommandReplicateMulti(redisClient *c) {
 void execCommand(redisClient *c) {
     int j;
     robj **orig_argv;
-    int orig_argc;
+    int orig_argc, orig_argv_len;
     struct redisCommand *orig_cmd;
 
     if (!(c->flags & REDIS_MULTI)) {
@@ -193,6 +193,7 @@ void execCommand(redisClient *c) {
 
     // 备份所有参数和命令
     orig_argv = c->argv;
+    orig_argv_len = c->argv_len;
     orig_argc = c->argc;
     orig_cmd = c->cmd;
     // 设置回复长度
@@ -214,6 +215,7 @@ void execCommand(redisClient *c) {
 
     // 恢复所有参数和命令
     c->argv = orig_argv;
+    c->argv_len = orig_argv_len;
     c->argc = orig_argc;
     c->cmd = orig_cmd;
 
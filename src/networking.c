@@ -11,6 +11,17 @@ size_t zmalloc_size_sds(sds s) {
     return zmalloc_size(s-sizeof(struct sdshdr));
 }
 
+/* Memory used by a node of the reply list: the list node itself, the
+ * object, and its string if already populated (deferred multi bulk lengths
+ * are added to the list as objects with a NULL string). */
+static size_t replyNodeMemoryUsage(listNode *ln) {
+    robj *o = listNodeValue(ln);
+    size_t size = zmalloc_size(ln)+zmalloc_size(o);
+
+    if (o->ptr) size += zmalloc_size_sds(o->ptr);
+    return size;
+}
+
 void *dupClientReplyValue(void *o) {
     incrRefCount((robj*)o);
     return o;
@@ -28,7 +39,9 @@ redisClient *createClient(int fd) {
      * in the context of a client. When commands are executed in other
      * contexts (for instance a Lua script) we need a non connected client. */
     if (fd != -1) {
-        anetNonBlock(NULL,fd);
+        /* The socket is already non blocking: accepted sockets are created
+         * with anetTcpNonBlockAccept() and the master link is connected with
+         * anetTcpNonBlockConnect(). */
         anetTcpNoDelay(NULL,fd);
         if (aeCreateFileEvent(server.el,fd,AE_READABLE,
             readQueryFromClient, c) == AE_ERR)
@@ -40,13 +53,17 @@ redisClient *createClient(int fd) {
     }
 
     selectDb(c,0);
+    c->id = server.next_client_id++;
     c->fd = fd;
+    c->resp = 2;
     c->bufpos = 0;
     c->querybuf = sdsempty();
     c->querybuf_peak = 0;
+    c->qb_pos = 0;
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -56,15 +73,26 @@ redisClient *createClient(int fd) {
     c->authenticated = 0;
     c->replstate = REDIS_REPL_NONE;
     c->slave_listening_port = 0;
+    c->max_staleness = 0;
+    c->repl_ack_off = 0;
+    c->repl_ack_time = 0;
+    c->repl_compression = 0;
+    c->repl_frame = NULL;
+    c->repl_frame_pos = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->mem_usage = 0;
     c->obuf_soft_limit_reached_time = 0;
-    listSetFreeMethod(c->reply,decrRefCount);
+    listSetFreeMethod(c->reply,releaseReplyObject);
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->bpop.keys = NULL;
     c->bpop.count = 0;
     c->bpop.timeout = 0;
     c->bpop.target = NULL;
+    c->bpop.numreplicas = 0;
+    c->bpop.reploffset = 0;
+    c->bpop.reptimeout = 0;
+    c->btype = 0;
     c->io_keys = listCreate();
     c->watched_keys = listCreate();
     listSetFreeMethod(c->io_keys,decrRefCount);
@@ -74,6 +102,7 @@ redisClient *createClient(int fd) {
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
     if (fd != -1) listAddNodeTail(server.clients,c);
     initClientMultiState(c);
+    updateClientMemUsage(c);
     return c;
 }
 
@@ -91,10 +120,27 @@ redisClient *createClient(int fd) {
  * Typically gets called every time a reply is built, before adding more
  * data to the clients output buffers. If the function returns REDIS_ERR no
  * data should be appended to the output buffers. */
+/* Return true if there is data to send to the client. Note that the
+ * shared block of the replication stream is kept at the tail of the reply
+ * list of a slave even once fully sent, see sendReplyToClient(). */
+int clientHasPendingReplies(redisClient *c) {
+    robj *o;
+
+    if (c->bufpos > 0) return 1;
+    if (listLength(c->reply) == 0) return 0;
+    if (listLength(c->reply) > 1) return 1;
+    o = listNodeValue(listFirst(c->reply));
+    return o->ptr == NULL || (size_t)c->sentlen < sdslen(o->ptr);
+}
+
 int prepareClientToWrite(redisClient *c) {
     if (c->flags & REDIS_LUA_CLIENT) return REDIS_OK;
     if (c->fd <= 0) return REDIS_ERR; /* Fake client */
-    if (c->bufpos == 0 && listLength(c->reply) == 0 &&
+    /* Masters don't receive replies, unless REDIS_MASTER_FORCE_REPLY is
+     * set: this is how slaves send REPLCONF ACK to their master. */
+    if ((c->flags & REDIS_MASTER) &&
+        !(c->flags & REDIS_MASTER_FORCE_REPLY)) return REDIS_ERR;
+    if (!clientHasPendingReplies(c) &&
         (c->replstate == REDIS_REPL_NONE ||
          c->replstate == REDIS_REPL_ONLINE) &&
         aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
@@ -102,20 +148,119 @@ int prepareClientToWrite(redisClient *c) {
     return REDIS_OK;
 }
 
-/* Create a duplicate of the last object in the reply list when
- * it is not exclusively owned by the reply list. */
-robj *dupLastObjectIfNeeded(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    redisAssert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        new = dupStringObject(cur);
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
+/* Return the last object of the reply list if 'len' more bytes can be
+ * appended to it in place, otherwise NULL is returned and the caller should
+ * add a new object to the list.
+ *
+ * Only objects exclusively owned by the reply list are modified. Objects
+ * shared with the rest of the server, like the values of keys added with
+ * addReply(), or the reply objects shared by slaves, are never copied:
+ * sendReplyToClient() sends them straight from their sds with writev(),
+ * and their reference count keeps them alive until they are sent. */
+static robj *replyListTailForAppend(redisClient *c, size_t len) {
+    robj *tail;
+
+    if (listLength(c->reply) == 0) return NULL;
+    tail = listNodeValue(listLast(c->reply));
+    if (tail->ptr == NULL || tail->refcount != 1 ||
+        sdslen(tail->ptr)+len > REDIS_REPLY_BLOCK_BYTES) return NULL;
+    return tail;
+}
+
+/* -----------------------------------------------------------------------------
+ * Reply blocks pool.
+ *
+ * Replies added to the reply list, except big objects that are referenced
+ * instead of copied, are stored in fixed size blocks: string objects
+ * whose sds has room for exactly REDIS_REPLY_BLOCK_BYTES bytes, so that the
+ * following replies are appended without reallocations (the sds header
+ * holds the used and free size of the block). Once sent, or when the client
+ * is freed, blocks are returned to a pool shared by all the clients instead
+ * of being freed, so that clients doing large pipelines don't allocate and
+ * free a block for every chunk of reply they receive.
+ * -------------------------------------------------------------------------- */
+
+static int isReplyBlock(robj *o) {
+    return o->refcount == 1 && o->encoding == REDIS_ENCODING_RAW &&
+           o->ptr != NULL &&
+           sdslen(o->ptr)+sdsavail(o->ptr) == REDIS_REPLY_BLOCK_BYTES;
+}
+
+/* Return an empty reply block, from the pool if possible. */
+robj *createReplyBlock(void) {
+    robj *o;
+
+    if (server.reply_pool_len) {
+        o = server.reply_pool[--server.reply_pool_len];
+        if (server.reply_pool_len < server.reply_pool_min_len)
+            server.reply_pool_min_len = server.reply_pool_len;
+        server.stat_reply_pool_hits++;
+    } else {
+        sds s = sdsnewlen(NULL,REDIS_REPLY_BLOCK_BYTES);
+
+        sdsclear(s);
+        o = createObject(REDIS_STRING,s);
+        server.stat_reply_pool_misses++;
+    }
+    return o;
+}
+
+/* Free method of the clients reply lists: blocks go back to the pool,
+ * every other object is just released. */
+void releaseReplyObject(void *o) {
+    robj *obj = o;
+
+    if (isReplyBlock(obj) && server.reply_pool_len < REDIS_REPLY_POOL_MAX) {
+        sdsclear(obj->ptr);
+        server.reply_pool[server.reply_pool_len++] = obj;
+    } else {
+        decrRefCount(obj);
     }
-    return listNodeValue(ln);
+}
+
+/* Memory retained by the blocks in the pool. */
+size_t replyPoolRetainedBytes(void) {
+    if (server.reply_pool_len == 0) return 0;
+    return server.reply_pool_len *
+           (sizeof(robj)+zmalloc_size_sds(server.reply_pool[0]->ptr));
+}
+
+/* Called every second by serverCron(): half of the blocks that were never
+ * taken from the pool in the last second are released, so that the memory
+ * retained after a burst of traffic is given back over time. */
+void replyPoolCron(void) {
+    unsigned long unused = (server.reply_pool_min_len+1)/2;
+
+    while(unused--)
+        decrRefCount(server.reply_pool[--server.reply_pool_len]);
+    server.reply_pool_min_len = server.reply_pool_len;
+}
+
+/* Add a new reply block to the list of the client, holding 's'. */
+static void _addReplyBlockToList(redisClient *c, char *s, size_t len) {
+    robj *o = createReplyBlock();
+
+    o->ptr = sdscatlen(o->ptr,s,len);
+    listAddNodeTail(c->reply,o);
+    c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
+}
+
+/* Add a reference to a reply block shared with other clients, whose content
+ * is appended later by the owner of the block. This is how the replication
+ * stream, encoded once, reaches all the slaves: the block is never copied,
+ * and sendReplyToClient() sends the data appended to it as long as it is
+ * still in the reply list of the client.
+ *
+ * The block is never reallocated (the owner appends at most its free
+ * space), so the memory accounted here is the same released when the block
+ * is removed from the list. */
+void addReplySharedBlock(redisClient *c, robj *block) {
+    if (prepareClientToWrite(c) != REDIS_OK) return;
+    if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
+    incrRefCount(block);
+    listAddNodeTail(c->reply,block);
+    c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
+    asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 /* -----------------------------------------------------------------------------
@@ -144,26 +289,19 @@ void _addReplyObjectToList(redisClient *c, robj *o) {
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
+    /* Append to the last object when possible. */
+    if ((tail = replyListTailForAppend(c,sdslen(o->ptr))) != NULL) {
+        c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+        tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
+        c->reply_bytes += zmalloc_size_sds(tail->ptr);
+    } else if (sdslen(o->ptr) <= REDIS_REPLY_COPY_MAX_BYTES) {
+        /* Small objects are cheaper to copy into a block, where the
+         * following replies can be appended, than to reference. */
+        _addReplyBlockToList(c,o->ptr,sdslen(o->ptr));
+    } else {
         incrRefCount(o);
         listAddNodeTail(c->reply,o);
-        c->reply_bytes += zmalloc_size_sds(o->ptr);
-    } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-        } else {
-            incrRefCount(o);
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += zmalloc_size_sds(o->ptr);
-        }
+        c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -178,25 +316,18 @@ void _addReplySdsToList(redisClient *c, sds s) {
         return;
     }
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,createObject(REDIS_STRING,s));
-        c->reply_bytes += zmalloc_size_sds(s);
+    /* Append to the last object when possible. */
+    if ((tail = replyListTailForAppend(c,sdslen(s))) != NULL) {
+        c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+        tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
+        c->reply_bytes += zmalloc_size_sds(tail->ptr);
+        sdsfree(s);
+    } else if (sdslen(s) <= REDIS_REPLY_BLOCK_BYTES) {
+        _addReplyBlockToList(c,s,sdslen(s));
+        sdsfree(s);
     } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+sdslen(s) <= REDIS_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,createObject(REDIS_STRING,s));
-            c->reply_bytes += zmalloc_size_sds(s);
-        }
+        listAddNodeTail(c->reply,createObject(REDIS_STRING,s));
+        c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -206,28 +337,18 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
+    /* Append to the last object when possible. */
+    if ((tail = replyListTailForAppend(c,len)) != NULL) {
+        c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+        tail->ptr = sdscatlen(tail->ptr,s,len);
+        c->reply_bytes += zmalloc_size_sds(tail->ptr);
+    } else if (len <= REDIS_REPLY_BLOCK_BYTES) {
+        _addReplyBlockToList(c,s,len);
+    } else {
         robj *o = createStringObject(s,len);
 
         listAddNodeTail(c->reply,o);
-        c->reply_bytes += zmalloc_size_sds(o->ptr);
-    } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+len <= REDIS_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,len);
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-        } else {
-            robj *o = createStringObject(s,len);
-
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += zmalloc_size_sds(o->ptr);
-        }
+        c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -346,6 +467,7 @@ void *addDeferredMultiBulkLength(redisClient *c) {
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != REDIS_OK) return NULL;
     listAddNodeTail(c->reply,createObject(REDIS_STRING,NULL));
+    c->reply_bytes += replyNodeMemoryUsage(listLast(c->reply));
     return listLast(c->reply);
 }
 
@@ -363,10 +485,14 @@ void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
+        /* Only glue when the next node is non-NULL (an sds in this case),
+         * and small enough: big objects, like values of keys, are better
+         * sent directly than copied. */
+        if (next->ptr != NULL &&
+            sdslen(len->ptr)+sdslen(next->ptr) <= REDIS_REPLY_CHUNK_BYTES)
+        {
             c->reply_bytes -= zmalloc_size_sds(len->ptr);
-            c->reply_bytes -= zmalloc_size_sds(next->ptr);
+            c->reply_bytes -= replyNodeMemoryUsage(ln->next);
             len->ptr = sdscatlen(len->ptr,next->ptr,sdslen(next->ptr));
             c->reply_bytes += zmalloc_size_sds(len->ptr);
             listDelNode(c->reply,ln->next);
@@ -421,6 +547,37 @@ void addReplyMultiBulkLen(redisClient *c, long length) {
     addReplyLongLongWithPrefix(c,length,'*');
 }
 
+/* Reply types of the RESP3 protocol (see HELLO). Clients still using the
+ * old protocol get the nearest RESP2 type, so commands can use them without
+ * checking the protocol version of the client. */
+
+/* A map of 'length' field-value pairs: %<length>. In RESP2 it is a flat
+ * multi bulk of length*2 elements. */
+void addReplyMapLen(redisClient *c, long length) {
+    if (c->resp == 2)
+        addReplyLongLongWithPrefix(c,length*2,'*');
+    else
+        addReplyLongLongWithPrefix(c,length,'%');
+}
+
+/* An out of band push message: ><length>. RESP2 has no push type, the
+ * message is sent as a multi bulk like Pub/Sub messages. */
+void addReplyPushLen(redisClient *c, long length) {
+    if (c->resp == 2)
+        addReplyLongLongWithPrefix(c,length,'*');
+    else
+        addReplyLongLongWithPrefix(c,length,'>');
+}
+
+/* The RESP3 null type, that replaces both the null bulk and the null
+ * multi bulk of RESP2. */
+void addReplyNull(redisClient *c) {
+    if (c->resp == 2)
+        addReply(c,shared.nullbulk);
+    else
+        addReplyString(c,"_\r\n",3);
+}
+
 /* Create the length prefix of a bulk reply, example: $2234 */
 void addReplyBulkLen(redisClient *c, robj *obj) {
     size_t len;
@@ -511,35 +668,48 @@ static void acceptCommonHandler(int fd) {
     server.stat_numconnections++;
 }
 
+/* The listening sockets are non blocking, so the accept handlers accept
+ * all the pending connections, up to REDIS_MAX_ACCEPTS_PER_CALL, instead of
+ * a single one per event: when many clients connect at the same time (for
+ * instance reconnecting after a failover) this drains the accept queue
+ * much faster, avoiding an overflow of the listen backlog. */
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cport, cfd;
-    char cip[128];
+    int cport, cfd, max = REDIS_MAX_ACCEPTS_PER_CALL;
+    char cip[REDIS_IP_STR_LEN];
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
     REDIS_NOTUSED(privdata);
 
-    cfd = anetTcpAccept(server.neterr, fd, cip, &cport);
-    if (cfd == AE_ERR) {
-        redisLog(REDIS_WARNING,"Accepting client connection: %s", server.neterr);
-        return;
+    while(max--) {
+        cfd = anetTcpNonBlockAccept(server.neterr,fd,cip,sizeof(cip),&cport);
+        if (cfd == ANET_ERR) {
+            if (errno != EWOULDBLOCK)
+                redisLog(REDIS_WARNING,
+                    "Accepting client connection: %s", server.neterr);
+            return;
+        }
+        redisLog(REDIS_VERBOSE,"Accepted %s:%d", cip, cport);
+        acceptCommonHandler(cfd);
     }
-    redisLog(REDIS_VERBOSE,"Accepted %s:%d", cip, cport);
-    acceptCommonHandler(cfd);
 }
 
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cfd;
+    int cfd, max = REDIS_MAX_ACCEPTS_PER_CALL;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
     REDIS_NOTUSED(privdata);
 
-    cfd = anetUnixAccept(server.neterr, fd);
-    if (cfd == AE_ERR) {
-        redisLog(REDIS_WARNING,"Accepting client connection: %s", server.neterr);
-        return;
+    while(max--) {
+        cfd = anetUnixNonBlockAccept(server.neterr, fd);
+        if (cfd == ANET_ERR) {
+            if (errno != EWOULDBLOCK)
+                redisLog(REDIS_WARNING,
+                    "Accepting client connection: %s", server.neterr);
+            return;
+        }
+        redisLog(REDIS_VERBOSE,"Accepted connection to %s", server.unixsocket);
+        acceptCommonHandler(cfd);
     }
-    redisLog(REDIS_VERBOSE,"Accepted connection to %s", server.unixsocket);
-    acceptCommonHandler(cfd);
 }
 
 
@@ -566,16 +736,24 @@ void freeClient(redisClient *c) {
 
     /* If this is marked as current client unset it */
     if (server.current_client == c) server.current_client = NULL;
+    if (server.reading_client == c) server.reading_client = NULL;
 
     /* Note that if the client we are freeing is blocked into a blocking
      * call, we have to set querybuf to NULL *before* to call
      * unblockClientWaitingData() to avoid processInputBuffer() will get
      * called. Also it is important to remove the file events after
      * this, because this call adds the READABLE event. */
-    sdsfree(c->querybuf);
+    if (c->querybuf == server.shared_querybuf)
+        sdsclear(server.shared_querybuf);
+    else
+        sdsfree(c->querybuf);
     c->querybuf = NULL;
-    if (c->flags & REDIS_BLOCKED)
-        unblockClientWaitingData(c);
+    if (c->flags & REDIS_BLOCKED) {
+        if (c->btype == REDIS_BLOCKED_WAIT)
+            unblockClientWaitingReplicas(c);
+        else
+            unblockClientWaitingData(c);
+    }
 
     /* UNWATCH all the keys */
     unwatchAllKeys(c);
@@ -585,6 +763,11 @@ void freeClient(redisClient *c) {
     pubsubUnsubscribeAllPatterns(c,0);
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
+    /* Stop receiving keys invalidation messages */
+    disableTracking(c);
+    /* The thread reading the stream of our master must be stopped before
+     * the socket is closed. */
+    if (c->flags & REDIS_MASTER) replicationStopReaderThread();
     /* Obvious cleanup */
     aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
     aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
@@ -608,6 +791,7 @@ void freeClient(redisClient *c) {
     if (c->flags & REDIS_SLAVE) {
         if (c->replstate == REDIS_REPL_SEND_BULK && c->repldbfd != -1)
             close(c->repldbfd);
+        if (c->repl_frame) sdsfree(c->repl_frame);
         list *l = (c->flags & REDIS_MONITOR) ? server.monitors : server.slaves;
         ln = listSearchKey(l,c);
         redisAssert(ln != NULL);
@@ -617,6 +801,8 @@ void freeClient(redisClient *c) {
     /* Case 2: we lost the connection with the master. */
     if (c->flags & REDIS_MASTER) {
         server.master = NULL;
+        sdsclear(server.repl_proxy_pending);
+        sdsclear(server.repl_transfer_frame);
         server.repl_state = REDIS_REPL_CONNECT;
         server.repl_down_since = server.unixtime;
         /* We lost connection with our master, force our slaves to resync
@@ -636,6 +822,9 @@ void freeClient(redisClient *c) {
     }
 
     /* Release memory */
+    server.clients_mem_usage -= c->mem_usage;
+    if (c->mem_usage >= REDIS_MAXMEMORY_CLIENTS_MIN_USAGE)
+        server.clients_big_mem--;
     zfree(c->argv);
     freeClientMultiState(c);
     zfree(c);
@@ -662,59 +851,106 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Process the events of the other clients while a command takes long to
+ * execute (slow scripts, loading). The handlers of the other clients set
+ * server.current_client, so it is restored once they return. */
+void processEventsWhileBlocked(void) {
+    redisClient *c = server.current_client;
+
+    aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+    server.current_client = c;
+}
+
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
-    robj *o;
+    struct iovec iov[REDIS_IOV_MAX];
+    int nwritten = 0, totwritten = 0;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
 
-    while(c->bufpos > 0 || listLength(c->reply)) {
+    while(clientHasPendingReplies(c)) {
+        int iovcnt = 0;
+        size_t iovlen = 0, sentlen = c->sentlen, remaining;
+        listIter li;
+        listNode *ln;
+        robj *o;
+
+        /* Gather the static buffer and the objects in the reply list into
+         * a single writev() call. Note that c->sentlen always refers to the
+         * first chunk: the buffer if not empty, otherwise the head of the
+         * list. We stop adding chunks once REDIS_MAX_WRITE_PER_EVENT bytes
+         * are collected, there is no point in preparing more than that. */
         if (c->bufpos > 0) {
-            if (c->flags & REDIS_MASTER) {
-                /* Don't reply to a master */
-                nwritten = c->bufpos - c->sentlen;
-            } else {
-                nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-                if (nwritten <= 0) break;
-            }
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+            iov[iovcnt].iov_base = c->buf+sentlen;
+            iov[iovcnt].iov_len = c->bufpos-sentlen;
+            iovlen += iov[iovcnt].iov_len;
+            iovcnt++;
+            sentlen = 0;
+        }
+        listRewind(c->reply,&li);
+        while(iovcnt < REDIS_IOV_MAX && iovlen < REDIS_MAX_WRITE_PER_EVENT &&
+              (ln = listNext(&li)) != NULL)
+        {
+            size_t objlen;
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if (c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
+            o = listNodeValue(ln);
             objlen = sdslen(o->ptr);
-            objmem = zmalloc_size_sds(o->ptr);
+            if (objlen == 0) continue;
+            iov[iovcnt].iov_base = ((char*)o->ptr)+sentlen;
+            iov[iovcnt].iov_len = objlen-sentlen;
+            iovlen += iov[iovcnt].iov_len;
+            iovcnt++;
+            sentlen = 0;
+        }
 
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
+        if (iovlen == 0) {
+            nwritten = 0;
+        } else {
+            nwritten = writev(fd,iov,iovcnt);
+            if (nwritten <= 0) break;
+        }
+        totwritten += nwritten;
 
-            if (c->flags & REDIS_MASTER) {
-                /* Don't reply to a master */
-                nwritten = objlen - c->sentlen;
+        /* Remove from the buffer and the list what was sent. Empty
+         * objects at the head of the list are removed as well. */
+        remaining = nwritten;
+        if (c->bufpos > 0) {
+            if (remaining >= (size_t)(c->bufpos-c->sentlen)) {
+                remaining -= c->bufpos-c->sentlen;
+                c->bufpos = 0;
+                c->sentlen = 0;
             } else {
-                nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-                if (nwritten <= 0) break;
+                c->sentlen += remaining;
+                remaining = 0;
             }
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+        }
+        while(c->bufpos == 0 && (ln = listFirst(c->reply)) != NULL) {
+            size_t objlen;
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
+            o = listNodeValue(ln);
+            objlen = sdslen(o->ptr);
+            if (remaining < objlen-c->sentlen) {
+                c->sentlen += remaining;
+                break;
+            }
+            /* A slave keeps the block the replication stream is being
+             * appended to, so that it is still attached to it and the
+             * next writes don't need to start a new block. */
+            if (o == server.repl_block && ln == listLast(c->reply) &&
+                sdsavail(o->ptr) > 0)
+            {
+                c->sentlen = objlen;
+                break;
             }
+            remaining -= objlen-c->sentlen;
+            c->sentlen = 0;
+            c->reply_bytes -= replyNodeMemoryUsage(ln);
+            listDelNode(c->reply,ln);
         }
+
+        /* A short write means the socket buffer is full. */
+        if ((size_t)nwritten < iovlen) break;
+
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -738,50 +974,115 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
     if (totwritten > 0) c->lastinteraction = server.unixtime;
-    if (c->bufpos == 0 && listLength(c->reply) == 0) {
-        c->sentlen = 0;
+    if (!clientHasPendingReplies(c)) {
+        if (listLength(c->reply) == 0) c->sentlen = 0;
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+            freeClient(c);
+            return;
+        }
     }
+    updateClientMemUsage(c);
+}
+
+/* Make sure the argv array of the client can hold 'argc' arguments. The
+ * array is reused from command to command, and is only reallocated when it
+ * is too small, or too big to be worth keeping around. */
+static void clientArgvMakeRoom(redisClient *c, int argc) {
+    if (argc <= c->argv_len && c->argv_len <= REDIS_ARGV_REUSE_MAX) return;
+    zfree(c->argv);
+    c->argv = zmalloc(sizeof(robj*)*argc);
+    c->argv_len = argc;
 }
 
 /* resetClient prepare the client to process the next command */
 void resetClient(redisClient *c) {
+    redisCommandProc *prevcmd = c->cmd ? c->cmd->proc : NULL;
+
     freeClientArgv(c);
     c->reqtype = 0;
     c->multibulklen = 0;
     c->bulklen = -1;
-    /* We clear the ASKING flag as well if we are not inside a MULTI. */
-    if (!(c->flags & REDIS_MULTI)) c->flags &= (~REDIS_ASKING);
+    /* We clear the ASKING flag as well if we are not inside a MULTI, and
+     * if what we just executed is not the ASKING command itself. */
+    if (!(c->flags & REDIS_MULTI) && prevcmd != askingCommand)
+        c->flags &= (~REDIS_ASKING);
 }
 
+/* Parse the length of a multi bulk or bulk count. Lengths are almost always
+ * short strings of digits, that are converted here with a tight loop, while
+ * everything else (signs, overflows, invalid strings) is left to the full
+ * string2ll() implementation. */
+static int parseProtoLength(const char *p, size_t len, long long *value) {
+    if (len > 0 && len <= 18 && (p[0] != '0' || len == 1)) {
+        long long v = 0;
+        size_t j;
+
+        for (j = 0; j < len; j++) {
+            unsigned int digit = (unsigned char)p[j] - '0';
+
+            if (digit > 9) break;
+            v = v*10 + digit;
+        }
+        if (j == len) {
+            *value = v;
+            return 1;
+        }
+    }
+    return string2ll(p,len,value);
+}
+
+/* Called by the parsing functions every time they consume 'len' bytes of
+ * the query buffer: if the client is our master the bytes are accumulated
+ * in server.repl_proxy_pending, and proxied verbatim to our slaves once the
+ * command they belong to is complete, see processInputBuffer(). */
+static void masterStreamConsumed(redisClient *c, char *p, size_t len) {
+    if (!(c->flags & REDIS_MASTER) || len == 0) return;
+    server.repl_proxy_pending = sdscatlen(server.repl_proxy_pending,p,len);
+}
+
+/* The parsing functions below don't trim the query buffer after every
+ * request, that would move the rest of the pipeline every time: c->qb_pos
+ * is the offset of the first byte not yet processed, and the buffer is
+ * trimmed once by processInputBuffer(). Delimiters are searched with
+ * memchr(), that the C library implements using SIMD instructions. */
 int processInlineBuffer(redisClient *c) {
-    char *newline = strstr(c->querybuf,"\r\n");
+    char *buf = c->querybuf+c->qb_pos, *newline = buf;
+    size_t len = sdslen(c->querybuf)-c->qb_pos;
     int argc, j;
     sds *argv;
     size_t querylen;
 
+    /* Search for the first \r\n */
+    do {
+        newline = memchr(newline,'\n',len-(newline-buf));
+        if (newline == NULL || (newline > buf && newline[-1] == '\r')) break;
+        newline++;
+    } while(newline < buf+len);
+    if (newline != NULL && newline >= buf+len) newline = NULL;
+
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
+        if (len > REDIS_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError(c,0);
+            setProtocolError(c,c->qb_pos);
         }
         return REDIS_ERR;
     }
+    newline--; /* Point to the \r */
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    argv = sdssplitlen(c->querybuf,querylen," ",1,&argc);
+    querylen = newline-buf;
+    argv = sdssplitlen(buf,querylen," ",1,&argc);
 
     /* Leave data after the first line of the query in the buffer */
-    c->querybuf = sdsrange(c->querybuf,querylen+2,-1);
+    masterStreamConsumed(c,buf,querylen+2);
+    c->qb_pos += querylen+2;
 
     /* Setup argv array on client structure */
-    if (c->argv) zfree(c->argv);
-    c->argv = zmalloc(sizeof(robj*)*argc);
+    clientArgvMakeRoom(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -796,8 +1097,8 @@ int processInlineBuffer(redisClient *c) {
     return REDIS_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
+/* Helper function. Marks the client to be closed and discards the data
+ * processed so far, up to the offset 'pos' of the query buffer. */
 static void setProtocolError(redisClient *c, int pos) {
     if (server.verbosity >= REDIS_VERBOSE) {
         sds client = getClientInfoString(c);
@@ -806,12 +1107,13 @@ static void setProtocolError(redisClient *c, int pos) {
         sdsfree(client);
     }
     c->flags |= REDIS_CLOSE_AFTER_REPLY;
-    c->querybuf = sdsrange(c->querybuf,pos,-1);
+    c->qb_pos = pos;
 }
 
 int processMultibulkBuffer(redisClient *c) {
     char *newline = NULL;
-    int pos = 0, ok;
+    int pos = c->qb_pos, mark = pos, ok;
+    size_t qblen = sdslen(c->querybuf);
     long long ll;
 
     if (c->multibulklen == 0) {
@@ -819,23 +1121,24 @@ int processMultibulkBuffer(redisClient *c) {
         redisAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = memchr(c->querybuf+pos,'\r',qblen-pos);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
+            if (qblen-pos > REDIS_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError(c,0);
+                setProtocolError(c,pos);
             }
             return REDIS_ERR;
         }
 
         /* Buffer should also contain \n */
-        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+        if (newline-(c->querybuf) > ((signed)qblen-2))
             return REDIS_ERR;
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        redisAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        redisAssertWithInfo(c,NULL,c->querybuf[pos] == '*');
+        ok = parseProtoLength(c->querybuf+pos+1,
+                              newline-(c->querybuf+pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
             setProtocolError(c,pos);
@@ -844,32 +1147,33 @@ int processMultibulkBuffer(redisClient *c) {
 
         pos = (newline-c->querybuf)+2;
         if (ll <= 0) {
-            c->querybuf = sdsrange(c->querybuf,pos,-1);
+            masterStreamConsumed(c,c->querybuf+mark,pos-mark);
+            c->qb_pos = pos;
             return REDIS_OK;
         }
 
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        clientArgvMakeRoom(c,c->multibulklen);
     }
 
     redisAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = memchr(c->querybuf+pos,'\r',qblen-pos);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
+                if (qblen-pos > REDIS_INLINE_MAX_SIZE) {
                     addReplyError(c,"Protocol error: too big bulk count string");
-                    setProtocolError(c,0);
+                    setProtocolError(c,pos);
+                    return REDIS_ERR;
                 }
                 break;
             }
 
             /* Buffer should also contain \n */
-            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+            if (newline-(c->querybuf) > ((signed)qblen-2))
                 break;
 
             if (c->querybuf[pos] != '$') {
@@ -880,7 +1184,8 @@ int processMultibulkBuffer(redisClient *c) {
                 return REDIS_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = parseProtoLength(c->querybuf+pos+1,
+                                  newline-(c->querybuf+pos+1),&ll);
             if (!ok || ll < 0 || ll > 512*1024*1024) {
                 addReplyError(c,"Protocol error: invalid bulk length");
                 setProtocolError(c,pos);
@@ -892,18 +1197,26 @@ int processMultibulkBuffer(redisClient *c) {
                 /* If we are going to read a large object from network
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimized object creation
-                 * avoiding a large copy of data. */
-                c->querybuf = sdsrange(c->querybuf,pos,-1);
-                pos = 0;
+                 * avoiding a large copy of data. Big arguments are always
+                 * read using the private query buffer of the client. */
+                masterStreamConsumed(c,c->querybuf+mark,pos-mark);
+                if (c->querybuf == server.shared_querybuf) {
+                    c->querybuf = sdsnewlen(c->querybuf+pos,qblen-pos);
+                    sdsclear(server.shared_querybuf);
+                } else {
+                    c->querybuf = sdsrange(c->querybuf,pos,-1);
+                }
+                pos = mark = 0;
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
                 c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2);
+                qblen = sdslen(c->querybuf);
             }
             c->bulklen = ll;
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if (qblen-pos < (unsigned)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
@@ -912,15 +1225,17 @@ int processMultibulkBuffer(redisClient *c) {
              * just use the current sds string. */
             if (pos == 0 &&
                 c->bulklen >= REDIS_MBULK_BIG_ARG &&
-                (signed) sdslen(c->querybuf) == c->bulklen+2)
+                (signed) qblen == c->bulklen+2)
             {
+                masterStreamConsumed(c,c->querybuf,qblen);
                 c->argv[c->argc++] = createObject(REDIS_STRING,c->querybuf);
                 sdsIncrLen(c->querybuf,-2); /* remove CRLF */
                 c->querybuf = sdsempty();
                 /* Assume that if we saw a fat argument we'll see another one
                  * likely... */
                 c->querybuf = sdsMakeRoomFor(c->querybuf,c->bulklen+2);
-                pos = 0;
+                qblen = 0;
+                pos = mark = 0;
             } else {
                 c->argv[c->argc++] =
                     createStringObject(c->querybuf+pos,c->bulklen);
@@ -931,8 +1246,9 @@ int processMultibulkBuffer(redisClient *c) {
         }
     }
 
-    /* Trim to pos */
-    if (pos) c->querybuf = sdsrange(c->querybuf,pos,-1);
+    /* Discard the data processed */
+    masterStreamConsumed(c,c->querybuf+mark,pos-mark);
+    c->qb_pos = pos;
 
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return REDIS_OK;
@@ -941,49 +1257,74 @@ int processMultibulkBuffer(redisClient *c) {
     return REDIS_ERR;
 }
 
+/* Parse the next request in the query buffer of the client into
+ * c->argc / c->argv. REDIS_OK is returned when a whole request was parsed,
+ * otherwise more data is needed (or a protocol error was found, in that
+ * case the client is flagged with REDIS_CLOSE_AFTER_REPLY). */
+static int parseRequest(redisClient *c) {
+    /* Determine request type when unknown. */
+    if (!c->reqtype) {
+        if (c->querybuf[c->qb_pos] == '*') {
+            c->reqtype = REDIS_REQ_MULTIBULK;
+        } else {
+            c->reqtype = REDIS_REQ_INLINE;
+        }
+    }
+
+    if (c->reqtype == REDIS_REQ_INLINE) {
+        return processInlineBuffer(c);
+    } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
+        return processMultibulkBuffer(c);
+    } else {
+        redisPanic("Unknown request type");
+        return REDIS_ERR; /* Not reached. */
+    }
+}
+
 void processInputBuffer(redisClient *c) {
     /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    while(c->qb_pos < sdslen(c->querybuf)) {
         /* Immediately abort if the client is in the middle of something. */
-        if (c->flags & REDIS_BLOCKED) return;
+        if (c->flags & REDIS_BLOCKED) break;
 
         /* REDIS_CLOSE_AFTER_REPLY closes the connection once the reply is
          * written to the client. Make sure to not let the reply grow after
          * this flag has been set (i.e. don't process more commands). */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
-
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = REDIS_REQ_MULTIBULK;
-            } else {
-                c->reqtype = REDIS_REQ_INLINE;
-            }
-        }
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) break;
 
-        if (c->reqtype == REDIS_REQ_INLINE) {
-            if (processInlineBuffer(c) != REDIS_OK) break;
-        } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != REDIS_OK) break;
-        } else {
-            redisPanic("Unknown request type");
-        }
+        if (parseRequest(c) != REDIS_OK) break;
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
         } else {
+            int dictid = c->db->id;
+
             /* Only reset the client when the command was executed. */
             if (processCommand(c) == REDIS_OK)
                 resetClient(c);
+
+            /* Proxy the command to our slaves exactly as it was received
+             * from our master. */
+            if (c->flags & REDIS_MASTER)
+                replicationProxyMasterStream(dictid,c->db->id);
         }
     }
+
+    /* Trim the processed data from the query buffer. */
+    if (c->qb_pos) {
+        c->querybuf = sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *c = (redisClient*) privdata;
     int nread, readlen;
     size_t qblen;
+    sds qb, privqb = NULL;
+    redisClient *prev_reading_client;
+    int freed;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
 
@@ -1003,10 +1344,28 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (remaining < readlen) readlen = remaining;
     }
 
-    qblen = sdslen(c->querybuf);
+    /* When there is no pending data in the query buffer of the client we
+     * read into the shared query buffer instead, and the data is moved into
+     * the private buffer of the client only if a command is left incomplete
+     * once the buffer is processed. This way idle clients don't hold a
+     * query buffer at all.
+     *
+     * Events may be processed while a command is executed (slow scripts,
+     * loading), so the shared buffer is only used when it holds no data
+     * still pending for another client. */
+    if (sdslen(c->querybuf) == 0 && sdslen(server.shared_querybuf) == 0 &&
+        readlen == REDIS_IOBUF_LEN)
+    {
+        qb = server.shared_querybuf;
+    } else {
+        qb = c->querybuf;
+    }
+
+    qblen = sdslen(qb);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
-    c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    qb = sdsMakeRoomFor(qb, readlen);
+    if (qb != server.shared_querybuf) c->querybuf = qb;
+    nread = read(fd, qb+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
             nread = 0;
@@ -1021,12 +1380,23 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
     if (nread) {
-        sdsIncrLen(c->querybuf,nread);
+        sdsIncrLen(qb,nread);
         c->lastinteraction = server.unixtime;
+        if (c->flags & REDIS_MASTER) server.slave_repl_read += nread;
     } else {
         server.current_client = NULL;
         return;
     }
+    if (qb == server.shared_querybuf) {
+        privqb = c->querybuf;
+        c->querybuf = qb;
+    }
+
+    /* The client may be freed while its input is processed, and events of
+     * other clients may be processed meanwhile (slow scripts, loading), so
+     * we track explicitly if it is still alive. */
+    prev_reading_client = server.reading_client;
+    server.reading_client = c;
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = getClientInfoString(c), bytes = sdsempty();
 
@@ -1035,9 +1405,32 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(ci);
         sdsfree(bytes);
         freeClient(c);
-        return;
+    } else {
+        processInputBuffer(c);
     }
-    processInputBuffer(c);
+    freed = server.reading_client != c;
+    server.reading_client = prev_reading_client;
+
+    /* Give the shared query buffer back. If the client was freed while
+     * processing its input, freeClient() already cleared the buffer. */
+    if (privqb) {
+        if (freed) {
+            sdsfree(privqb);
+        } else if (c->querybuf == server.shared_querybuf) {
+            privqb = sdscatlen(privqb,c->querybuf,sdslen(c->querybuf));
+            c->querybuf = privqb;
+        } else {
+            /* A big argument moved the data to a new private buffer. */
+            sdsfree(privqb);
+        }
+        sdsclear(server.shared_querybuf);
+    }
+
+    /* Don't keep a big private buffer around once all its data was
+     * processed, the next read will use the shared buffer anyway. */
+    if (!freed && sdslen(c->querybuf) == 0 && sdsavail(c->querybuf) > 1024)
+        c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+    if (!freed) updateClientMemUsage(c);
     server.current_client = NULL;
 }
 
@@ -1061,11 +1454,10 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
 
 /* Turn a Redis client into an sds string representing its state. */
 sds getClientInfoString(redisClient *client) {
-    char ip[32], flags[16], events[3], *p;
-    int port;
+    char peer[ANET_ADDR_STR_LEN], flags[16], events[3], *p;
     int emask;
 
-    anetPeerToString(client->fd,ip,&port);
+    anetFormatPeer(client->fd,peer,sizeof(peer));
     p = flags;
     if (client->flags & REDIS_SLAVE) {
         if (client->flags & REDIS_MONITOR)
@@ -1080,6 +1472,8 @@ sds getClientInfoString(redisClient *client) {
     if (client->flags & REDIS_CLOSE_AFTER_REPLY) *p++ = 'c';
     if (client->flags & REDIS_UNBLOCKED) *p++ = 'u';
     if (client->flags & REDIS_CLOSE_ASAP) *p++ = 'A';
+    if (client->flags & REDIS_TRACKING) *p++ = 't';
+    if (client->flags & REDIS_READONLY) *p++ = 'r';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
@@ -1089,8 +1483,8 @@ sds getClientInfoString(redisClient *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatprintf(sdsempty(),
-        "addr=%s:%d fd=%d age=%ld idle=%ld flags=%s db=%d sub=%d psub=%d multi=%d qbuf=%lu qbuf-free=%lu obl=%lu oll=%lu omem=%lu events=%s cmd=%s",
-        ip,port,client->fd,
+        "id=%lu addr=%s fd=%d age=%ld idle=%ld flags=%s db=%d sub=%d psub=%d multi=%d qbuf=%lu qbuf-free=%lu obl=%lu oll=%lu omem=%lu tot-mem=%lu events=%s cmd=%s",
+        client->id,peer,client->fd,
         (long)(server.unixtime - client->ctime),
         (long)(server.unixtime - client->lastinteraction),
         flags,
@@ -1098,11 +1492,12 @@ sds getClientInfoString(redisClient *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & REDIS_MULTI) ? client->mstate.count : -1,
-        (unsigned long) sdslen(client->querybuf),
+        (unsigned long) (sdslen(client->querybuf)-client->qb_pos),
         (unsigned long) sdsavail(client->querybuf),
         (unsigned long) client->bufpos,
         (unsigned long) listLength(client->reply),
         getClientOutputBufferMemoryUsage(client),
+        (unsigned long) getClientMemoryUsage(client),
         events,
         client->lastcmd ? client->lastcmd->name : "NULL");
 }
@@ -1138,13 +1533,12 @@ void clientCommand(redisClient *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"kill") && c->argc == 3) {
         listRewind(server.clients,&li);
         while ((ln = listNext(&li)) != NULL) {
-            char ip[32], addr[64];
-            int port;
+            char peer[ANET_ADDR_STR_LEN];
 
             client = listNodeValue(ln);
-            if (anetPeerToString(client->fd,ip,&port) == -1) continue;
-            snprintf(addr,sizeof(addr),"%s:%d",ip,port);
-            if (strcmp(addr,c->argv[2]->ptr) == 0) {
+            if (anetPeerToString(client->fd,NULL,0,NULL) == -1) continue;
+            anetFormatPeer(client->fd,peer,sizeof(peer));
+            if (strcmp(peer,c->argv[2]->ptr) == 0) {
                 addReply(c,shared.ok);
                 if (c == client) {
                     client->flags |= REDIS_CLOSE_AFTER_REPLY;
@@ -1155,9 +1549,87 @@ void clientCommand(redisClient *c) {
             }
         }
         addReplyError(c,"No such client");
+    } else if (!strcasecmp(c->argv[1]->ptr,"id") && c->argc == 2) {
+        addReplyLongLong(c,c->id);
+    } else if (!strcasecmp(c->argv[1]->ptr,"tracking") && c->argc == 3) {
+        if (!strcasecmp(c->argv[2]->ptr,"on")) {
+            /* Invalidation messages are push messages, that can't be
+             * told apart from replies using the old protocol. */
+            if (c->resp < 3) {
+                addReplyError(c,"Keys tracking requires the RESP3 protocol, "
+                                "switch with HELLO 3");
+                return;
+            }
+            enableTracking(c);
+        } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+            disableTracking(c);
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        addReply(c,shared.ok);
     } else {
-        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL ip:port)");
+        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL ip:port | ID | TRACKING on|off)");
+    }
+}
+
+/* HELLO [protover]
+ *
+ * Switch the client to the specified protocol version (2 or 3), and reply
+ * with a map describing the server. Without arguments the protocol is not
+ * changed. */
+void helloCommand(redisClient *c) {
+    long long ver;
+    char *mode;
+
+    if (c->argc > 2) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 2) {
+        if (getLongLongFromObject(c->argv[1],&ver) != REDIS_OK ||
+            ver < 2 || ver > 3)
+        {
+            addReplyString(c,"-NOPROTO unsupported protocol version\r\n",39);
+            return;
+        }
+        /* Using RESP2 invalidation messages can't be parsed anymore. */
+        if (ver == 2) disableTracking(c);
+        c->resp = ver;
     }
+
+    if (server.sentinel_mode) mode = "sentinel";
+    else if (server.cluster_enabled) mode = "cluster";
+    else mode = "standalone";
+
+    addReplyMapLen(c,6);
+    addReplyBulkCString(c,"server");
+    addReplyBulkCString(c,"redis");
+    addReplyBulkCString(c,"version");
+    addReplyBulkCString(c,REDIS_VERSION);
+    addReplyBulkCString(c,"proto");
+    addReplyLongLong(c,c->resp);
+    addReplyBulkCString(c,"id");
+    addReplyLongLong(c,c->id);
+    addReplyBulkCString(c,"mode");
+    addReplyBulkCString(c,mode);
+    addReplyBulkCString(c,"role");
+    addReplyBulkCString(c,server.masterhost ? "slave" : "master");
+}
+
+/* Completely replace the client command vector with the provided one,
+ * taking ownership of the 'argv' array: the reference count of the objects
+ * is not incremented. */
+void replaceClientCommandVector(redisClient *c, int argc, robj **argv) {
+    int j;
+
+    for (j = 0; j < c->argc; j++) decrRefCount(c->argv[j]);
+    zfree(c->argv);
+    c->argv = argv;
+    c->argv_len = argc;
+    c->argc = argc;
+    c->cmd = lookupCommand(c->argv[0]->ptr);
+    redisAssertWithInfo(c,NULL,c->cmd != NULL);
 }
 
 /* Rewrite the command vector of the client. All the new objects ref count
@@ -1180,13 +1652,7 @@ void rewriteClientCommandVector(redisClient *c, int argc, ...) {
     /* We free the objects in the original vector at the end, so we are
      * sure that if the same objects are reused in the new vector the
      * refcount gets incremented before it gets decremented. */
-    for (j = 0; j < c->argc; j++) decrRefCount(c->argv[j]);
-    zfree(c->argv);
-    /* Replace argv and argc with our new versions. */
-    c->argv = argv;
-    c->argc = argc;
-    c->cmd = lookupCommand(c->argv[0]->ptr);
-    redisAssertWithInfo(c,NULL,c->cmd != NULL);
+    replaceClientCommandVector(c,argc,argv);
     va_end(ap);
 }
 
@@ -1213,18 +1679,49 @@ void rewriteClientCommandArgument(redisClient *c, int i, robj *newval) {
  * It is "virtual" since the reply output list may contain objects that
  * are shared and are not really using additional memory.
  *
- * The function returns the total sum of the length of all the objects
- * stored in the output list, plus the memory used to allocate every
- * list node. The static reply buffer is not taken into account since it
- * is allocated anyway.
+ * The function returns the memory allocated for the output list, as
+ * reported by the allocator: the list nodes, the objects and their strings.
+ * It is kept updated every time the list is modified, see reply_bytes.
+ * The static reply buffer is not taken into account since it is allocated
+ * anyway as part of the client structure.
  *
  * Note: this function is very fast so can be called as many time as
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(redisClient *c) {
-    unsigned long list_item_size = sizeof(listNode)+sizeof(robj);
+    return c->reply_bytes;
+}
 
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+/* Total memory used by the client: the client structure (including the
+ * static reply buffer), the query buffer, the arguments vector and the
+ * output list. */
+size_t getClientMemoryUsage(redisClient *c) {
+    size_t mem = zmalloc_size(c) + getClientOutputBufferMemoryUsage(c);
+
+    if (c->querybuf && c->querybuf != server.shared_querybuf)
+        mem += zmalloc_size_sds(c->querybuf);
+    if (c->argv) mem += zmalloc_size(c->argv);
+    return mem;
+}
+
+/* Update the memory used by the client in server.clients_mem_usage, that
+ * is checked against maxmemory-clients. Slaves and the master are not
+ * accounted since they have their own limits, and can't be evicted. */
+void updateClientMemUsage(redisClient *c) {
+    size_t mem = 0;
+
+    if (c->fd == -1) return; /* Lua and AOF loading clients. */
+    if (!(c->flags & (REDIS_SLAVE|REDIS_MASTER)))
+        mem = getClientMemoryUsage(c);
+    server.clients_mem_usage -= c->mem_usage;
+    server.clients_mem_usage += mem;
+    /* Track the clients that the clients-first policy may close, so that
+     * they are only searched when there is at least one. */
+    if (c->mem_usage >= REDIS_MAXMEMORY_CLIENTS_MIN_USAGE)
+        server.clients_big_mem--;
+    if (mem >= REDIS_MAXMEMORY_CLIENTS_MIN_USAGE)
+        server.clients_big_mem++;
+    c->mem_usage = mem;
 }
 
 /* Get the class of a client, used in order to envorce limits to different
@@ -1315,6 +1812,89 @@ void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) {
         redisLog(REDIS_WARNING,"Client %s scheduled to be closed ASAP for overcoming of output buffer limits.", client);
         sdsfree(client);
     }
+    updateClientMemUsage(c);
+}
+
+static int clientMemUsageCompare(const void *a, const void *b) {
+    const redisClient *ca = *(redisClient**)a, *cb = *(redisClient**)b;
+
+    if (ca->mem_usage == cb->mem_usage) return 0;
+    return (ca->mem_usage > cb->mem_usage) ? -1 : 1;
+}
+
+/* Close the normal clients using more memory first, until the clients
+ * closed are going to release at least 'tofree' bytes. Only clients using
+ * at least 'min_usage' bytes are considered. Clients already scheduled to be
+ * closed count as memory being released, so calling this function again
+ * before they are actually freed does not close more clients.
+ *
+ * Clients are closed asynchronously, so this is safe to call from any
+ * context. The function returns the number of bytes that will be released,
+ * that may be less than 'tofree'. */
+size_t freeClientsMemory(size_t tofree, size_t min_usage, char *reason) {
+    redisClient **clients;
+    size_t freed = 0;
+    unsigned long numclients = 0, j;
+    listIter li;
+    listNode *ln;
+
+    /* Fast path: this is called for every command when over maxmemory, and
+     * most of the times no client is big enough to be closed. */
+    if (min_usage >= REDIS_MAXMEMORY_CLIENTS_MIN_USAGE &&
+        server.clients_big_mem == 0) return 0;
+
+    clients = zmalloc(sizeof(redisClient*)*listLength(server.clients));
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li)) != NULL) {
+        redisClient *c = listNodeValue(ln);
+
+        if (c->flags & REDIS_CLOSE_ASAP) {
+            freed += c->mem_usage;
+            continue;
+        }
+        if (c->mem_usage && c->mem_usage >= min_usage)
+            clients[numclients++] = c;
+    }
+    qsort(clients,numclients,sizeof(redisClient*),clientMemUsageCompare);
+
+    for (j = 0; j < numclients && freed < tofree; j++) {
+        sds client = getClientInfoString(clients[j]);
+
+        freed += clients[j]->mem_usage;
+        freeClientAsync(clients[j]);
+        server.stat_evictedclients++;
+        redisLog(REDIS_WARNING,"Client %s scheduled to be closed ASAP for overcoming of %s.", client, reason);
+        sdsfree(client);
+    }
+    zfree(clients);
+    return freed;
+}
+
+/* If the memory used by the clients is over maxmemory-clients, close the
+ * clients using more memory first until we are under the limit.
+ *
+ * With the clients-first maxmemory-clients-policy the same is done when the
+ * server is over maxmemory, closing only the clients using a significant
+ * amount of memory: this way clients filling their buffers are closed as
+ * soon as possible, even if they are not sending complete commands that
+ * would trigger the eviction of keys. */
+void evictClientsIfNeeded(void) {
+    if (server.maxmemory_clients &&
+        server.clients_mem_usage > server.maxmemory_clients)
+    {
+        freeClientsMemory(server.clients_mem_usage - server.maxmemory_clients,
+                          1,"maxmemory-clients");
+    }
+
+    if (server.maxmemory &&
+        server.maxmemory_clients_policy == REDIS_MAXMEMORY_CLIENTS_FIRST)
+    {
+        size_t used = getMaxmemoryUsedMemory();
+
+        if (used > server.maxmemory)
+            freeClientsMemory(used - server.maxmemory,
+                              REDIS_MAXMEMORY_CLIENTS_MIN_USAGE,"maxmemory");
+    }
 }
 
 /* Helper function used by freeMemoryIfNeeded() in order to flush slaves
@@ -1331,9 +1911,84 @@ void flushSlavesOutputBuffers(void) {
         events = aeGetFileEvents(server.el,slave->fd);
         if (events & AE_WRITABLE &&
             slave->replstate == REDIS_REPL_ONLINE &&
-            listLength(slave->reply))
+            clientHasPendingReplies(slave))
         {
             sendReplyToClient(server.el,slave->fd,slave,0);
         }
     }
 }
+
+/* -----------------------------------------------------------------------------
+ * Protocol parser benchmark (redis-server --test-parser).
+ * -------------------------------------------------------------------------- */
+
+/* Parse the requests in the specified file, that should contain Redis
+ * protocol (for instance an append only file, that is just the captured
+ * stream of write commands received by the server), 'iterations' times.
+ * The data is fed to the parser REDIS_IOBUF_LEN bytes at a time, like
+ * readQueryFromClient() does, and the commands are not executed. */
+void parserBenchmark(char *filename, int iterations) {
+    FILE *fp = fopen(filename,"r");
+    sds data = sdsempty();
+    char buf[REDIS_IOBUF_LEN];
+    size_t nread;
+    redisClient *c;
+    long long start, elapsed, commands = 0;
+    double bytes;
+    int j;
+
+    if (fp == NULL) {
+        fprintf(stderr,"Can't open %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    while((nread = fread(buf,1,sizeof(buf),fp)) > 0)
+        data = sdscatlen(data,buf,nread);
+    fclose(fp);
+
+    /* A client not bound to any socket: replies (to protocol errors)
+     * are discarded by prepareClientToWrite(). */
+    c = zcalloc(sizeof(*c));
+    c->fd = -1;
+    c->querybuf = sdsempty();
+    c->bulklen = -1;
+
+    start = ustime();
+    for (j = 0; j < iterations; j++) {
+        size_t pos = 0;
+
+        while(pos < sdslen(data)) {
+            size_t len = sdslen(data)-pos;
+
+            if (len > REDIS_IOBUF_LEN) len = REDIS_IOBUF_LEN;
+            c->querybuf = sdscatlen(c->querybuf,data+pos,len);
+            pos += len;
+            while(c->qb_pos < sdslen(c->querybuf) &&
+                  parseRequest(c) == REDIS_OK)
+            {
+                if (c->argc) commands++;
+                resetClient(c);
+            }
+            c->querybuf = sdsrange(c->querybuf,c->qb_pos,-1);
+            c->qb_pos = 0;
+            if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+                fprintf(stderr,"Protocol error near offset %zu of %s\n",
+                    pos-sdslen(c->querybuf), filename);
+                exit(1);
+            }
+        }
+    }
+    elapsed = ustime()-start;
+    if (elapsed == 0) elapsed = 1;
+    bytes = (double)sdslen(data)*iterations;
+
+    printf("%lld commands, %.2f MB parsed in %.3f seconds\n",
+        commands, bytes/(1024*1024), (double)elapsed/1000000);
+    printf("%.2f commands per second, %.2f MB per second\n",
+        (double)commands*1000000/elapsed,
+        bytes*1000000/elapsed/(1024*1024));
+
+    sdsfree(data);
+    sdsfree(c->querybuf);
+    zfree(c->argv);
+    zfree(c);
+}
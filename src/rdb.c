@@ -10,6 +10,7 @@
 #include <sys/wait.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 static int rdbWriteRaw(rio *rdb, void *p, size_t len) {
     if (rdb && rioWrite(rdb,p,len) == 0)
@@ -597,6 +598,243 @@ int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val,
     return 1;
 }
 
+/* ---------------------------- RDB key index ------------------------------
+ * See rdb.h for a description of the on disk format. The index is built in
+ * memory by the saving process while writing the key-value pairs, and is
+ * appended to the file once the whole dataset was written. */
+
+typedef struct rdbIndexEntry {
+    uint64_t keycrc;    /* CRC64 of the key name. */
+    uint64_t offset;    /* Offset of the record in the RDB file. */
+    uint64_t len;       /* Length of the record in bytes. */
+    uint64_t crc;       /* CRC64 of the record bytes. */
+    uint32_t dbid;      /* DB the key belongs to. */
+} rdbIndexEntry;
+
+typedef struct rdbIndex {
+    rdbIndexEntry *entries;
+    size_t count;
+    size_t size;
+} rdbIndex;
+
+/* CRC64 of the record currently being written, see rdbIndexUpdateChecksum. */
+static uint64_t rdbIndexRecordCksum;
+
+/* Checksum function installed in the rio object while saving with the index
+ * enabled: in addition to the global checksum it also computes the checksum
+ * of the record being written. */
+static void rdbIndexUpdateChecksum(rio *r, const void *buf, size_t len) {
+    if (server.rdb_checksum) rioGenericUpdateChecksum(r,buf,len);
+    rdbIndexRecordCksum = crc64(rdbIndexRecordCksum,buf,len);
+}
+
+static void rdbIndexAdd(rdbIndex *idx, int dbid, sds key, off_t offset,
+                        off_t len)
+{
+    rdbIndexEntry *e;
+
+    if (idx->count == idx->size) {
+        idx->size = idx->size ? idx->size*2 : 1024;
+        idx->entries = zrealloc(idx->entries,sizeof(rdbIndexEntry)*idx->size);
+    }
+    e = idx->entries+idx->count++;
+    e->keycrc = crc64(0,(unsigned char*)key,sdslen(key));
+    e->offset = offset;
+    e->len = len;
+    e->crc = rdbIndexRecordCksum;
+    e->dbid = dbid;
+}
+
+static int rdbIndexEntryCompare(const void *a, const void *b) {
+    const rdbIndexEntry *ea = a, *eb = b;
+
+    if (ea->dbid != eb->dbid) return (ea->dbid < eb->dbid) ? -1 : 1;
+    if (ea->keycrc != eb->keycrc) return (ea->keycrc < eb->keycrc) ? -1 : 1;
+    return 0;
+}
+
+/* Sort the index and append it, followed by the footer, to the RDB file.
+ * Returns -1 on write error, 0 on success. */
+static int rdbIndexWrite(rio *rdb, rdbIndex *idx) {
+    unsigned char buf[REDIS_RDB_INDEX_ENTRY_LEN];
+    uint64_t start = rioTell(rdb), crc = 0, u64;
+    uint32_t u32;
+    size_t j;
+
+    qsort(idx->entries,idx->count,sizeof(rdbIndexEntry),rdbIndexEntryCompare);
+    for (j = 0; j < idx->count; j++) {
+        rdbIndexEntry *e = idx->entries+j;
+
+        u64 = e->keycrc; memrev64ifbe(&u64); memcpy(buf,&u64,8);
+        u64 = e->offset; memrev64ifbe(&u64); memcpy(buf+8,&u64,8);
+        u64 = e->len;    memrev64ifbe(&u64); memcpy(buf+16,&u64,8);
+        u64 = e->crc;    memrev64ifbe(&u64); memcpy(buf+24,&u64,8);
+        u32 = e->dbid;   memrev32ifbe(&u32); memcpy(buf+32,&u32,4);
+        memset(buf+36,0,4);
+        crc = crc64(crc,buf,sizeof(buf));
+        if (rdbWriteRaw(rdb,buf,sizeof(buf)) == -1) return -1;
+    }
+
+    /* Footer */
+    u64 = start;      memrev64ifbe(&u64); memcpy(buf,&u64,8);
+    u64 = idx->count; memrev64ifbe(&u64); memcpy(buf+8,&u64,8);
+    u64 = crc;        memrev64ifbe(&u64); memcpy(buf+16,&u64,8);
+    memcpy(buf+24,REDIS_RDB_INDEX_MAGIC,8);
+    if (rdbWriteRaw(rdb,buf,REDIS_RDB_INDEX_FOOTER_LEN) == -1) return -1;
+    return 0;
+}
+
+/* Set in the child process performing a BGSAVE: the rate limit is only
+ * applied in this case, never when the server itself is blocked saving. */
+static int rdbSaveInChild = 0;
+
+/* Setup a file rio object used to write an RDB file according to the
+ * incremental fsync and rate limit configuration. */
+static void rdbInitSaveRio(rio *rdb, FILE *fp) {
+    rioInitWithFile(rdb,fp);
+    if (server.rdb_save_fsync_bytes)
+        rioSetAutoSync(rdb,server.rdb_save_fsync_bytes,
+                       server.rdb_save_drop_cache);
+    if (rdbSaveInChild && server.rdb_save_rate_limit)
+        rioSetRateLimit(rdb,server.rdb_save_rate_limit);
+}
+
+/* Make sure data will not remain on the OS's output buffers, then close
+ * the file. */
+static void rdbSyncAndClose(FILE *fp) {
+    fflush(fp);
+    fsync(fileno(fp));
+#ifdef HAVE_FADVISE
+    if (server.rdb_save_fsync_bytes && server.rdb_save_drop_cache)
+        posix_fadvise(fileno(fp),0,0,POSIX_FADV_DONTNEED);
+#endif
+    fclose(fp);
+}
+
+/* ----------------------------------------------------------------------------
+ * Delta RDB files.
+ *
+ * When rdb-delta-tracking is enabled the names of the keys modified since
+ * the last save are remembered in db->delta_keys, so that BGSAVE DELTA can
+ * write a file containing just those keys. A delta always refers to the
+ * full RDB file saved before it (the base), identified by its checksum, and
+ * to the previous delta by means of a sequence number. A backup can be
+ * rebuilt merging the base and all its deltas with redis-rdb-merge.
+ *
+ * Every event that can't be described as a set of modified keys (FLUSHDB,
+ * FLUSHALL, a new dataset received from the master, ...) just requires the
+ * next save to be a full one.
+ * ------------------------------------------------------------------------- */
+
+/* Remember that 'key' was modified, created or deleted. */
+void rdbDeltaTrackKey(redisDb *db, robj *key) {
+    if (!server.rdb_delta_tracking || server.rdb_delta_need_full) return;
+    if (dictFind(db->delta_keys,key->ptr) == NULL)
+        dictAdd(db->delta_keys,sdsdup(key->ptr),NULL);
+}
+
+/* The next save must be a full one: there is no point in tracking keys
+ * until then. Keys being saved by a delta child are left alone, the
+ * delta is still valid as it only refers to the previous saves. */
+void rdbDeltaNeedFullSave(void) {
+    int j;
+
+    server.rdb_delta_need_full = 1;
+    for (j = 0; j < server.dbnum; j++) {
+        if (dictSize(server.db[j].delta_keys))
+            dictEmpty(server.db[j].delta_keys);
+    }
+}
+
+/* Return the number of keys that the next delta would contain. */
+unsigned long rdbDeltaTrackedKeys(void) {
+    unsigned long count = 0;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        count += dictSize(server.db[j].delta_keys);
+    return count;
+}
+
+/* A full RDB file with the specified checksum was saved, and it contains
+ * all the changes up to now: it is the new base for deltas. */
+static void rdbDeltaFullSaveDone(uint64_t cksum) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dictSize(server.db[j].delta_keys))
+            dictEmpty(server.db[j].delta_keys);
+    }
+    server.rdb_delta_base_cksum = cksum;
+    server.rdb_delta_seq = 0;
+    server.rdb_delta_need_full = 0;
+}
+
+/* Called in the parent just before creating a saving child. The keys
+ * tracked so far are the ones the child is going to save, so we start
+ * tracking again from scratch. */
+static void rdbDeltaSaveStarted(int type) {
+    int j;
+
+    if (type == REDIS_RDB_CHILD_TYPE_FULL) {
+        /* The child saves everything: the keys modified from now on will
+         * be the content of the first delta on top of this file. */
+        for (j = 0; j < server.dbnum; j++) {
+            if (dictSize(server.db[j].delta_keys))
+                dictEmpty(server.db[j].delta_keys);
+        }
+        server.rdb_delta_need_full = 0;
+    } else {
+        for (j = 0; j < server.dbnum; j++) {
+            dict *tmp = server.db[j].delta_saving_keys;
+
+            server.db[j].delta_saving_keys = server.db[j].delta_keys;
+            server.db[j].delta_keys = tmp;
+        }
+    }
+}
+
+/* Called in the parent when the saving child terminated. */
+static void rdbDeltaSaveDone(int type, int ok) {
+    int j;
+
+    if (type == REDIS_RDB_CHILD_TYPE_FULL) {
+        if (ok && server.rdb_child_cksum_received) {
+            server.rdb_delta_base_cksum = server.rdb_child_cksum;
+            server.rdb_delta_seq = 0;
+        } else {
+            /* Keys modified before the fork are lost. */
+            rdbDeltaNeedFullSave();
+        }
+        return;
+    }
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        /* On failure the keys saved by the child need to be part of the
+         * next delta again. */
+        if (!ok && !server.rdb_delta_need_full) {
+            dictIterator *di = dictGetIterator(db->delta_saving_keys);
+            dictEntry *de;
+
+            while((de = dictNext(di)) != NULL) {
+                sds key = dictGetKey(de);
+
+                if (dictFind(db->delta_keys,key) == NULL)
+                    dictAdd(db->delta_keys,sdsdup(key),NULL);
+            }
+            dictReleaseIterator(di);
+        }
+        if (dictSize(db->delta_saving_keys))
+            dictEmpty(db->delta_saving_keys);
+    }
+    /* If a new base was saved in the meantime this delta refers to the
+     * old one, and the sequence restarted already. */
+    if (ok && server.rdb_child_delta_base == server.rdb_delta_base_cksum)
+        server.rdb_delta_seq = server.rdb_child_delta_seq;
+}
+
 /* Save the DB on disk. Return REDIS_ERR on error, REDIS_OK on success */
 int rdbSave(char *filename) {
     dictIterator *di = NULL;
@@ -608,6 +846,7 @@ int rdbSave(char *filename) {
     FILE *fp;
     rio rdb;
     uint64_t cksum;
+    rdbIndex idx = { NULL, 0, 0 };
 
     snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
     fp = fopen(tmpfile,"w");
@@ -617,8 +856,10 @@ int rdbSave(char *filename) {
         return REDIS_ERR;
     }
 
-    rioInitWithFile(&rdb,fp);
-    if (server.rdb_checksum)
+    rdbInitSaveRio(&rdb,fp);
+    if (server.rdb_key_index)
+        rdb.update_cksum = rdbIndexUpdateChecksum;
+    else if (server.rdb_checksum)
         rdb.update_cksum = rioGenericUpdateChecksum;
     snprintf(magic,sizeof(magic),"REDIS%04d",REDIS_RDB_VERSION);
     if (rdbWriteRaw(&rdb,magic,9) == -1) goto werr;
@@ -642,10 +883,19 @@ int rdbSave(char *filename) {
             sds keystr = dictGetKey(de);
             robj key, *o = dictGetVal(de);
             long long expire;
+            off_t offset = 0;
+            int retval;
             
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
-            if (rdbSaveKeyValuePair(&rdb,&key,o,expire,now) == -1) goto werr;
+            if (server.rdb_key_index) {
+                offset = rioTell(&rdb);
+                rdbIndexRecordCksum = 0;
+            }
+            retval = rdbSaveKeyValuePair(&rdb,&key,o,expire,now);
+            if (retval == -1) goto werr;
+            if (server.rdb_key_index && retval == 1)
+                rdbIndexAdd(&idx,j,keystr,offset,rioTell(&rdb)-offset);
         }
         dictReleaseIterator(di);
     }
@@ -657,13 +907,18 @@ int rdbSave(char *filename) {
     /* CRC64 checksum. It will be zero if checksum computation is disabled, the
      * loading code skips the check in this case. */
     cksum = rdb.cksum;
+    server.rdb_save_cksum = cksum;
     memrev64ifbe(&cksum);
     rioWrite(&rdb,&cksum,8);
 
-    /* Make sure data will not remain on the OS's output buffers */
-    fflush(fp);
-    fsync(fileno(fp));
-    fclose(fp);
+    /* Key index, if enabled. */
+    if (server.rdb_key_index) {
+        if (rdbIndexWrite(&rdb,&idx) == -1) goto werr;
+        zfree(idx.entries);
+        idx.entries = NULL;
+    }
+
+    rdbSyncAndClose(fp);
 
     /* Use RENAME to make sure the DB file is changed atomically only
      * if the generate DB file is ok. */
@@ -673,6 +928,9 @@ int rdbSave(char *filename) {
         return REDIS_ERR;
     }
     redisLog(REDIS_NOTICE,"DB saved on disk");
+    /* When saving in the foreground the file is the new base for deltas.
+     * For BGSAVE this is handled by the parent when the child exits. */
+    if (!rdbSaveInChild) rdbDeltaFullSaveDone(server.rdb_save_cksum);
     server.dirty = 0;
     server.lastsave = time(NULL);
     server.lastbgsave_status = REDIS_OK;
@@ -683,35 +941,147 @@ werr:
     unlink(tmpfile);
     redisLog(REDIS_WARNING,"Write error saving DB on disk: %s", strerror(errno));
     if (di) dictReleaseIterator(di);
+    zfree(idx.entries);
     return REDIS_ERR;
 }
 
-int rdbSaveBackground(char *filename) {
+/* Save a delta RDB file containing the keys in db->delta_saving_keys.
+ * This is performed by the child process created by BGSAVE DELTA. */
+int rdbSaveDelta(char *filename) {
+    dictIterator *di = NULL;
+    dictEntry *de;
+    char tmpfile[256];
+    char magic[10];
+    unsigned char hdr[16];
+    uint64_t u64;
+    int j;
+    long long now = mstime();
+    FILE *fp;
+    rio rdb;
+
+    snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        redisLog(REDIS_WARNING, "Failed opening delta .rdb for saving: %s",
+            strerror(errno));
+        return REDIS_ERR;
+    }
+
+    rdbInitSaveRio(&rdb,fp);
+    rdb.update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"%s%04d",REDIS_RDB_DELTA_MAGIC,
+        REDIS_RDB_VERSION);
+    if (rdbWriteRaw(&rdb,magic,9) == -1) goto werr;
+    u64 = server.rdb_child_delta_base; memrev64ifbe(&u64);
+    memcpy(hdr,&u64,8);
+    u64 = server.rdb_child_delta_seq; memrev64ifbe(&u64);
+    memcpy(hdr+8,&u64,8);
+    if (rdbWriteRaw(&rdb,hdr,sizeof(hdr)) == -1) goto werr;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (dictSize(db->delta_saving_keys) == 0) continue;
+        if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_SELECTDB) == -1) goto werr;
+        if (rdbSaveLen(&rdb,j) == -1) goto werr;
+
+        di = dictGetIterator(db->delta_saving_keys);
+        while((de = dictNext(di)) != NULL) {
+            sds keystr = dictGetKey(de);
+            dictEntry *kde = dictFind(db->dict,keystr);
+            robj key;
+            int retval = 0;
+
+            initStaticStringObject(key,keystr);
+            if (kde) {
+                retval = rdbSaveKeyValuePair(&rdb,&key,dictGetVal(kde),
+                    getExpire(db,&key),now);
+                if (retval == -1) goto werr;
+            }
+            /* Deleted or already expired: remove it from the base. */
+            if (retval == 0) {
+                if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_DELKEY) == -1 ||
+                    rdbSaveRawString(&rdb,(unsigned char*)keystr,
+                                     sdslen(keystr)) == -1) goto werr;
+            }
+        }
+        dictReleaseIterator(di);
+        di = NULL;
+    }
+
+    if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_EOF) == -1) goto werr;
+    u64 = rdb.cksum;
+    memrev64ifbe(&u64);
+    if (rioWrite(&rdb,&u64,8) == 0) goto werr;
+    rdbSyncAndClose(fp);
+
+    if (rename(tmpfile,filename) == -1) {
+        redisLog(REDIS_WARNING,"Error moving temp delta file on the final destination: %s", strerror(errno));
+        unlink(tmpfile);
+        return REDIS_ERR;
+    }
+    redisLog(REDIS_NOTICE,"Delta saved on disk");
+    return REDIS_OK;
+
+werr:
+    fclose(fp);
+    unlink(tmpfile);
+    redisLog(REDIS_WARNING,"Write error saving delta on disk: %s", strerror(errno));
+    if (di) dictReleaseIterator(di);
+    return REDIS_ERR;
+}
+
+/* Fork a child saving either a full RDB file or a delta, according to
+ * 'type' (REDIS_RDB_CHILD_TYPE_*). */
+static int rdbSaveBackgroundType(char *filename, int type) {
     pid_t childpid;
     long long start;
 
     if (server.rdb_child_pid != -1) return REDIS_ERR;
 
     server.dirty_before_bgsave = server.dirty;
+    server.rdb_child_type = type;
+    server.rdb_child_cksum_received = 0;
+    /* Done before fork() so that the child sees the keys to save. */
+    rdbDeltaSaveStarted(type);
 
+    openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
         int retval;
 
         /* Child */
-        if (server.ipfd > 0) close(server.ipfd);
-        if (server.sofd > 0) close(server.sofd);
-        retval = rdbSave(filename);
+        closeListeningSockets();
+        rdbSaveInChild = 1;
+        if (type == REDIS_RDB_CHILD_TYPE_DELTA)
+            retval = rdbSaveDelta(filename);
+        else
+            retval = rdbSave(filename);
+        if (retval == REDIS_OK) {
+            size_t private_dirty = zmalloc_get_private_dirty();
+
+            if (private_dirty) {
+                redisLog(REDIS_NOTICE,
+                    "RDB: %zu MB of memory used by copy-on-write",
+                    private_dirty/(1024*1024));
+            }
+            sendChildInfo(REDIS_CHILD_INFO_TYPE_RDB,private_dirty);
+        }
         exitFromChild((retval == REDIS_OK) ? 0 : 1);
     } else {
         /* Parent */
         server.stat_fork_time = ustime()-start;
         if (childpid == -1) {
+            closeChildInfoPipe();
+            rdbDeltaSaveDone(type,0);
             redisLog(REDIS_WARNING,"Can't save in background: fork: %s",
                 strerror(errno));
             return REDIS_ERR;
         }
-        redisLog(REDIS_NOTICE,"Background saving started by pid %d",childpid);
+        redisLog(REDIS_NOTICE,
+            "Background %ssaving started by pid %d (fork took %lld usec)",
+            (type == REDIS_RDB_CHILD_TYPE_DELTA) ? "delta " : "",
+            childpid, server.stat_fork_time);
         server.rdb_save_time_start = time(NULL);
         server.rdb_child_pid = childpid;
         updateDictResizePolicy();
@@ -720,6 +1090,22 @@ int rdbSaveBackground(char *filename) {
     return REDIS_OK; /* unreached */
 }
 
+int rdbSaveBackground(char *filename) {
+    return rdbSaveBackgroundType(filename,REDIS_RDB_CHILD_TYPE_FULL);
+}
+
+/* Save the keys modified since the last save in a delta file named after
+ * the RDB file and the delta sequence number, like dump.rdb.delta-1. */
+int rdbSaveDeltaBackground(void) {
+    char filename[1024];
+
+    server.rdb_child_delta_base = server.rdb_delta_base_cksum;
+    server.rdb_child_delta_seq = server.rdb_delta_seq+1;
+    snprintf(filename,sizeof(filename),"%s.delta-%lld",
+        server.rdb_filename,server.rdb_child_delta_seq);
+    return rdbSaveBackgroundType(filename,REDIS_RDB_CHILD_TYPE_DELTA);
+}
+
 void rdbRemoveTempFile(pid_t childpid) {
     char tmpfile[256];
 
@@ -1059,7 +1445,7 @@ int rdbLoad(char *filename) {
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
             loadingProgress(rioTell(&rdb));
-            aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+            processEventsWhileBlocked();
         }
 
         /* Read type. */
@@ -1141,6 +1527,25 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
 
 /* A background saving child (BGSAVE) terminated its work. Handle this. */
 void backgroundSaveDoneHandler(int exitcode, int bysignal) {
+    if (server.rdb_child_type == REDIS_RDB_CHILD_TYPE_DELTA) {
+        /* A delta file doesn't change the state of dump.rdb, nor the
+         * count of changes since the last save. */
+        if (!bysignal && exitcode == 0) {
+            redisLog(REDIS_NOTICE,
+                "Background delta saving terminated with success");
+        } else {
+            redisLog(REDIS_WARNING, "Background delta saving error");
+            if (bysignal) rdbRemoveTempFile(server.rdb_child_pid);
+        }
+        rdbDeltaSaveDone(REDIS_RDB_CHILD_TYPE_DELTA,
+            !bysignal && exitcode == 0);
+        server.rdb_child_pid = -1;
+        server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+        server.rdb_save_time_start = -1;
+        updateSlavesWaitingBgsave(REDIS_ERR);
+        return;
+    }
+
     if (!bysignal && exitcode == 0) {
         redisLog(REDIS_NOTICE,
             "Background saving terminated with success");
@@ -1156,6 +1561,7 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
         rdbRemoveTempFile(server.rdb_child_pid);
         server.lastbgsave_status = REDIS_ERR;
     }
+    rdbDeltaSaveDone(REDIS_RDB_CHILD_TYPE_FULL,!bysignal && exitcode == 0);
     server.rdb_child_pid = -1;
     server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
     server.rdb_save_time_start = -1;
@@ -1176,11 +1582,32 @@ void saveCommand(redisClient *c) {
     }
 }
 
+/* BGSAVE [DELTA] */
 void bgsaveCommand(redisClient *c) {
+    int delta = 0;
+
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"delta")) {
+        delta = 1;
+    } else if (c->argc != 1) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
     if (server.rdb_child_pid != -1) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         addReplyError(c,"Can't BGSAVE while AOF log rewriting is in progress");
+    } else if (delta && !server.rdb_delta_tracking) {
+        addReplyError(c,"Delta saving requires rdb-delta-tracking to be enabled");
+    } else if (delta && !server.rdb_checksum) {
+        addReplyError(c,"Delta saving requires rdbchecksum to be enabled");
+    } else if (delta && server.rdb_delta_need_full) {
+        addReplyError(c,"A full BGSAVE is needed before saving a delta");
+    } else if (delta) {
+        if (rdbSaveDeltaBackground() == REDIS_OK)
+            addReplyStatus(c,"Background delta saving started");
+        else
+            addReply(c,shared.err);
     } else if (rdbSaveBackground(server.rdb_filename) == REDIS_OK) {
         addReplyStatus(c,"Background saving started");
     } else {
@@ -57,6 +57,7 @@
 #define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+#define REDIS_RDB_OPCODE_DELKEY     251
 #define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
 #define REDIS_RDB_OPCODE_EXPIRETIME 253
 #define REDIS_RDB_OPCODE_SELECTDB   254
@@ -65,6 +66,44 @@
 /* Test if a type is an opcode. */
 #define rdbIsOpcode(t) (t >= 253 && t <= 255)
 
+/* Optional key index, appended after the final CRC64 checksum when the
+ * rdb-key-index option is enabled. Loaders stop reading after the checksum
+ * so the index is invisible to them, while tools can mmap() the file, read
+ * the footer and seek directly to single keys without decoding the rest of
+ * the file:
+ *
+ * ...RDB | CRC64 | entry 0 | entry 1 | ... | entry N-1 | footer
+ *
+ * Every entry is 40 bytes long, all the fields are in little endian:
+ *
+ * key CRC64 (8) | record offset (8) | record length (8) | record CRC64 (8) |
+ * db number (4) | reserved (4)
+ *
+ * A record starts at the optional EXPIRETIME_MS opcode and includes the type,
+ * key and value. Entries are sorted by db number, then by key CRC64, so a
+ * given key can be located with a binary search.
+ *
+ * The footer is 32 bytes long:
+ *
+ * index offset (8) | number of entries (8) | CRC64 of entries (8) | magic (8)
+ */
+#define REDIS_RDB_INDEX_MAGIC "REDISIDX"
+#define REDIS_RDB_INDEX_ENTRY_LEN 40
+#define REDIS_RDB_INDEX_FOOTER_LEN 32
+
+/* Delta RDB files (BGSAVE DELTA) only contain the keys modified since the
+ * previous save, full or delta. The format is the same as a normal RDB file
+ * with a different header:
+ *
+ * "DELTA" | RDB version (4 digits) | base CRC64 (8) | sequence number (8)
+ *
+ * The base CRC64 is the checksum of the full RDB file the delta applies to,
+ * and the sequence number (little endian) starts from 1 after every full
+ * save. Keys that no longer exist are stored as a DELKEY opcode followed by
+ * the key name. The file is terminated by the EOF opcode and the CRC64 of
+ * the whole file, as usually. */
+#define REDIS_RDB_DELTA_MAGIC "DELTA"
+
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
@@ -75,6 +114,10 @@ int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
 int rdbLoad(char *filename);
 int rdbSaveBackground(char *filename);
+int rdbSaveDeltaBackground(void);
+void rdbDeltaTrackKey(redisDb *db, robj *key);
+void rdbDeltaNeedFullSave(void);
+unsigned long rdbDeltaTrackedKeys(void);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename);
 int rdbSaveObject(rio *rdb, robj *o);
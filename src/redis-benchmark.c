@@ -44,9 +44,18 @@
 #include "sds.h"
 #include "adlist.h"
 #include "zmalloc.h"
+#include "crc16.h"
 
 #define REDIS_NOTUSED(V) ((void) V)
 
+/* A node of the cluster serving hash slots, with the number of requests it
+ * served during the current test. */
+typedef struct clusterNode {
+    sds ip;
+    int port;
+    int requests_finished;
+} clusterNode;
+
 static struct config {
     aeEventLoop *el;
     const char *hostip;
@@ -73,6 +82,12 @@ static struct config {
     int loop;
     int idlemode;
     char *tests;
+    int cluster_mode;
+    clusterNode *cluster_nodes;
+    int cluster_numnodes;
+    int cluster_slots[REDIS_CLUSTER_SLOTS]; /* Index in cluster_nodes or -1 */
+    int cluster_next;       /* Next node for clients without a constant key. */
+    int cluster_redirects;  /* -MOVED / -ASK replies in the current test. */
 } config;
 
 typedef struct _client {
@@ -84,6 +99,10 @@ typedef struct _client {
     long long start; /* start time of a request */
     long long latency; /* request latency */
     int pending;    /* Number of pending requests (sent but no reply received) */
+    int node;       /* Cluster node the client is connected to. */
+    size_t cmdlen;  /* Length of a single command in 'obuf'. */
+    long keyoff;    /* Offset of the key in the command, or -1. */
+    size_t keylen;  /* Length of the key. */
 } *client;
 
 /* Prototypes */
@@ -153,6 +172,57 @@ static void randomizeClientKey(client c) {
     }
 }
 
+/* Set every ":rand:" of the command 'cmd' in the client buffer, that are
+ * the placeholders from i to j-1, to the value 'r'. Returns non zero if the
+ * key of the command then hashes to a slot served by the node of the
+ * client. */
+static int setClusterClientKey(client c, char *cmd, size_t i, size_t j,
+                               size_t r)
+{
+    char buf[32];
+    size_t k;
+
+    snprintf(buf,sizeof(buf),"%012zu",r);
+    for (k = i; k < j; k++) memcpy(c->randptr[k],buf,12);
+    return c->keyoff == -1 ||
+           config.cluster_slots[keyHashSlot(cmd+c->keyoff,c->keylen)] ==
+                c->node;
+}
+
+/* In cluster mode the same random value is used for every ":rand:" of a
+ * command, so that multi keys commands like MSET use a single key, and it
+ * is generated again until the key hashes to a slot served by the node of
+ * the client. When random values keep failing, for instance because the
+ * node serves just a few slots, the whole keyspace is scanned, and if no
+ * key at all belongs to the node we exit, since sending the command to the
+ * wrong node would only benchmark the -MOVED error. */
+static void randomizeClusterClientKey(client c) {
+    size_t i = 0, j, n, r = 0;
+
+    while (i < c->randlen) {
+        char *cmd = c->obuf+((c->randptr[i]-c->obuf)/c->cmdlen)*c->cmdlen;
+        size_t len = config.randomkeys_keyspacelen;
+        int tries = 0, found = 0;
+
+        for (j = i; j < c->randlen && c->randptr[j] < cmd+c->cmdlen; j++);
+        while (!found && tries++ < 1000) {
+            r = random() % len;
+            found = setClusterClientKey(c,cmd,i,j,r);
+        }
+        for (n = 1; !found && n < len; n++)
+            found = setClusterClientKey(c,cmd,i,j,(r+n) % len);
+        if (!found) {
+            fprintf(stderr,
+                "No key of the keyspace hashes to a slot served by %s:%d, "
+                "try a bigger keyspace with -r\n",
+                config.cluster_nodes[c->node].ip,
+                config.cluster_nodes[c->node].port);
+            exit(1);
+        }
+        i = j;
+    }
+}
+
 static void clientDone(client c) {
     if (config.requests_finished == config.requests) {
         freeClient(c);
@@ -191,15 +261,40 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                 exit(1);
             }
             if (reply != NULL) {
+                int redirected = 0;
+
                 if (reply == (void*)REDIS_REPLY_ERROR) {
                     fprintf(stderr,"Unexpected error reply, exiting...\n");
                     exit(1);
                 }
+                /* A redirected request was not served by the node of the
+                 * client: it is not accounted, and another request is
+                 * issued in its place. */
+                if (config.cluster_mode &&
+                    ((redisReply*)reply)->type == REDIS_REPLY_ERROR)
+                {
+                    char *err = ((redisReply*)reply)->str;
+
+                    if (!strncmp(err,"MOVED",5) || !strncmp(err,"ASK",3)) {
+                        redirected = 1;
+                        config.requests_issued--;
+                        if (++config.cluster_redirects > config.requests) {
+                            fprintf(stderr,"Too many -MOVED / -ASK "
+                                "redirections, the slots map is stale\n");
+                            exit(1);
+                        }
+                    }
+                }
 
                 freeReplyObject(reply);
 
-                if (config.requests_finished < config.requests)
+                if (!redirected &&
+                    config.requests_finished < config.requests)
+                {
                     config.latency[config.requests_finished++] = c->latency;
+                    if (config.cluster_mode)
+                        config.cluster_nodes[c->node].requests_finished++;
+                }
                 c->pending--;
                 if (c->pending == 0) clientDone(c);
             } else {
@@ -217,14 +312,22 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     /* Initialize request when nothing was written. */
     if (c->written == 0) {
-        /* Enforce upper bound to number of requests. */
-        if (config.requests_issued++ >= config.requests) {
+        /* Enforce upper bound to number of requests. Clients that are
+         * freed don't count as issued, since redirected requests in cluster
+         * mode are issued again. */
+        if (config.requests_issued >= config.requests) {
             freeClient(c);
             return;
         }
+        config.requests_issued++;
 
         /* Really initialize: randomize keys and set start time. */
-        if (config.randomkeys) randomizeClientKey(c);
+        if (config.randomkeys) {
+            if (config.cluster_mode)
+                randomizeClusterClientKey(c);
+            else
+                randomizeClientKey(c);
+        }
         c->start = ustime();
         c->latency = -1;
     }
@@ -246,19 +349,76 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Return the offset of the first argument of the command 'cmd', in the
+ * protocol format, that is assumed to be the key of the command. Its length
+ * is stored in *keylen. If the command has no arguments -1 is returned. */
+static long getCommandKeyOffset(char *cmd, size_t len, size_t *keylen) {
+    char *p, *end = cmd+len;
+    int j;
+
+    if (len == 0 || cmd[0] != '*' || strtol(cmd+1,NULL,10) < 2) return -1;
+    if ((p = strstr(cmd,"\r\n")) == NULL) return -1;
+    p += 2;
+    for (j = 0; j < 2; j++) {
+        long arglen;
+
+        if (p >= end || *p != '$') return -1;
+        arglen = strtol(p+1,&p,10);
+        p += 2;
+        if (arglen < 0 || p+arglen > end) return -1;
+        if (j == 1) {
+            *keylen = arglen;
+            return p-cmd;
+        }
+        p += arglen+2;
+    }
+    return -1;
+}
+
+/* Select the cluster node of a new client. Clients sending a constant key
+ * connect to the node serving it, while the clients of commands with a
+ * random key, or without a key at all, are spread across the nodes. */
+static int clusterSelectNode(char *cmd, long keyoff, size_t keylen) {
+    char *r = keyoff != -1 ? strstr(cmd+keyoff,":rand:") : NULL;
+    int randkey = config.randomkeys && r && r < cmd+keyoff+keylen;
+
+    if (keyoff != -1 && !randkey) {
+        int node = config.cluster_slots[keyHashSlot(cmd+keyoff,keylen)];
+
+        if (node == -1) {
+            fprintf(stderr,"No node is serving the hash slot of key '%.*s'\n",
+                (int)keylen, cmd+keyoff);
+            exit(1);
+        }
+        return node;
+    }
+    return config.cluster_next++ % config.cluster_numnodes;
+}
+
 static client createClient(char *cmd, size_t len) {
     int j;
     client c = zmalloc(sizeof(struct _client));
+    const char *ip = config.hostip;
+    int port = config.hostport;
+
+    c->cmdlen = len;
+    c->keyoff = getCommandKeyOffset(cmd,len,&c->keylen);
+    c->node = 0;
+    if (config.cluster_mode) {
+        c->node = clusterSelectNode(cmd,c->keyoff,c->keylen);
+        ip = config.cluster_nodes[c->node].ip;
+        port = config.cluster_nodes[c->node].port;
+    }
 
     if (config.hostsocket == NULL) {
-        c->context = redisConnectNonBlock(config.hostip,config.hostport);
+        c->context = redisConnectNonBlock(ip,port);
     } else {
         c->context = redisConnectUnixNonBlock(config.hostsocket);
     }
     if (c->context->err) {
         fprintf(stderr,"Could not connect to Redis at ");
         if (config.hostsocket == NULL)
-            fprintf(stderr,"%s:%d: %s\n",config.hostip,config.hostport,c->context->errstr);
+            fprintf(stderr,"%s:%d: %s\n",ip,port,c->context->errstr);
         else
             fprintf(stderr,"%s: %s\n",config.hostsocket,c->context->errstr);
         exit(1);
@@ -331,6 +491,22 @@ static void showLatencyReport(void) {
             }
         }
         printf("%.2f requests per second\n\n", reqpersec);
+
+        if (config.cluster_mode) {
+            for (i = 0; i < config.cluster_numnodes; i++) {
+                clusterNode *node = config.cluster_nodes+i;
+
+                printf("  %s:%d: %d requests, %.2f requests per second\n",
+                    node->ip, node->port, node->requests_finished,
+                    (float)node->requests_finished/
+                        ((float)config.totlatency/1000));
+            }
+            if (config.cluster_redirects)
+                printf("  %d requests redirected and not accounted: "
+                       "the slots map is stale\n",
+                    config.cluster_redirects);
+            printf("\n");
+        }
     } else if (config.csv) {
         printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
     } else {
@@ -340,10 +516,14 @@ static void showLatencyReport(void) {
 
 static void benchmark(char *title, char *cmd, int len) {
     client c;
+    int i;
 
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
+    config.cluster_redirects = 0;
+    for (i = 0; i < config.cluster_numnodes; i++)
+        config.cluster_nodes[i].requests_finished = 0;
 
     c = createClient(cmd,len);
     createMissingClients(c);
@@ -356,6 +536,90 @@ static void benchmark(char *title, char *cmd, int len) {
     freeAllClients();
 }
 
+/* Load the map of the hash slots using CLUSTER NODES, where every line
+ * is in the form:
+ *
+ * <name> <ip:port> <flags> <master> <ping> <pong> <link> <slot> <slot> ...
+ *
+ * Slots are single numbers or start-end ranges. Only the nodes serving at
+ * least a slot are used. The node we query may not know its own address,
+ * reported as ":0", in that case the address we connected to is used. */
+static void clusterLoadSlots(void) {
+    redisContext *ctx;
+    redisReply *reply;
+    sds *lines;
+    int j, numlines;
+
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) config.cluster_slots[j] = -1;
+    ctx = redisConnect(config.hostip,config.hostport);
+    if (ctx->err) {
+        fprintf(stderr,"Could not connect to Redis at %s:%d: %s\n",
+            config.hostip,config.hostport,ctx->errstr);
+        exit(1);
+    }
+    reply = redisCommand(ctx,"CLUSTER NODES");
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) {
+        fprintf(stderr,"Can't load the cluster configuration: %s\n",
+            reply ? reply->str : ctx->errstr);
+        exit(1);
+    }
+
+    lines = sdssplitlen(reply->str,reply->len,"\n",1,&numlines);
+    for (j = 0; j < numlines; j++) {
+        sds *fields;
+        char *p;
+        int i, numfields, node = -1;
+
+        fields = sdssplitlen(lines[j],sdslen(lines[j])," ",1,&numfields);
+        if (numfields < 8 || (p = strrchr(fields[1],':')) == NULL) {
+            sdsfreesplitres(fields,numfields);
+            continue;
+        }
+        *p = '\0';
+        for (i = 7; i < numfields; i++) {
+            int start, end, slot;
+            char *range;
+
+            if (fields[i][0] == '[') continue; /* Migrating / importing. */
+            if (node == -1) {
+                clusterNode *n;
+
+                config.cluster_nodes = zrealloc(config.cluster_nodes,
+                    sizeof(clusterNode)*(config.cluster_numnodes+1));
+                n = config.cluster_nodes+config.cluster_numnodes;
+                if (fields[1][0] == '\0') {
+                    n->ip = sdsnew(config.hostip);
+                    n->port = config.hostport;
+                } else {
+                    n->ip = sdsnew(fields[1]);
+                    n->port = atoi(p+1);
+                }
+                n->requests_finished = 0;
+                node = config.cluster_numnodes++;
+            }
+            if ((range = strchr(fields[i],'-')) != NULL) {
+                start = atoi(fields[i]);
+                end = atoi(range+1);
+            } else {
+                start = end = atoi(fields[i]);
+            }
+            if (start < 0) start = 0;
+            if (end >= REDIS_CLUSTER_SLOTS) end = REDIS_CLUSTER_SLOTS-1;
+            for (slot = start; slot <= end; slot++)
+                config.cluster_slots[slot] = node;
+        }
+        sdsfreesplitres(fields,numfields);
+    }
+    sdsfreesplitres(lines,numlines);
+    freeReplyObject(reply);
+    redisFree(ctx);
+
+    if (config.cluster_numnodes == 0) {
+        fprintf(stderr,"No hash slot is assigned in the cluster\n");
+        exit(1);
+    }
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -406,6 +670,8 @@ int parseOptions(int argc, const char **argv) {
             config.loop = 1;
         } else if (!strcmp(argv[i],"-I")) {
             config.idlemode = 1;
+        } else if (!strcmp(argv[i],"--cluster")) {
+            config.cluster_mode = 1;
         } else if (!strcmp(argv[i],"-t")) {
             if (lastarg) goto invalid;
             /* We get the list of tests to run as a string in the form
@@ -457,7 +723,11 @@ usage:
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --cluster          Cluster mode. Send every request to the node serving\n"
+"                    its key, and report the requests per second of every\n"
+"                    node. The first argument of the command is assumed\n"
+"                    to be the key.\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -530,11 +800,24 @@ int main(int argc, const char **argv) {
     config.hostport = 6379;
     config.hostsocket = NULL;
     config.tests = NULL;
+    config.cluster_mode = 0;
+    config.cluster_nodes = NULL;
+    config.cluster_numnodes = 0;
+    config.cluster_next = 0;
+    config.cluster_redirects = 0;
 
     i = parseOptions(argc,argv);
     argc -= i;
     argv += i;
 
+    if (config.cluster_mode) {
+        if (config.hostsocket != NULL) {
+            fprintf(stderr,"Cluster mode can't be used with a UNIX socket\n");
+            exit(1);
+        }
+        clusterLoadSlots();
+    }
+
     config.latency = zmalloc(sizeof(long long)*config.requests);
 
     if (config.keepalive == 0) {
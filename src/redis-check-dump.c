@@ -562,6 +562,24 @@ void process() {
     entry entry;
     int dump_version = processHeader();
 
+    /* If the file ends with a key index (rdb-key-index option) exclude it
+     * from the data to check, the RDB payload ends where the index starts. */
+    if (positions[0].size >= 9+32 &&
+        memcmp((char*)positions[0].data+positions[0].size-8,"REDISIDX",8) == 0)
+    {
+        unsigned char *p = (unsigned char*)positions[0].data+
+                           positions[0].size-32;
+        uint64_t idxoff = 0;
+        int j;
+
+        for (j = 7; j >= 0; j--) idxoff = (idxoff << 8) | p[j];
+        if (idxoff <= positions[0].size) {
+            printf("Key index found, %llu bytes\n",
+                (unsigned long long) (positions[0].size-idxoff));
+            positions[0].size = idxoff;
+        }
+    }
+
     /* Exclude the final checksum for RDB >= 5. Will be checked at the end. */
     if (dump_version >= 5) {
         if (positions[0].size < 8) {
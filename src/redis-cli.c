@@ -49,6 +49,7 @@
 #include "help.h"
 #include "anet.h"
 #include "ae.h"
+#include "crc16.h"
 
 #define REDIS_NOTUSED(V) ((void) V)
 
@@ -56,6 +57,8 @@
 #define OUTPUT_RAW 1
 #define OUTPUT_CSV 2
 
+#define CLUSTER_MAX_REDIRECTS 16 /* Max times a command is reissued. */
+
 static redisContext *context;
 static struct config {
     char *hostip;
@@ -71,6 +74,7 @@ static struct config {
     int latency_mode;
     int cluster_mode;
     int cluster_reissue_command;
+    int cluster_send_asking; /* Reissuing the command after -ASK. */
     int slave_mode;
     int pipe_mode;
     int bigkeys;
@@ -82,6 +86,19 @@ static struct config {
     char *eval;
 } config;
 
+/* In cluster mode the hash slots are mapped to the nodes serving them, so
+ * that commands can be sent directly to the right node instead of following
+ * a -MOVED redirection every time. */
+static struct {
+    int loaded;                 /* Did we try to load the map already? */
+    int slots[REDIS_CLUSTER_SLOTS]; /* Index in 'nodes' or -1 if unknown. */
+    struct {
+        sds ip;
+        int port;
+    } *nodes;
+    int numnodes;
+} cluster;
+
 static void usage();
 char *redisGitSHA1(void);
 char *redisGitDirty(void);
@@ -343,6 +360,131 @@ static void cliPrintContextError() {
     fprintf(stderr,"Error: %s\n",context->errstr);
 }
 
+/*------------------------------------------------------------------------------
+ * Cluster slots map
+ *--------------------------------------------------------------------------- */
+
+/* Return the index of the node ip:port in the cluster map, adding it if
+ * it is not already known. */
+static int cliClusterGetNode(char *ip, int port) {
+    int j;
+
+    for (j = 0; j < cluster.numnodes; j++) {
+        if (cluster.nodes[j].port == port && !strcmp(cluster.nodes[j].ip,ip))
+            return j;
+    }
+    cluster.nodes = zrealloc(cluster.nodes,
+                             sizeof(*cluster.nodes)*(cluster.numnodes+1));
+    cluster.nodes[j].ip = sdsnew(ip);
+    cluster.nodes[j].port = port;
+    return cluster.numnodes++;
+}
+
+/* Populate the slots map using the output of CLUSTER NODES, where every
+ * line is in the form:
+ *
+ * <name> <ip:port> <flags> <master> <ping> <pong> <link> <slot> <slot> ...
+ *
+ * Slots are single numbers or start-end ranges. The node we are talking
+ * with may not know its own address, reported as ":0": in that case we use
+ * the address we are connected to. If the node is not in cluster mode the
+ * map remains empty, and we'll just follow the redirections. */
+static void cliClusterLoadSlots(void) {
+    redisReply *reply;
+    sds *lines;
+    int j, numlines;
+
+    for (j = 0; j < REDIS_CLUSTER_SLOTS; j++) cluster.slots[j] = -1;
+    cluster.loaded = 1;
+    if (context == NULL) return;
+    reply = redisCommand(context,"CLUSTER NODES");
+    if (reply == NULL) return;
+    if (reply->type != REDIS_REPLY_STRING) {
+        freeReplyObject(reply);
+        return;
+    }
+
+    lines = sdssplitlen(reply->str,reply->len,"\n",1,&numlines);
+    for (j = 0; j < numlines; j++) {
+        sds *fields;
+        char *p;
+        int i, numfields, node;
+
+        fields = sdssplitlen(lines[j],sdslen(lines[j])," ",1,&numfields);
+        if (numfields < 8 || (p = strrchr(fields[1],':')) == NULL) {
+            sdsfreesplitres(fields,numfields);
+            continue;
+        }
+        *p = '\0';
+        if (fields[1][0] == '\0')
+            node = cliClusterGetNode(config.hostip,config.hostport);
+        else
+            node = cliClusterGetNode(fields[1],atoi(p+1));
+        for (i = 7; i < numfields; i++) {
+            int start, end, slot;
+
+            if (fields[i][0] == '[') continue; /* Migrating / importing. */
+            if ((p = strchr(fields[i],'-')) != NULL) {
+                start = atoi(fields[i]);
+                end = atoi(p+1);
+            } else {
+                start = end = atoi(fields[i]);
+            }
+            if (start < 0) start = 0;
+            if (end >= REDIS_CLUSTER_SLOTS) end = REDIS_CLUSTER_SLOTS-1;
+            for (slot = start; slot <= end; slot++)
+                cluster.slots[slot] = node;
+        }
+        sdsfreesplitres(fields,numfields);
+    }
+    sdsfreesplitres(lines,numlines);
+    freeReplyObject(reply);
+}
+
+/* Return true if the first argument of the command is a key, according
+ * to the parameters documented in the help. Commands having keys in other
+ * positions are just sent to the current node, following redirections. */
+static int cliCommandFirstArgIsKey(char *name) {
+    int j;
+
+    for (j = 0; j < helpEntriesLen; j++) {
+        struct commandHelp *help = helpEntries[j].org;
+
+        if (helpEntries[j].type != CLI_HELP_COMMAND) continue;
+        if (strcasecmp(name,help->name)) continue;
+        return !strncmp(help->params,"key",3) &&
+               (help->params[3] == ' ' || help->params[3] == '\0');
+    }
+    return 0;
+}
+
+/* Connect to the node serving the key of the command, if we know it and
+ * it is not the one we are connected to. */
+static void cliClusterRouteCommand(int argc, char **argv) {
+    int slot, node;
+
+    if (!config.cluster_mode || config.hostsocket != NULL) return;
+    /* After -ASK the command must be sent to the node we were redirected
+     * to, even if the map says the slot is still served by another one. */
+    if (config.cluster_send_asking) {
+        config.cluster_send_asking = 0;
+        return;
+    }
+    if (argc < 2 || !cliCommandFirstArgIsKey(argv[0])) return;
+    if (!cluster.loaded) cliClusterLoadSlots();
+
+    slot = keyHashSlot(argv[1],sdslen(argv[1]));
+    if ((node = cluster.slots[slot]) == -1) return;
+    if (cluster.nodes[node].port == config.hostport &&
+        !strcmp(cluster.nodes[node].ip,config.hostip)) return;
+
+    sdsfree(config.hostip);
+    config.hostip = sdsdup(cluster.nodes[node].ip);
+    config.hostport = cluster.nodes[node].port;
+    cliConnect(1);
+    cliRefreshPrompt();
+}
+
 static sds cliFormatReplyTTY(redisReply *r, char *prefix) {
     sds out = sdsempty();
     switch (r->type) {
@@ -506,10 +648,10 @@ static int cliReadReply(int output_raw_strings) {
     /* Check if we need to connect to a different node and reissue the
      * request. */
     if (config.cluster_mode && reply->type == REDIS_REPLY_ERROR &&
-        (!strncmp(reply->str,"MOVED",5) || !strcmp(reply->str,"ASK")))
+        (!strncmp(reply->str,"MOVED",5) || !strncmp(reply->str,"ASK",3)))
     {
         char *p = reply->str, *s;
-        int slot;
+        int slot, moved = reply->str[0] == 'M';
 
         output = 0;
         /* Comments show the position of the pointer as:
@@ -526,6 +668,13 @@ static int cliReadReply(int output_raw_strings) {
         sdsfree(config.hostip);
         config.hostip = sdsnew(p+1);
         config.hostport = atoi(s+1);
+        /* -ASK only redirects this request, while -MOVED means the slot is
+         * now served by the other node. */
+        if (moved && cluster.loaded &&
+            slot >= 0 && slot < REDIS_CLUSTER_SLOTS)
+            cluster.slots[slot] = cliClusterGetNode(config.hostip,
+                                                    config.hostport);
+        config.cluster_send_asking = !moved;
         if (config.interactive)
             printf("-> Redirected to slot [%d] located at %s:%d\n",
                 slot, config.hostip, config.hostport);
@@ -563,6 +712,7 @@ static int cliSendCommand(int argc, char **argv, int repeat) {
         return REDIS_OK;
     }
 
+    cliClusterRouteCommand(argc,argv);
     if (context == NULL) return REDIS_ERR;
 
     output_raw = 0;
@@ -620,6 +770,32 @@ static int cliSendCommand(int argc, char **argv, int repeat) {
     return REDIS_OK;
 }
 
+/* Connect to the node the last command was redirected to, so that it can
+ * be issued again, sending ASKING first after a -ASK redirection. Returns
+ * REDIS_ERR if the command should not be reissued: nodes disagreeing about
+ * a slot while it is migrating could otherwise redirect us forever. */
+static int cliClusterFollowRedirection(int redirects) {
+    if (redirects > CLUSTER_MAX_REDIRECTS) {
+        fprintf(stderr,"Error: Too many cluster redirections\n");
+        config.cluster_send_asking = 0;
+        return REDIS_ERR;
+    }
+    if (cliConnect(1) != REDIS_OK) {
+        config.cluster_send_asking = 0;
+        return REDIS_ERR;
+    }
+    if (config.cluster_send_asking) {
+        redisReply *reply = redisCommand(context,"ASKING");
+
+        if (reply == NULL) {
+            config.cluster_send_asking = 0;
+            return REDIS_ERR;
+        }
+        freeReplyObject(reply);
+    }
+    return REDIS_OK;
+}
+
 /*------------------------------------------------------------------------------
  * User interface
  *--------------------------------------------------------------------------- */
@@ -716,7 +892,8 @@ static void usage() {
 "  -n <db>          Database number\n"
 "  -x               Read last argument from STDIN\n"
 "  -d <delimiter>   Multi-bulk delimiter in for raw formatting (default: \\n)\n"
-"  -c               Enable cluster mode (follow -ASK and -MOVED redirections)\n"
+"  -c               Enable cluster mode (follow -ASK and -MOVED redirections,\n"
+"                   sending commands directly to the node serving the key)\n"
 "  --raw            Use raw formatting for replies (default when STDOUT is not a tty)\n"
 "  --latency        Enter a special mode continuously sampling latency\n"
 "  --slave          Simulate a slave showing commands received from the master\n"
@@ -799,7 +976,7 @@ static void repl() {
                     linenoiseClearScreen();
                 } else {
                     long long start_time = mstime(), elapsed;
-                    int repeat, skipargs = 0;
+                    int repeat, skipargs = 0, redirects = 0;
 
                     repeat = atoi(argv[0]);
                     if (argc > 1 && repeat) {
@@ -823,7 +1000,8 @@ static void repl() {
                         }
                         /* Issue the command again if we got redirected in cluster mode */
                         if (config.cluster_mode && config.cluster_reissue_command) {
-                            cliConnect(1);
+                            if (cliClusterFollowRedirection(++redirects)
+                                != REDIS_OK) break;
                         } else {
                             break;
                         }
@@ -845,14 +1023,25 @@ static void repl() {
 }
 
 static int noninteractive(int argc, char **argv) {
-    int retval = 0;
+    int retval = 0, redirects = 0;
     if (config.stdinarg) {
         argv = zrealloc(argv, (argc+1)*sizeof(char*));
         argv[argc] = readArgFromStdin();
-        retval = cliSendCommand(argc+1, argv, config.repeat);
-    } else {
-        /* stdin is probably a tty, can be tested with S_ISCHR(s.st_mode) */
+        argc++;
+    }
+    /* stdin is probably a tty, can be tested with S_ISCHR(s.st_mode) */
+    while(1) {
+        config.cluster_reissue_command = 0;
         retval = cliSendCommand(argc, argv, config.repeat);
+        /* Issue the command again if we got redirected in cluster mode */
+        if (config.cluster_mode && config.cluster_reissue_command) {
+            if (cliClusterFollowRedirection(++redirects) != REDIS_OK) {
+                retval = REDIS_ERR;
+                break;
+            }
+        } else {
+            break;
+        }
     }
     return retval;
 }
@@ -1202,6 +1391,8 @@ int main(int argc, char **argv) {
     config.pubsub_mode = 0;
     config.latency_mode = 0;
     config.cluster_mode = 0;
+    config.cluster_reissue_command = 0;
+    config.cluster_send_asking = 0;
     config.slave_mode = 0;
     config.pipe_mode = 0;
     config.bigkeys = 0;
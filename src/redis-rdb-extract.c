@@ -0,0 +1,515 @@
+/* Redis RDB selective extraction tool.
+ *
+ * Extract a subset of the keys stored in an RDB file produced with the
+ * rdb-key-index option enabled. The key index appended to the file (see
+ * rdb.h for a description of the format) is used in order to seek directly
+ * to the interesting records, so only the key names are decoded, and only
+ * for the records that are candidates for extraction.
+ *
+ * The output is a stream of Redis protocol commands (SELECT and RESTORE)
+ * written on standard output, that can be sent to a Redis instance using
+ * redis-cli --pipe. Every record is verified against its CRC64 checksum
+ * before being emitted: corrupted records are reported and skipped.
+ *
+ * Copyright (c) 2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <limits.h>
+#include "lzf.h"
+
+/* Constants from rdb.h, duplicated here as this tool is not linked with
+ * the Redis server code. */
+#define REDIS_RDB_6BITLEN 0
+#define REDIS_RDB_14BITLEN 1
+#define REDIS_RDB_32BITLEN 2
+#define REDIS_RDB_ENCVAL 3
+
+#define REDIS_RDB_ENC_INT8 0
+#define REDIS_RDB_ENC_INT16 1
+#define REDIS_RDB_ENC_INT32 2
+#define REDIS_RDB_ENC_LZF 3
+
+#define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
+
+#define REDIS_RDB_INDEX_MAGIC "REDISIDX"
+#define REDIS_RDB_INDEX_ENTRY_LEN 40
+#define REDIS_RDB_INDEX_FOOTER_LEN 32
+
+#define ERROR(...) { \
+    fprintf(stderr, __VA_ARGS__); \
+    exit(1); \
+}
+
+/* In memory representation of an index entry. */
+typedef struct {
+    uint64_t keycrc;
+    uint64_t offset;
+    uint64_t len;
+    uint64_t crc;
+    uint32_t dbid;
+} indexEntry;
+
+static struct config {
+    unsigned char *data;    /* The mmap()ed RDB file. */
+    size_t size;            /* Size of the file. */
+    int rdbver;             /* RDB version of the file. */
+    unsigned char *index;   /* First index entry. */
+    uint64_t numentries;    /* Number of index entries. */
+    int dbnum;              /* Only extract keys from this DB, or -1. */
+    char **keys;            /* Exact key names to extract. */
+    int numkeys;
+    char *prefix;           /* Extract keys with this prefix, or NULL. */
+    int check;              /* Only verify the records, don't output them. */
+    int lastdb;             /* Last DB selected in the output stream. */
+    long long now;          /* Unix time in milliseconds. */
+    long long extracted, expired, corrupted;
+} config;
+
+/* Prototypes */
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+
+static uint64_t load64(unsigned char *p) {
+    return ((uint64_t)p[0] << 0) |
+           ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) |
+           ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) |
+           ((uint64_t)p[7] << 56);
+}
+
+static void store64(unsigned char *p, uint64_t v) {
+    int j;
+
+    for (j = 0; j < 8; j++) p[j] = (v >> (j*8)) & 0xff;
+}
+
+static long long mstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000+tv.tv_usec/1000;
+}
+
+static void getEntry(uint64_t j, indexEntry *e) {
+    unsigned char *p = config.index+j*REDIS_RDB_INDEX_ENTRY_LEN;
+
+    e->keycrc = load64(p);
+    e->offset = load64(p+8);
+    e->len = load64(p+16);
+    e->crc = load64(p+24);
+    e->dbid = p[32]|(p[33]<<8)|(p[34]<<16)|((uint32_t)p[35]<<24);
+}
+
+/* Decode an RDB length at 'p', not reading past 'end'. The number of bytes
+ * used by the length is stored in *used. Returns -1 on error. */
+static long long loadLength(unsigned char *p, unsigned char *end, int *isencoded,
+                            int *used)
+{
+    int type;
+
+    *isencoded = 0;
+    if (p >= end) return -1;
+    type = (p[0] & 0xC0) >> 6;
+    if (type == REDIS_RDB_6BITLEN) {
+        *used = 1;
+        return p[0] & 0x3F;
+    } else if (type == REDIS_RDB_ENCVAL) {
+        *isencoded = 1;
+        *used = 1;
+        return p[0] & 0x3F;
+    } else if (type == REDIS_RDB_14BITLEN) {
+        if (p+2 > end) return -1;
+        *used = 2;
+        return ((p[0] & 0x3F) << 8) | p[1];
+    } else {
+        uint32_t len;
+
+        if (p+5 > end) return -1;
+        memcpy(&len,p+1,4);
+        *used = 5;
+        return ntohl(len);
+    }
+}
+
+/* Decode the RDB encoded string at 'p' into a newly allocated buffer.
+ * On success the buffer is returned, its length is stored in *lenptr and
+ * *next is set to the first byte after the string. Returns NULL on error. */
+static char *loadString(unsigned char *p, unsigned char *end, size_t *lenptr,
+                        unsigned char **next)
+{
+    int isencoded, used;
+    long long len = loadLength(p,end,&isencoded,&used);
+    char *buf;
+
+    if (len == -1) return NULL;
+    p += used;
+    if (isencoded) {
+        long long val;
+
+        if (len == REDIS_RDB_ENC_INT8) {
+            if (p+1 > end) return NULL;
+            val = (int8_t)p[0];
+            p += 1;
+        } else if (len == REDIS_RDB_ENC_INT16) {
+            if (p+2 > end) return NULL;
+            val = (int16_t)(p[0]|(p[1]<<8));
+            p += 2;
+        } else if (len == REDIS_RDB_ENC_INT32) {
+            if (p+4 > end) return NULL;
+            val = (int32_t)(p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24));
+            p += 4;
+        } else if (len == REDIS_RDB_ENC_LZF) {
+            long long clen, ulen;
+
+            if ((clen = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+            p += used;
+            if ((ulen = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+            p += used;
+            if (p+clen > end) return NULL;
+            if ((buf = malloc(ulen+1)) == NULL) return NULL;
+            if (lzf_decompress(p,clen,buf,ulen) != (unsigned int)ulen) {
+                free(buf);
+                return NULL;
+            }
+            buf[ulen] = '\0';
+            *lenptr = ulen;
+            *next = p+clen;
+            return buf;
+        } else {
+            return NULL;
+        }
+        if ((buf = malloc(32)) == NULL) return NULL;
+        *lenptr = snprintf(buf,32,"%lld",val);
+        *next = p;
+        return buf;
+    }
+
+    if (p+len > end) return NULL;
+    if ((buf = malloc(len+1)) == NULL) return NULL;
+    memcpy(buf,p,len);
+    buf[len] = '\0';
+    *lenptr = len;
+    *next = p+len;
+    return buf;
+}
+
+static void writeBulk(const char *p, size_t len) {
+    printf("$%zu\r\n", len);
+    fwrite(p, len, 1, stdout);
+    printf("\r\n");
+}
+
+/* Emit the record described by 'e' as a RESTORE command. The key name was
+ * already decoded by the caller, 'value' points to the serialized value
+ * right after the key. */
+static void emitRecord(indexEntry *e, char *key, size_t keylen,
+                       unsigned char type, unsigned char *value,
+                       long long expire)
+{
+    unsigned char *recend = config.data+e->offset+e->len;
+    size_t vlen = recend-value, plen = 1+vlen+10;
+    unsigned char *payload;
+    long long ttl = 0;
+    char buf[32];
+    int buflen;
+
+    if (expire != -1) {
+        ttl = expire-config.now;
+        if (ttl <= 0) {
+            config.expired++;
+            return;
+        }
+    }
+    config.extracted++;
+    if (config.check) return;
+
+    if (config.lastdb != (int)e->dbid) {
+        buflen = snprintf(buf,sizeof(buf),"%u",e->dbid);
+        printf("*2\r\n");
+        writeBulk("SELECT",6);
+        writeBulk(buf,buflen);
+        config.lastdb = e->dbid;
+    }
+
+    /* Build the DUMP payload: type, serialized value, RDB version and
+     * CRC64, exactly like the DUMP command does. */
+    if ((payload = malloc(plen)) == NULL) ERROR("Out of memory\n");
+    payload[0] = type;
+    memcpy(payload+1,value,vlen);
+    payload[1+vlen] = config.rdbver & 0xff;
+    payload[2+vlen] = (config.rdbver >> 8) & 0xff;
+    store64(payload+3+vlen,crc64(0,payload,3+vlen));
+
+    printf("*4\r\n");
+    writeBulk("RESTORE",7);
+    writeBulk(key,keylen);
+    buflen = snprintf(buf,sizeof(buf),"%lld",ttl);
+    writeBulk(buf,buflen);
+    writeBulk((char*)payload,plen);
+    free(payload);
+}
+
+/* Process the index entry 'j'. If 'wanted' is not NULL only the key with
+ * this exact name is extracted, otherwise keys are matched against the
+ * configured prefix (if any). */
+static void processEntry(uint64_t j, char *wanted, size_t wantedlen) {
+    indexEntry e;
+    unsigned char *p, *end, type;
+    long long expire = -1;
+    char *key;
+    size_t keylen;
+
+    getEntry(j,&e);
+    if (e.offset+e.len > config.size || e.len < 2) {
+        fprintf(stderr,"Index entry %llu points outside the file\n",
+            (unsigned long long) j);
+        config.corrupted++;
+        return;
+    }
+    p = config.data+e.offset;
+    end = p+e.len;
+    if (crc64(0,p,e.len) != e.crc) {
+        fprintf(stderr,"Record at offset %llu is corrupted, skipping it\n",
+            (unsigned long long) e.offset);
+        config.corrupted++;
+        return;
+    }
+
+    if (p[0] == REDIS_RDB_OPCODE_EXPIRETIME_MS) {
+        if (p+10 > end) goto badrecord;
+        expire = load64(p+1);
+        p += 9;
+    }
+    type = *p++;
+    if ((key = loadString(p,end,&keylen,&p)) == NULL) goto badrecord;
+
+    if (wanted) {
+        if (keylen == wantedlen && memcmp(key,wanted,keylen) == 0)
+            emitRecord(&e,key,keylen,type,p,expire);
+    } else if (config.prefix == NULL ||
+               (keylen >= strlen(config.prefix) &&
+                memcmp(key,config.prefix,strlen(config.prefix)) == 0))
+    {
+        emitRecord(&e,key,keylen,type,p,expire);
+    }
+    free(key);
+    return;
+
+badrecord:
+    fprintf(stderr,"Unable to decode the record at offset %llu\n",
+        (unsigned long long) e.offset);
+    config.corrupted++;
+}
+
+/* Return the index of the first entry >= (dbid,keycrc). */
+static uint64_t lowerBound(uint32_t dbid, uint64_t keycrc) {
+    uint64_t lo = 0, hi = config.numentries;
+
+    while (lo < hi) {
+        uint64_t mid = lo+(hi-lo)/2;
+        indexEntry e;
+
+        getEntry(mid,&e);
+        if (e.dbid < dbid || (e.dbid == dbid && e.keycrc < keycrc))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Extract the key 'name' from the specified DB. All the entries with the
+ * same key CRC64 are candidates, and are checked comparing the key name. */
+static void extractKey(uint32_t dbid, char *name) {
+    size_t namelen = strlen(name);
+    uint64_t keycrc = crc64(0,(unsigned char*)name,namelen);
+    uint64_t j = lowerBound(dbid,keycrc);
+
+    for (; j < config.numentries; j++) {
+        indexEntry e;
+
+        getEntry(j,&e);
+        if (e.dbid != dbid || e.keycrc != keycrc) break;
+        processEntry(j,name,namelen);
+    }
+}
+
+static void extractKeys(void) {
+    uint64_t j;
+    int k;
+
+    if (config.numkeys == 0) {
+        /* Prefix match (or full extraction): only the key names of the
+         * records are decoded. */
+        for (j = 0; j < config.numentries; j++) {
+            indexEntry e;
+
+            getEntry(j,&e);
+            if (config.dbnum != -1 && e.dbid != (uint32_t)config.dbnum)
+                continue;
+            processEntry(j,NULL,0);
+        }
+        return;
+    }
+
+    /* Exact names: binary search every key in every DB of interest. The
+     * DBs present in the file are found jumping from one DB to the next
+     * one with a binary search as well. */
+    j = 0;
+    while (j < config.numentries) {
+        indexEntry e;
+
+        getEntry(j,&e);
+        if (config.dbnum == -1 || e.dbid == (uint32_t)config.dbnum) {
+            for (k = 0; k < config.numkeys; k++)
+                extractKey(e.dbid,config.keys[k]);
+        }
+        if (e.dbid == UINT32_MAX) break;
+        j = lowerBound(e.dbid+1,0);
+    }
+}
+
+/* Check the file header and locate the key index using the footer. */
+static void loadIndex(void) {
+    unsigned char *footer;
+    uint64_t offset, crc;
+
+    if (config.size < 9 || memcmp(config.data,"REDIS",5) != 0)
+        ERROR("Wrong signature in header\n");
+    config.rdbver = (int)strtol((char*)config.data+5,NULL,10);
+
+    if (config.size < 9+REDIS_RDB_INDEX_FOOTER_LEN)
+        ERROR("No key index found (was rdb-key-index enabled?)\n");
+    footer = config.data+config.size-REDIS_RDB_INDEX_FOOTER_LEN;
+    if (memcmp(footer+24,REDIS_RDB_INDEX_MAGIC,8) != 0)
+        ERROR("No key index found (was rdb-key-index enabled?)\n");
+
+    offset = load64(footer);
+    config.numentries = load64(footer+8);
+    crc = load64(footer+16);
+    if (offset > config.size ||
+        config.numentries > (config.size-offset)/REDIS_RDB_INDEX_ENTRY_LEN ||
+        offset+config.numentries*REDIS_RDB_INDEX_ENTRY_LEN+
+        REDIS_RDB_INDEX_FOOTER_LEN != config.size)
+    {
+        ERROR("Key index footer is corrupted\n");
+    }
+    config.index = config.data+offset;
+    if (crc64(0,config.index,config.numentries*REDIS_RDB_INDEX_ENTRY_LEN) != crc)
+        ERROR("Key index CRC64 does not match\n");
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+"Usage: %s [OPTIONS] <dump.rdb>\n"
+"  --key <name>       Extract the key with the specified name (can be repeated)\n"
+"  --prefix <prefix>  Extract all the keys starting with the specified prefix\n"
+"                     (decodes the name of every key, but no value)\n"
+"  --db <n>           Only extract keys stored in the specified DB\n"
+"  --check            Verify the selected records without writing them\n"
+"\n"
+"Without --key or --prefix all the keys are extracted. The output is in the\n"
+"Redis protocol format, and can be sent to a Redis server with:\n"
+"\n"
+"  %s --prefix user:1000: dump.rdb | redis-cli --pipe\n",
+    prog, prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct stat st;
+    char *filename = NULL;
+    void *data;
+    int fd, j;
+
+    config.dbnum = -1;
+    config.keys = malloc(sizeof(char*)*argc);
+    config.numkeys = 0;
+    config.prefix = NULL;
+    config.check = 0;
+    config.lastdb = -1;
+    config.extracted = config.expired = config.corrupted = 0;
+
+    for (j = 1; j < argc; j++) {
+        int lastarg = (j == argc-1);
+
+        if (!strcmp(argv[j],"--key") && !lastarg) {
+            config.keys[config.numkeys++] = argv[++j];
+        } else if (!strcmp(argv[j],"--prefix") && !lastarg) {
+            config.prefix = argv[++j];
+        } else if (!strcmp(argv[j],"--db") && !lastarg) {
+            config.dbnum = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--check")) {
+            config.check = 1;
+        } else if (lastarg && argv[j][0] != '-') {
+            filename = argv[j];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (filename == NULL) usage(argv[0]);
+    if (config.numkeys && config.prefix)
+        ERROR("--key and --prefix can't be used together\n");
+
+    if ((fd = open(filename,O_RDONLY)) == -1)
+        ERROR("Cannot open file: %s\n", filename);
+    if (fstat(fd,&st) == -1)
+        ERROR("Cannot stat: %s\n", filename);
+    if (sizeof(size_t) == sizeof(int32_t) && st.st_size >= INT_MAX)
+        ERROR("Cannot process dump files >2GB on a 32-bit platform\n");
+    data = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if (data == MAP_FAILED)
+        ERROR("Cannot mmap: %s\n", filename);
+
+    config.data = data;
+    config.size = st.st_size;
+    config.now = mstime();
+    loadIndex();
+    extractKeys();
+    fflush(stdout);
+
+    fprintf(stderr,"%lld keys %s, %lld expired, %lld corrupted\n",
+        config.extracted, config.check ? "verified" : "extracted",
+        config.expired, config.corrupted);
+
+    munmap(data,st.st_size);
+    close(fd);
+    return config.corrupted ? 1 : 0;
+}
@@ -0,0 +1,651 @@
+/* Redis delta RDB merge tool.
+ *
+ * Rebuild a full RDB file from a base RDB file and the delta files saved
+ * after it with BGSAVE DELTA (see rdb.h for a description of the format).
+ *
+ * The keys contained in the deltas are loaded in memory, then the base file
+ * is copied record by record to the output, skipping the keys that were
+ * modified or deleted later, and finally the most recent version of every
+ * key found in the deltas is appended. Values are never decoded: records
+ * are copied verbatim, only key names are parsed.
+ *
+ * Copyright (c) 2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <limits.h>
+#include "lzf.h"
+
+/* Constants from rdb.h, duplicated here as this tool is not linked with
+ * the Redis server code. */
+#define REDIS_RDB_6BITLEN 0
+#define REDIS_RDB_14BITLEN 1
+#define REDIS_RDB_32BITLEN 2
+#define REDIS_RDB_ENCVAL 3
+
+#define REDIS_RDB_ENC_INT8 0
+#define REDIS_RDB_ENC_INT16 1
+#define REDIS_RDB_ENC_INT32 2
+#define REDIS_RDB_ENC_LZF 3
+
+#define REDIS_RDB_TYPE_STRING 0
+#define REDIS_RDB_TYPE_LIST   1
+#define REDIS_RDB_TYPE_SET    2
+#define REDIS_RDB_TYPE_ZSET   3
+#define REDIS_RDB_TYPE_HASH   4
+#define REDIS_RDB_TYPE_HASH_ZIPMAP    9
+#define REDIS_RDB_TYPE_LIST_ZIPLIST  10
+#define REDIS_RDB_TYPE_SET_INTSET    11
+#define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
+#define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+
+#define REDIS_RDB_OPCODE_DELKEY     251
+#define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
+#define REDIS_RDB_OPCODE_EXPIRETIME 253
+#define REDIS_RDB_OPCODE_SELECTDB   254
+#define REDIS_RDB_OPCODE_EOF        255
+
+#define REDIS_RDB_DELTA_MAGIC "DELTA"
+#define REDIS_RDB_DELTA_HEADER_LEN (9+16)
+
+#define ERROR(...) { \
+    fprintf(stderr, __VA_ARGS__); \
+    exit(1); \
+}
+
+/* An mmap()ed input file. */
+typedef struct {
+    char *name;
+    unsigned char *data;
+    size_t size;
+} inputFile;
+
+/* A key found in a delta file. */
+typedef struct {
+    uint32_t dbid;
+    char *key;
+    size_t keylen;
+    unsigned char *rec;     /* Record, starting at the optional expire. */
+    size_t reclen;
+    int deleted;            /* DELKEY record: the key must be removed. */
+    long order;             /* Position in the deltas, later wins. */
+} deltaEntry;
+
+static struct config {
+    deltaEntry *entries;
+    size_t numentries;
+    size_t allocated;
+    FILE *out;
+    uint64_t outcrc;
+    long long fromBase, fromDeltas, deleted;
+} config;
+
+/* Prototypes */
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+
+static uint64_t load64(unsigned char *p) {
+    return ((uint64_t)p[0] << 0) |
+           ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) |
+           ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) |
+           ((uint64_t)p[7] << 56);
+}
+
+static void store64(unsigned char *p, uint64_t v) {
+    int j;
+
+    for (j = 0; j < 8; j++) p[j] = (v >> (j*8)) & 0xff;
+}
+
+static void openInput(inputFile *f, char *name) {
+    struct stat st;
+    void *data;
+    int fd;
+
+    if ((fd = open(name,O_RDONLY)) == -1)
+        ERROR("Cannot open file: %s\n", name);
+    if (fstat(fd,&st) == -1)
+        ERROR("Cannot stat: %s\n", name);
+    if (sizeof(size_t) == sizeof(int32_t) && st.st_size >= INT_MAX)
+        ERROR("Cannot process dump files >2GB on a 32-bit platform\n");
+    if (st.st_size == 0)
+        ERROR("Empty file: %s\n", name);
+    data = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if (data == MAP_FAILED)
+        ERROR("Cannot mmap: %s\n", name);
+    close(fd);
+    f->name = name;
+    f->data = data;
+    f->size = st.st_size;
+}
+
+/* Decode an RDB length at 'p', not reading past 'end'. The number of bytes
+ * used by the length is stored in *used. Returns -1 on error. */
+static long long loadLength(unsigned char *p, unsigned char *end, int *isencoded,
+                            int *used)
+{
+    int type;
+
+    *isencoded = 0;
+    if (p >= end) return -1;
+    type = (p[0] & 0xC0) >> 6;
+    if (type == REDIS_RDB_6BITLEN) {
+        *used = 1;
+        return p[0] & 0x3F;
+    } else if (type == REDIS_RDB_ENCVAL) {
+        *isencoded = 1;
+        *used = 1;
+        return p[0] & 0x3F;
+    } else if (type == REDIS_RDB_14BITLEN) {
+        if (p+2 > end) return -1;
+        *used = 2;
+        return ((p[0] & 0x3F) << 8) | p[1];
+    } else {
+        uint32_t len;
+
+        if (p+5 > end) return -1;
+        memcpy(&len,p+1,4);
+        *used = 5;
+        return ntohl(len);
+    }
+}
+
+/* Skip the RDB encoded string at 'p'. Returns a pointer to the first byte
+ * after the string, or NULL on error. */
+static unsigned char *skipString(unsigned char *p, unsigned char *end) {
+    int isencoded, used;
+    long long len = loadLength(p,end,&isencoded,&used);
+
+    if (len == -1) return NULL;
+    p += used;
+    if (isencoded) {
+        if (len == REDIS_RDB_ENC_INT8) {
+            p += 1;
+        } else if (len == REDIS_RDB_ENC_INT16) {
+            p += 2;
+        } else if (len == REDIS_RDB_ENC_INT32) {
+            p += 4;
+        } else if (len == REDIS_RDB_ENC_LZF) {
+            long long clen;
+
+            if ((clen = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+            p += used;
+            if (loadLength(p,end,&isencoded,&used) == -1) return NULL;
+            p += used+clen;
+        } else {
+            return NULL;
+        }
+    } else {
+        p += len;
+    }
+    return (p > end) ? NULL : p;
+}
+
+/* Decode the RDB encoded string at 'p' into a newly allocated buffer.
+ * On success the buffer is returned, its length is stored in *lenptr and
+ * *next is set to the first byte after the string. Returns NULL on error. */
+static char *loadString(unsigned char *p, unsigned char *end, size_t *lenptr,
+                        unsigned char **next)
+{
+    int isencoded, used;
+    long long len = loadLength(p,end,&isencoded,&used);
+    char *buf;
+
+    if (len == -1) return NULL;
+    p += used;
+    if (isencoded) {
+        long long val;
+
+        if (len == REDIS_RDB_ENC_INT8) {
+            if (p+1 > end) return NULL;
+            val = (int8_t)p[0];
+            p += 1;
+        } else if (len == REDIS_RDB_ENC_INT16) {
+            if (p+2 > end) return NULL;
+            val = (int16_t)(p[0]|(p[1]<<8));
+            p += 2;
+        } else if (len == REDIS_RDB_ENC_INT32) {
+            if (p+4 > end) return NULL;
+            val = (int32_t)(p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24));
+            p += 4;
+        } else if (len == REDIS_RDB_ENC_LZF) {
+            long long clen, ulen;
+
+            if ((clen = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+            p += used;
+            if ((ulen = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+            p += used;
+            if (p+clen > end) return NULL;
+            if ((buf = malloc(ulen+1)) == NULL) return NULL;
+            if (lzf_decompress(p,clen,buf,ulen) != (unsigned int)ulen) {
+                free(buf);
+                return NULL;
+            }
+            buf[ulen] = '\0';
+            *lenptr = ulen;
+            *next = p+clen;
+            return buf;
+        } else {
+            return NULL;
+        }
+        if ((buf = malloc(32)) == NULL) return NULL;
+        *lenptr = snprintf(buf,32,"%lld",val);
+        *next = p;
+        return buf;
+    }
+
+    if (p+len > end) return NULL;
+    if ((buf = malloc(len+1)) == NULL) return NULL;
+    memcpy(buf,p,len);
+    buf[len] = '\0';
+    *lenptr = len;
+    *next = p+len;
+    return buf;
+}
+
+/* Skip a serialized value of the specified type. Returns a pointer to the
+ * first byte after the value, or NULL on error. */
+static unsigned char *skipValue(int type, unsigned char *p, unsigned char *end) {
+    int isencoded, used;
+    long long len, j;
+
+    switch(type) {
+    case REDIS_RDB_TYPE_STRING:
+    case REDIS_RDB_TYPE_HASH_ZIPMAP:
+    case REDIS_RDB_TYPE_LIST_ZIPLIST:
+    case REDIS_RDB_TYPE_SET_INTSET:
+    case REDIS_RDB_TYPE_ZSET_ZIPLIST:
+    case REDIS_RDB_TYPE_HASH_ZIPLIST:
+        return skipString(p,end);
+    case REDIS_RDB_TYPE_LIST:
+    case REDIS_RDB_TYPE_SET:
+    case REDIS_RDB_TYPE_ZSET:
+    case REDIS_RDB_TYPE_HASH:
+        if ((len = loadLength(p,end,&isencoded,&used)) == -1) return NULL;
+        p += used;
+        for (j = 0; j < len; j++) {
+            if ((p = skipString(p,end)) == NULL) return NULL;
+            if (type == REDIS_RDB_TYPE_HASH) {
+                if ((p = skipString(p,end)) == NULL) return NULL;
+            } else if (type == REDIS_RDB_TYPE_ZSET) {
+                /* Scores are saved as a length byte followed by the
+                 * string representation, 253-255 are NaN and infinities. */
+                if (p >= end) return NULL;
+                p += (*p >= 253) ? 1 : 1+*p;
+            }
+        }
+        return (p > end) ? NULL : p;
+    default:
+        return NULL;
+    }
+}
+
+/* Parse the record at 'p' (optional expire, type, key, value). On success
+ * the decoded key is returned, and *next points to the next opcode.
+ * A DELKEY record has no value. Returns NULL on error. */
+static char *parseRecord(unsigned char *p, unsigned char *end, size_t *keylen,
+                         int *deleted, unsigned char **next)
+{
+    int type;
+    char *key;
+
+    if (p < end && *p == REDIS_RDB_OPCODE_EXPIRETIME_MS) p += 9;
+    else if (p < end && *p == REDIS_RDB_OPCODE_EXPIRETIME) p += 5;
+    if (p >= end) return NULL;
+    type = *p++;
+    if ((key = loadString(p,end,keylen,&p)) == NULL) return NULL;
+    *deleted = (type == REDIS_RDB_OPCODE_DELKEY);
+    if (!*deleted && (p = skipValue(type,p,end)) == NULL) {
+        free(key);
+        return NULL;
+    }
+    *next = p;
+    return key;
+}
+
+/* Compare two entries by DB and key name. */
+static int keyCompare(const deltaEntry *ea, const deltaEntry *eb) {
+    size_t minlen = (ea->keylen < eb->keylen) ? ea->keylen : eb->keylen;
+    int cmp;
+
+    if (ea->dbid != eb->dbid) return (ea->dbid < eb->dbid) ? -1 : 1;
+    if ((cmp = memcmp(ea->key,eb->key,minlen)) != 0) return cmp;
+    if (ea->keylen != eb->keylen) return (ea->keylen < eb->keylen) ? -1 : 1;
+    return 0;
+}
+
+/* qsort() comparator: versions of the same key are sorted by position. */
+static int entryCompare(const void *a, const void *b) {
+    const deltaEntry *ea = a, *eb = b;
+    int cmp = keyCompare(ea,eb);
+
+    if (cmp != 0) return cmp;
+    return (ea->order < eb->order) ? -1 : (ea->order > eb->order);
+}
+
+/* Load all the keys of a delta file. 'base' is the checksum of the base
+ * RDB file, and 'seq' the expected sequence number of the delta. */
+static void loadDelta(inputFile *f, uint64_t base, uint64_t seq) {
+    unsigned char *p = f->data+REDIS_RDB_DELTA_HEADER_LEN;
+    unsigned char *end = f->data+f->size;
+    uint32_t dbid = 0;
+
+    if (f->size < REDIS_RDB_DELTA_HEADER_LEN+9 ||
+        memcmp(f->data,REDIS_RDB_DELTA_MAGIC,5) != 0)
+        ERROR("%s: not a delta RDB file\n", f->name);
+    if (load64(f->data+9) != base)
+        ERROR("%s: delta refers to a different base RDB file\n", f->name);
+    if (load64(f->data+17) != seq)
+        ERROR("%s: expected delta number %llu, found %llu\n", f->name,
+            (unsigned long long)seq, (unsigned long long)load64(f->data+17));
+    if (crc64(0,f->data,f->size-8) != load64(end-8))
+        ERROR("%s: CRC64 does not match\n", f->name);
+    end -= 8;
+
+    while (p < end && *p != REDIS_RDB_OPCODE_EOF) {
+        deltaEntry *e;
+        unsigned char *next;
+
+        if (*p == REDIS_RDB_OPCODE_SELECTDB) {
+            int isencoded, used;
+            long long id = loadLength(p+1,end,&isencoded,&used);
+
+            if (id == -1) ERROR("%s: corrupted SELECTDB\n", f->name);
+            dbid = id;
+            p += 1+used;
+            continue;
+        }
+        if (config.numentries == config.allocated) {
+            config.allocated = config.allocated ? config.allocated*2 : 1024;
+            config.entries = realloc(config.entries,
+                sizeof(deltaEntry)*config.allocated);
+            if (config.entries == NULL) ERROR("Out of memory\n");
+        }
+        e = config.entries+config.numentries;
+        e->key = parseRecord(p,end,&e->keylen,&e->deleted,&next);
+        if (e->key == NULL)
+            ERROR("%s: corrupted record at offset %lld\n", f->name,
+                (long long)(p-f->data));
+        e->dbid = dbid;
+        e->rec = p;
+        e->reclen = next-p;
+        e->order = config.numentries;
+        config.numentries++;
+        p = next;
+    }
+    if (p >= end) ERROR("%s: unexpected end of file\n", f->name);
+}
+
+/* Sort the delta entries and only retain the most recent version of every
+ * key. */
+static void compactEntries(void) {
+    size_t j, last = 0;
+
+    if (config.numentries == 0) return;
+    qsort(config.entries,config.numentries,sizeof(deltaEntry),entryCompare);
+    for (j = 1; j < config.numentries; j++) {
+        deltaEntry *a = config.entries+last, *b = config.entries+j;
+
+        if (keyCompare(a,b) == 0) {
+            free(a->key);
+        } else {
+            last++;
+        }
+        config.entries[last] = *b;
+    }
+    config.numentries = last+1;
+}
+
+/* Return true if the specified key is found in the deltas. */
+static int findEntry(uint32_t dbid, char *key, size_t keylen) {
+    size_t lo = 0, hi = config.numentries;
+    deltaEntry e;
+
+    e.dbid = dbid;
+    e.key = key;
+    e.keylen = keylen;
+    while (lo < hi) {
+        size_t mid = lo+(hi-lo)/2;
+        int cmp = keyCompare(config.entries+mid,&e);
+
+        if (cmp == 0) return 1;
+        if (cmp < 0) lo = mid+1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+static void writeOut(const void *p, size_t len) {
+    config.outcrc = crc64(config.outcrc,p,len);
+    if (fwrite(p,len,1,config.out) != 1) ERROR("Write error: %s\n",
+        strerror(errno));
+}
+
+static void writeSelectDb(uint32_t dbid) {
+    unsigned char buf[6];
+    int len;
+
+    buf[0] = REDIS_RDB_OPCODE_SELECTDB;
+    if (dbid < (1<<6)) {
+        buf[1] = dbid;
+        len = 2;
+    } else if (dbid < (1<<14)) {
+        buf[1] = ((dbid>>8)&0xFF)|(REDIS_RDB_14BITLEN<<6);
+        buf[2] = dbid&0xFF;
+        len = 3;
+    } else {
+        uint32_t nlen = htonl(dbid);
+
+        buf[1] = REDIS_RDB_32BITLEN<<6;
+        memcpy(buf+2,&nlen,4);
+        len = 6;
+    }
+    writeOut(buf,len);
+}
+
+/* Copy the base file to the output skipping the keys found in the deltas,
+ * verifying its checksum. */
+static void copyBase(inputFile *f, int rdbver) {
+    unsigned char *p = f->data+9;
+    unsigned char *end = f->data+f->size;
+    uint32_t dbid = 0;
+
+    writeOut(f->data,9);
+    while (p < end && *p != REDIS_RDB_OPCODE_EOF) {
+        unsigned char *next;
+        size_t keylen;
+        int deleted;
+        char *key;
+
+        if (*p == REDIS_RDB_OPCODE_SELECTDB) {
+            int isencoded, used;
+            long long id = loadLength(p+1,end,&isencoded,&used);
+
+            if (id == -1) ERROR("%s: corrupted SELECTDB\n", f->name);
+            dbid = id;
+            writeOut(p,1+used);
+            p += 1+used;
+            continue;
+        }
+        key = parseRecord(p,end,&keylen,&deleted,&next);
+        if (key == NULL || deleted)
+            ERROR("%s: corrupted record at offset %lld\n", f->name,
+                (long long)(p-f->data));
+        if (!findEntry(dbid,key,keylen)) {
+            writeOut(p,next-p);
+            config.fromBase++;
+        }
+        free(key);
+        p = next;
+    }
+    if (p >= end) ERROR("%s: unexpected end of file\n", f->name);
+
+    /* Versions before 5 have no checksum, zero means checksum disabled. */
+    if (rdbver < 5) return;
+    if (p+9 > end) ERROR("%s: unexpected end of file\n", f->name);
+    if (load64(p+1) != 0 && crc64(0,f->data,p+1-f->data) != load64(p+1))
+        ERROR("%s: CRC64 does not match\n", f->name);
+}
+
+/* Append the keys found in the deltas, then terminate the file. */
+static void writeDeltaKeys(int rdbver) {
+    unsigned char buf[9];
+    uint32_t dbid = UINT32_MAX;
+    size_t j;
+
+    for (j = 0; j < config.numentries; j++) {
+        deltaEntry *e = config.entries+j;
+
+        if (e->deleted) {
+            config.deleted++;
+            continue;
+        }
+        if (e->dbid != dbid) {
+            writeSelectDb(e->dbid);
+            dbid = e->dbid;
+        }
+        writeOut(e->rec,e->reclen);
+        config.fromDeltas++;
+    }
+    buf[0] = REDIS_RDB_OPCODE_EOF;
+    writeOut(buf,1);
+    if (rdbver >= 5) {
+        store64(buf,config.outcrc);
+        writeOut(buf,8);
+    }
+}
+
+/* The base checksum is needed in order to validate the deltas before the
+ * base is copied: read it locating the EOF opcode of the base. This means
+ * that the base is parsed twice, but only the key names are decoded. */
+static uint64_t baseChecksum(inputFile *f) {
+    unsigned char *p = f->data+9;
+    unsigned char *end = f->data+f->size;
+
+    while (p < end && *p != REDIS_RDB_OPCODE_EOF) {
+        if (*p == REDIS_RDB_OPCODE_SELECTDB) {
+            int isencoded, used;
+
+            if (loadLength(p+1,end,&isencoded,&used) == -1) break;
+            p += 1+used;
+        } else {
+            unsigned char *next;
+            size_t keylen;
+            int deleted;
+            char *key = parseRecord(p,end,&keylen,&deleted,&next);
+
+            if (key == NULL) break;
+            free(key);
+            p = next;
+        }
+    }
+    if (p+9 > end || *p != REDIS_RDB_OPCODE_EOF)
+        ERROR("%s: corrupted RDB file\n", f->name);
+    return load64(p+1);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+"Usage: %s -o <output.rdb> <base.rdb> [<delta-1> <delta-2> ...]\n"
+"\n"
+"Merge a full RDB file with the deltas saved after it using BGSAVE DELTA,\n"
+"producing a new full RDB file. Deltas must be given in order, starting\n"
+"from the first delta saved after the base file. Example:\n"
+"\n"
+"  %s -o merged.rdb dump.rdb dump.rdb.delta-1 dump.rdb.delta-2\n",
+    prog, prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *outname = NULL, tmpname[1024];
+    inputFile base, *deltas;
+    int numdeltas = 0, rdbver, j;
+    uint64_t cksum;
+
+    deltas = malloc(sizeof(inputFile)*argc);
+    for (j = 1; j < argc; j++) {
+        if (!strcmp(argv[j],"-o") && j+1 < argc) {
+            outname = argv[++j];
+        } else if (argv[j][0] == '-') {
+            usage(argv[0]);
+        } else {
+            openInput(deltas+numdeltas,argv[j]);
+            numdeltas++;
+        }
+    }
+    if (outname == NULL || numdeltas == 0) usage(argv[0]);
+    base = deltas[0];
+    deltas++;
+    numdeltas--;
+
+    if (base.size < 9 || memcmp(base.data,"REDIS",5) != 0)
+        ERROR("%s: wrong signature in header\n", base.name);
+    rdbver = (int)strtol((char*)base.data+5,NULL,10);
+    cksum = baseChecksum(&base);
+    if (numdeltas && (rdbver < 5 || cksum == 0))
+        ERROR("%s: the base file has no checksum\n", base.name);
+
+    for (j = 0; j < numdeltas; j++) loadDelta(deltas+j,cksum,j+1);
+    compactEntries();
+
+    snprintf(tmpname,sizeof(tmpname),"%s.tmp-%d",outname,(int)getpid());
+    if ((config.out = fopen(tmpname,"w")) == NULL)
+        ERROR("Cannot open %s for writing: %s\n", tmpname, strerror(errno));
+    copyBase(&base,rdbver);
+    writeDeltaKeys(rdbver);
+    if (fflush(config.out) == EOF || fsync(fileno(config.out)) == -1 ||
+        fclose(config.out) == EOF)
+    {
+        unlink(tmpname);
+        ERROR("Write error: %s\n", strerror(errno));
+    }
+    if (rename(tmpname,outname) == -1) {
+        unlink(tmpname);
+        ERROR("Cannot rename %s to %s: %s\n", tmpname, outname,
+            strerror(errno));
+    }
+
+    fprintf(stderr,"%lld keys from the base file, %lld keys from %d deltas, "
+                   "%lld keys deleted\n",
+        config.fromBase, config.fromDeltas, numdeltas, config.deleted);
+    return 0;
+}
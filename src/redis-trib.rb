@@ -25,6 +25,8 @@ require 'rubygems'
 require 'redis'
 
 ClusterHashSlots = 4096
+MigratePipeline = 100
+MigrateTimeout = 60000
 
 def xputs(s)
     printf s
@@ -352,15 +354,15 @@ class RedisTrib
         print "Moving slot #{slot} from #{source.info_string}: "; STDOUT.flush
         target.r.cluster("setslot",slot,"importing",source.info[:name])
         source.r.cluster("setslot",slot,"migrating",source.info[:name])
-        # Migrate all the keys from source to target using the MIGRATE command
+        # Migrate all the keys from source to target using the MIGRATE command,
+        # moving MigratePipeline keys with every call.
         while true
-            keys = source.r.cluster("getkeysinslot",slot,10)
+            keys = source.r.cluster("getkeysinslot",slot,MigratePipeline)
             break if keys.length == 0
-            keys.each{|key|
-                source.r.migrate(target.info[:host],target.info[:port],key,0,1000)
-                print "." if o[:verbose]
-                STDOUT.flush
-            }
+            source.r.client.call(["migrate",target.info[:host],
+                target.info[:port],"",0,MigrateTimeout,"keys",*keys])
+            print "."*keys.length if o[:verbose]
+            STDOUT.flush
         end
         puts
         # Set the new node as the owner of the slot in all the known nodes.
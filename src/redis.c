@@ -208,9 +208,10 @@ struct redisCommand redisCommandTable[] = {
     {"dbsize",dbsizeCommand,1,"r",0,NULL,0,0,0,0,0},
     {"auth",authCommand,2,"rs",0,NULL,0,0,0,0,0},
     {"ping",pingCommand,1,"r",0,NULL,0,0,0,0,0},
+    {"hello",helloCommand,-1,"rs",0,NULL,0,0,0,0,0},
     {"echo",echoCommand,2,"r",0,NULL,0,0,0,0,0},
     {"save",saveCommand,1,"ars",0,NULL,0,0,0,0,0},
-    {"bgsave",bgsaveCommand,1,"ar",0,NULL,0,0,0,0,0},
+    {"bgsave",bgsaveCommand,-1,"ar",0,NULL,0,0,0,0,0},
     {"bgrewriteaof",bgrewriteaofCommand,1,"ar",0,NULL,0,0,0,0,0},
     {"shutdown",shutdownCommand,-1,"ar",0,NULL,0,0,0,0,0},
     {"lastsave",lastsaveCommand,1,"r",0,NULL,0,0,0,0,0},
@@ -220,6 +221,9 @@ struct redisCommand redisCommandTable[] = {
     {"discard",discardCommand,1,"rs",0,NULL,0,0,0,0,0},
     {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"replconf",replconfCommand,-1,"ars",0,NULL,0,0,0,0,0},
+    {"readonly",readonlyCommand,-1,"rs",0,NULL,0,0,0,0,0},
+    {"readwrite",readwriteCommand,1,"rs",0,NULL,0,0,0,0,0},
+    {"wait",waitCommand,3,"rs",0,NULL,0,0,0,0,0},
     {"flushdb",flushdbCommand,1,"w",0,NULL,0,0,0,0,0},
     {"flushall",flushallCommand,1,"w",0,NULL,0,0,0,0,0},
     {"sort",sortCommand,-2,"wmS",0,NULL,1,1,1,0,0},
@@ -240,7 +244,7 @@ struct redisCommand redisCommandTable[] = {
     {"unwatch",unwatchCommand,1,"rs",0,NULL,0,0,0,0,0},
     {"cluster",clusterCommand,-2,"ar",0,NULL,0,0,0,0,0},
     {"restore",restoreCommand,4,"awm",0,NULL,1,1,1,0,0},
-    {"migrate",migrateCommand,6,"aw",0,NULL,0,0,0,0,0},
+    {"migrate",migrateCommand,-6,"aw",0,NULL,0,0,0,0,0},
     {"asking",askingCommand,1,"r",0,NULL,0,0,0,0,0},
     {"dump",dumpCommand,2,"ar",0,NULL,1,1,1,0,0},
     {"object",objectCommand,-2,"r",0,NULL,2,2,2,0,0},
@@ -380,6 +384,18 @@ void dictListDestructor(void *privdata, void *val)
     listRelease((list*)val);
 }
 
+void dictDictDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+    dictRelease((dict*)val);
+}
+
+/* Hash the pointer itself, used for dictionaries of client IDs that are
+ * stored directly inside the key pointer. */
+unsigned int dictPtrHash(const void *key) {
+    return dictGenHashFunction((const unsigned char*)&key,sizeof(key));
+}
+
 int dictSdsKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -507,6 +523,16 @@ dictType dbDictType = {
     dictRedisObjectDestructor   /* val destructor */
 };
 
+/* Db->delta_keys, set of sds keys owned by the dictionary. */
+dictType deltaKeysDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
 /* Db->expires */
 dictType keyptrDictType = {
     dictSdsHash,               /* hash function */
@@ -560,6 +586,50 @@ dictType clusterNodesDictType = {
     NULL                        /* val destructor */
 };
 
+/* Keys of a cluster hash slot. Keys are shared with the DB dictionary, that
+ * is responsible of freeing them. */
+dictType slotToKeyDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* MIGRATE cached connections, mapping host:port to migrateCachedSocket
+ * structures. */
+dictType migrateCacheDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* Tracking table, mapping key names to the set of IDs of the clients that
+ * may have the key cached. */
+dictType trackingTableDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictDictDestructor          /* val destructor */
+};
+
+/* Client IDs -> client pointer (or NULL for sets of IDs). The ID is stored
+ * in the key pointer, so keys are compared by value. */
+dictType clientIdDictType = {
+    dictPtrHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    NULL,                       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
 int htNeedsResize(dict *dict) {
     long long size, used;
 
@@ -727,7 +797,9 @@ int clientsCronHandleTimeout(redisClient *c) {
         redisLog(REDIS_VERBOSE,"Closing idle client");
         freeClient(c);
         return 1;
-    } else if (c->flags & REDIS_BLOCKED) {
+    } else if (c->flags & REDIS_BLOCKED && c->btype == REDIS_BLOCKED_LIST) {
+        /* WAIT timeouts are in milliseconds, and are handled by
+         * processClientsWaitingReplicas() instead. */
         if (c->bpop.timeout != 0 && c->bpop.timeout < now) {
             addReply(c,shared.nullmultibulk);
             unblockClientWaitingData(c);
@@ -788,6 +860,7 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        updateClientMemUsage(c);
     }
 }
 
@@ -912,12 +985,14 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             
             if (WIFSIGNALED(statloc)) bysignal = WTERMSIG(statloc);
 
+            if (!bysignal && exitcode == 0) receiveChildInfo();
             if (pid == server.rdb_child_pid) {
                 backgroundSaveDoneHandler(exitcode,bysignal);
             } else {
                 backgroundRewriteDoneHandler(exitcode,bysignal);
             }
             updateDictResizePolicy();
+            closeChildInfoPipe();
         }
     } else {
         /* If there is not a background saving/rewrite in progress check if
@@ -957,21 +1032,45 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
     /* Expire a few keys per cycle, only if this is a master.
      * On slaves we wait for DEL operations synthesized by the master
-     * in order to guarantee a strict consistency. */
-    if (server.masterhost == NULL) activeExpireCycle();
+     * in order to guarantee a strict consistency.
+     *
+     * While a saving child is active, every page touched by the deletion
+     * of an expired key is duplicated by copy-on-write, so we only run the
+     * active expire cycle once per second: keys are still expired lazily
+     * when accessed, and the normal frequency is restored once the child
+     * terminates. */
+    if (server.masterhost == NULL) {
+        if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+            activeExpireCycle();
+        } else {
+            run_with_period(1000) activeExpireCycle();
+        }
+    }
 
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
 
+    /* Give back the memory of reply blocks not needed anymore. */
+    run_with_period(1000) replyPoolCron();
+
     /* Replication cron function -- used to reconnect to master and
      * to detect transfer failures. */
     run_with_period(1000) replicationCron();
 
+    /* Let the slaves know the offset of the stream and the age of the data
+     * they received. */
+    run_with_period(REDIS_REPL_HEARTBEAT_PERIOD) {
+        if (listLength(server.slaves)) replicationFeedHeartbeat();
+    }
+
     /* Run other sub-systems specific cron jobs */
     run_with_period(1000) {
         if (server.cluster_enabled) clusterCron();
     }
 
+    /* Close MIGRATE cached connections not used for some time. */
+    run_with_period(1000) migrateCloseTimedoutSockets();
+
     /* Run the sentinel timer if we are in sentinel mode. */
     run_with_period(100) {
         if (server.sentinel_mode) sentinelTimer();
@@ -989,6 +1088,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     listNode *ln;
     redisClient *c;
 
+    /* Reply to the clients blocked in WAIT that got enough ACKs from the
+     * slaves, or timed out. */
+    if (listLength(server.clients_waiting_acks))
+        processClientsWaitingReplicas();
+
     /* Try to process pending commands for clients that were just unblocked. */
     while (listLength(server.unblocked_clients)) {
         ln = listFirst(server.unblocked_clients);
@@ -1005,8 +1109,30 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         }
     }
 
+    /* Send invalidation messages still queued for the last client. */
+    trackingHandlePendingKeys();
+
+    /* Clients blocked in WAIT during this event loop iteration: ask the
+     * slaves for an ACK now, instead of waiting for the next heartbeat. */
+    if (server.get_ack_from_slaves) {
+        if (listLength(server.slaves)) replicationFeedHeartbeat();
+        server.get_ack_from_slaves = 0;
+    }
+
+    /* Send the stream of this event loop iteration to the slaves using a
+     * compressed link, compressing it all at once. This must happen after
+     * the ACK request above is fed, otherwise WAIT would be delayed. */
+    replicationFlushCompressedStream();
+
+    /* Close the clients using more memory if over maxmemory-clients, or
+     * over maxmemory with the clients-first policy. */
+    evictClientsIfNeeded();
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+
+    /* Save the cluster config in background if it changed. */
+    if (server.cluster_enabled) clusterBeforeSleep();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1084,10 +1210,12 @@ void initServerConfig() {
     server.runid[REDIS_RUN_ID_SIZE] = '\0';
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = REDIS_SERVERPORT;
-    server.bindaddr = NULL;
+    server.bindaddr_count = 0;
+    server.tcp_reuseport = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = 0;
-    server.ipfd = -1;
+    server.ipfd_count = 0;
+    server.cfd_count = 0;
     server.sofd = -1;
     server.dbnum = REDIS_DEFAULT_DBNUM;
     server.verbosity = REDIS_NOTICE;
@@ -1121,12 +1249,26 @@ void initServerConfig() {
     server.requirepass = NULL;
     server.rdb_compression = 1;
     server.rdb_checksum = 1;
+    server.rdb_key_index = 0;
+    server.rdb_save_fsync_bytes = REDIS_RDB_SAVE_FSYNC_BYTES;
+    server.rdb_save_drop_cache = 0;
+    server.rdb_save_rate_limit = 0;
+    server.rdb_save_cksum = 0;
+    server.rdb_child_type = REDIS_RDB_CHILD_TYPE_FULL;
+    server.rdb_child_cksum = 0;
+    server.rdb_child_cksum_received = 0;
+    server.rdb_delta_tracking = 0;
+    server.rdb_delta_need_full = 1; /* No base RDB file yet. */
+    server.rdb_delta_base_cksum = 0;
+    server.rdb_delta_seq = 0;
     server.activerehashing = 1;
     server.maxclients = REDIS_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = 0;
     server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_LRU;
     server.maxmemory_samples = 3;
+    server.maxmemory_clients = 0;
+    server.maxmemory_clients_policy = REDIS_MAXMEMORY_CLIENTS_KEYS_ONLY;
     server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
@@ -1159,7 +1301,13 @@ void initServerConfig() {
     server.repl_syncio_timeout = REDIS_REPL_SYNCIO_TIMEOUT;
     server.repl_serve_stale_data = 1;
     server.repl_slave_ro = 1;
+    server.repl_compression = 0;
+    server.repl_transfer_compressed = 0;
+    server.slave_reader_thread = 0;
     server.repl_down_since = time(NULL);
+    server.slave_repl_read = 0;
+    server.slave_repl_base = 0;
+    server.slave_repl_data_time = 0;
     server.slave_priority = REDIS_DEFAULT_SLAVE_PRIORITY;
 
     /* Client output buffer limits */
@@ -1191,6 +1339,7 @@ void initServerConfig() {
     /* Slow log */
     server.slowlog_log_slower_than = REDIS_SLOWLOG_LOG_SLOWER_THAN;
     server.slowlog_max_len = REDIS_SLOWLOG_MAX_LEN;
+    server.tracking_table_max_keys = REDIS_TRACKING_TABLE_MAX_KEYS;
 
     /* Debugging */
     server.assert_failed = "<no assertion failed>";
@@ -1244,6 +1393,85 @@ void adjustOpenFilesLimit(void) {
     }
 }
 
+/* Initialize a set of file descriptors to listen to the specified 'port'
+ * binding the addresses specified in the Redis server configuration.
+ *
+ * The listening file descriptors are stored in the integer array 'fds'
+ * and their number is set in '*count'.
+ *
+ * The addresses to bind are specified in the global server.bindaddr array
+ * and their number is server.bindaddr_count. If the server configuration
+ * contains no specific addresses to bind, this function will try to
+ * bind * (all addresses) for both the IPv4 and IPv6 protocols.
+ *
+ * On success the function returns REDIS_OK.
+ *
+ * On error the function returns REDIS_ERR. For the function to be on
+ * error, at least one of the server.bindaddr addresses was
+ * impossible to bind, or no bind addresses were specified in the server
+ * configuration but the function is not able to bind * for at least
+ * one of the IPv4 or IPv6 protocols. */
+int listenToPort(int port, int *fds, int *count) {
+    int j;
+
+    /* Force binding of 0.0.0.0 if no bind address is specified, always
+     * entering the loop if j == 0. */
+    if (server.bindaddr_count == 0) server.bindaddr[0] = NULL;
+    for (j = 0; j < server.bindaddr_count || j == 0; j++) {
+        if (server.bindaddr[j] == NULL) {
+            /* Bind * for both IPv6 and IPv4, we enter here only if
+             * server.bindaddr_count == 0. */
+            fds[*count] = server.tcp_reuseport ?
+                anetTcp6ReusePortServer(server.neterr,port,NULL) :
+                anetTcp6Server(server.neterr,port,NULL);
+            if (fds[*count] != ANET_ERR) {
+                anetNonBlock(NULL,fds[*count]);
+                (*count)++;
+            }
+            fds[*count] = server.tcp_reuseport ?
+                anetTcpReusePortServer(server.neterr,port,NULL) :
+                anetTcpServer(server.neterr,port,NULL);
+            if (fds[*count] != ANET_ERR) {
+                anetNonBlock(NULL,fds[*count]);
+                (*count)++;
+            }
+            /* Exit the loop if we were able to bind * on IPv4 or IPv6,
+             * otherwise fds[*count] will be ANET_ERR and we'll print an
+             * error and return to the caller with an error. */
+            if (*count) break;
+        } else if (strchr(server.bindaddr[j],':')) {
+            /* Bind IPv6 address. */
+            fds[*count] = server.tcp_reuseport ?
+                anetTcp6ReusePortServer(server.neterr,port,server.bindaddr[j]) :
+                anetTcp6Server(server.neterr,port,server.bindaddr[j]);
+        } else {
+            /* Bind IPv4 address. */
+            fds[*count] = server.tcp_reuseport ?
+                anetTcpReusePortServer(server.neterr,port,server.bindaddr[j]) :
+                anetTcpServer(server.neterr,port,server.bindaddr[j]);
+        }
+        if (fds[*count] == ANET_ERR) {
+            redisLog(REDIS_WARNING,
+                "Creating Server TCP listening socket %s:%d: %s",
+                server.bindaddr[j] ? server.bindaddr[j] : "*",
+                port, server.neterr);
+            return REDIS_ERR;
+        }
+        anetNonBlock(NULL,fds[*count]);
+        (*count)++;
+    }
+    return REDIS_OK;
+}
+
+/* Close the TCP and Unix listening sockets, and the cluster bus ones. */
+void closeListeningSockets(void) {
+    int j;
+
+    for (j = 0; j < server.ipfd_count; j++) close(server.ipfd[j]);
+    for (j = 0; j < server.cfd_count; j++) close(server.cfd[j]);
+    if (server.sofd != -1) close(server.sofd);
+}
+
 void initServer() {
     int j;
 
@@ -1257,25 +1485,37 @@ void initServer() {
     }
 
     server.current_client = NULL;
+    server.reading_client = NULL;
     server.clients = listCreate();
+    server.clients_mem_usage = 0;
+    server.clients_big_mem = 0;
+    server.next_client_id = 1;
+    server.shared_querybuf = sdsnewlen(NULL,REDIS_IOBUF_LEN);
+    sdsclear(server.shared_querybuf);
+    server.reply_pool = zmalloc(sizeof(robj*)*REDIS_REPLY_POOL_MAX);
+    server.reply_pool_len = 0;
+    server.reply_pool_min_len = 0;
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_block = NULL;
+    server.slaveseldb = -1; /* Force to emit the first SELECT command. */
+    server.master_repl_offset = 0;
+    server.repl_proxy_pending = sdsempty();
+    server.repl_comp_pending = sdsempty();
+    server.repl_transfer_frame = sdsempty();
     server.monitors = listCreate();
     server.unblocked_clients = listCreate();
+    server.clients_waiting_acks = listCreate();
+    server.get_ack_from_slaves = 0;
 
     createSharedObjects();
     adjustOpenFilesLimit();
     server.el = aeCreateEventLoop(server.maxclients+1024);
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
 
-    if (server.port != 0) {
-        server.ipfd = anetTcpServer(server.neterr,server.port,server.bindaddr);
-        if (server.ipfd == ANET_ERR) {
-            redisLog(REDIS_WARNING, "Opening port %d: %s",
-                server.port, server.neterr);
-            exit(1);
-        }
-    }
+    if (server.port != 0 &&
+        listenToPort(server.port,server.ipfd,&server.ipfd_count) == REDIS_ERR)
+        exit(1);
     if (server.unixsocket != NULL) {
         unlink(server.unixsocket); /* don't care if this fails */
         server.sofd = anetUnixServer(server.neterr,server.unixsocket,server.unixsocketperm);
@@ -1283,8 +1523,9 @@ void initServer() {
             redisLog(REDIS_WARNING, "Opening socket: %s", server.neterr);
             exit(1);
         }
+        anetNonBlock(NULL,server.sofd);
     }
-    if (server.ipfd < 0 && server.sofd < 0) {
+    if (server.ipfd_count == 0 && server.sofd < 0) {
         redisLog(REDIS_WARNING, "Configured to not listen anywhere, exiting.");
         exit(1);
     }
@@ -1293,8 +1534,17 @@ void initServer() {
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].delta_keys = dictCreate(&deltaKeysDictType,NULL);
+        server.db[j].delta_saving_keys = dictCreate(&deltaKeysDictType,NULL);
         server.db[j].id = j;
     }
+    server.tracking_table = dictCreate(&trackingTableDictType,NULL);
+    server.migrate_cached_sockets = dictCreate(&migrateCacheDictType,NULL);
+    server.tracking_clients = dictCreate(&clientIdDictType,NULL);
+    server.tracking_pending_keys = listCreate();
+    listSetFreeMethod(server.tracking_pending_keys,decrRefCount);
+    server.tracking_pending_flush = 0;
+    server.tracking_pending_id = 0;
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
@@ -1302,6 +1552,8 @@ void initServer() {
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
+    server.child_info_pipe[0] = -1;
+    server.child_info_pipe[1] = -1;
     aofRewriteBufferReset();
     server.aof_buf = sdsempty();
     server.lastsave = time(NULL);
@@ -1312,12 +1564,23 @@ void initServer() {
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedclients = 0;
     server.stat_starttime = time(NULL);
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_peak_memory = 0;
     server.stat_fork_time = 0;
+    server.stat_rdb_cow_bytes = 0;
+    server.stat_aof_cow_bytes = 0;
     server.stat_rejected_conn = 0;
+    server.stat_reply_pool_hits = 0;
+    server.stat_reply_pool_misses = 0;
+    server.stat_repl_comp_in = 0;
+    server.stat_repl_comp_out = 0;
+    server.stat_repl_comp_usec = 0;
+    server.stat_repl_decomp_in = 0;
+    server.stat_repl_decomp_out = 0;
+    server.stat_repl_decomp_usec = 0;
     memset(server.ops_sec_samples,0,sizeof(server.ops_sec_samples));
     server.ops_sec_idx = 0;
     server.ops_sec_last_sample_time = mstime();
@@ -1326,8 +1589,11 @@ void initServer() {
     server.lastbgsave_status = REDIS_OK;
     server.stop_writes_on_bgsave_err = 1;
     aeCreateTimeEvent(server.el, 1, serverCron, NULL, NULL);
-    if (server.ipfd > 0 && aeCreateFileEvent(server.el,server.ipfd,AE_READABLE,
-        acceptTcpHandler,NULL) == AE_ERR) redisPanic("Unrecoverable error creating server.ipfd file event.");
+    for (j = 0; j < server.ipfd_count; j++) {
+        if (aeCreateFileEvent(server.el, server.ipfd[j], AE_READABLE,
+            acceptTcpHandler,NULL) == AE_ERR)
+            redisPanic("Unrecoverable error creating server.ipfd file event.");
+    }
     if (server.sofd > 0 && aeCreateFileEvent(server.el,server.sofd,AE_READABLE,
         acceptUnixHandler,NULL) == AE_ERR) redisPanic("Unrecoverable error creating server.sofd file event.");
 
@@ -1468,6 +1734,10 @@ void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
 {
     if (server.aof_state != REDIS_AOF_OFF && flags & REDIS_PROPAGATE_AOF)
         feedAppendOnlyFile(cmd,dbid,argv,argc);
+    /* What is executed on behalf of our master reaches our slaves verbatim,
+     * see replicationProxyMasterStream(). */
+    if (server.current_client && server.current_client->flags & REDIS_MASTER)
+        flags &= ~REDIS_PROPAGATE_REPL;
     if (flags & REDIS_PROPAGATE_REPL && listLength(server.slaves))
         replicationFeedSlaves(server.slaves,dbid,argv,argc);
 }
@@ -1485,8 +1755,10 @@ void call(redisClient *c, int flags) {
     long long dirty, start = ustime(), duration;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
-     * not geneated from reading an AOF. */
-    if (listLength(server.monitors) && !server.loading)
+     * not geneated from reading an AOF. Admin commands are not sent either,
+     * otherwise the REPLCONF ACKs of the slaves would flood the monitors. */
+    if (listLength(server.monitors) && !server.loading &&
+        !(c->cmd->flags & REDIS_CMD_ADMIN))
         replicationFeedMonitors(c,server.monitors,c->db->id,c->argv,c->argc);
 
     /* Call the command. */
@@ -1653,6 +1925,23 @@ int processCommand(redisClient *c) {
         return REDIS_OK;
     }
 
+    /* Reject reads of READONLY clients if the data of this slave is older
+     * than their staleness bound. The error includes the address of the
+     * master, so that the client can send the query there instead. */
+    if (server.masterhost && c->flags & REDIS_READONLY && c->max_staleness &&
+        !(c->cmd->getkeys_proc == NULL && c->cmd->firstkey == 0))
+    {
+        long long lag = replicationGetSlaveLag();
+
+        if (lag == -1 || lag > c->max_staleness) {
+            addReplySds(c,sdscatprintf(sdsempty(),
+                "-STALE %lld %s:%d Slave data is older than the staleness "
+                "bound of %lld milliseconds\r\n",
+                lag,server.masterhost,server.masterport,c->max_staleness));
+            return REDIS_OK;
+        }
+    }
+
     /* Loading DB? Return an error if the command has not the
      * REDIS_CMD_LOADING flag. */
     if (server.loading && !(c->cmd->flags & REDIS_CMD_LOADING)) {
@@ -1682,6 +1971,7 @@ int processCommand(redisClient *c) {
         addReply(c,shared.queued);
     } else {
         call(c,REDIS_CALL_FULL);
+        trackingHandlePendingKeys();
     }
     return REDIS_OK;
 }
@@ -1726,13 +2016,16 @@ int prepareForShutdown(int flags) {
             return REDIS_ERR;
         }
     }
+    if (server.cluster_enabled) {
+        redisLog(REDIS_NOTICE,"Saving the cluster config file.");
+        clusterFlushConfig();
+    }
     if (server.daemonize) {
         redisLog(REDIS_NOTICE,"Removing the pid file.");
         unlink(server.pidfile);
     }
     /* Close the listening sockets. Apparently this allows faster restarts. */
-    if (server.ipfd != -1) close(server.ipfd);
-    if (server.sofd != -1) close(server.sofd);
+    closeListeningSockets();
     if (server.unixsocket) {
         redisLog(REDIS_NOTICE,"Removing the unix socket file.");
         unlink(server.unixsocket); /* don't care if this fails */
@@ -1914,10 +2207,14 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "tracking_clients:%lu\r\n"
+            "clients_used_memory:%zu\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            dictSize(server.tracking_clients),
+            server.clients_mem_usage);
     }
 
     /* Memory */
@@ -1937,7 +2234,9 @@ sds genRedisInfoString(char *section) {
             "used_memory_peak_human:%s\r\n"
             "used_memory_lua:%lld\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
-            "mem_allocator:%s\r\n",
+            "mem_allocator:%s\r\n"
+            "reply_pool_blocks:%lu\r\n"
+            "reply_pool_retained_bytes:%zu\r\n",
             zmalloc_used_memory(),
             hmem,
             zmalloc_get_rss(),
@@ -1945,7 +2244,9 @@ sds genRedisInfoString(char *section) {
             peak_hmem,
             ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL,
             zmalloc_get_fragmentation_ratio(),
-            ZMALLOC_LIB
+            ZMALLOC_LIB,
+            server.reply_pool_len,
+            replyPoolRetainedBytes()
             );
     }
 
@@ -1961,12 +2262,17 @@ sds genRedisInfoString(char *section) {
             "rdb_last_bgsave_status:%s\r\n"
             "rdb_last_bgsave_time_sec:%ld\r\n"
             "rdb_current_bgsave_time_sec:%ld\r\n"
+            "rdb_last_cow_size:%zu\r\n"
+            "rdb_delta_tracked_keys:%lu\r\n"
+            "rdb_delta_full_needed:%d\r\n"
+            "rdb_delta_last_seq:%lld\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
             "aof_last_rewrite_time_sec:%ld\r\n"
             "aof_current_rewrite_time_sec:%ld\r\n"
-            "aof_last_bgrewrite_status:%s\r\n",
+            "aof_last_bgrewrite_status:%s\r\n"
+            "aof_last_cow_size:%zu\r\n",
             server.loading,
             server.dirty,
             server.rdb_child_pid != -1,
@@ -1975,13 +2281,18 @@ sds genRedisInfoString(char *section) {
             server.rdb_save_time_last,
             (server.rdb_child_pid == -1) ?
                 -1 : time(NULL)-server.rdb_save_time_start,
+            server.stat_rdb_cow_bytes,
+            rdbDeltaTrackedKeys(),
+            server.rdb_delta_need_full,
+            server.rdb_delta_seq,
             server.aof_state != REDIS_AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
             server.aof_rewrite_time_last,
             (server.aof_child_pid == -1) ?
                 -1 : time(NULL)-server.aof_rewrite_time_start,
-            (server.aof_lastbgrewrite_status == REDIS_OK) ? "ok" : "err");
+            (server.aof_lastbgrewrite_status == REDIS_OK) ? "ok" : "err",
+            server.stat_aof_cow_bytes);
 
         if (server.aof_state != REDIS_AOF_OFF) {
             info = sdscatprintf(info,
@@ -2044,22 +2355,35 @@ sds genRedisInfoString(char *section) {
             "rejected_connections:%lld\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_clients:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
-            "latest_fork_usec:%lld\r\n",
+            "latest_fork_usec:%lld\r\n"
+            "tracking_total_keys:%lu\r\n"
+            "reply_pool_hits:%lld\r\n"
+            "reply_pool_misses:%lld\r\n"
+            "reply_pool_hit_rate:%.2f\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getOperationsPerSecond(),
             server.stat_rejected_conn,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
+            server.stat_evictedclients,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
-            server.stat_fork_time);
+            server.stat_fork_time,
+            dictSize(server.tracking_table),
+            server.stat_reply_pool_hits,
+            server.stat_reply_pool_misses,
+            (server.stat_reply_pool_hits+server.stat_reply_pool_misses) ?
+                (double)server.stat_reply_pool_hits*100/
+                (server.stat_reply_pool_hits+server.stat_reply_pool_misses) :
+                0);
     }
 
     /* Replication */
@@ -2101,11 +2425,43 @@ sds genRedisInfoString(char *section) {
                     (long)server.unixtime-server.repl_down_since);
             }
             info = sdscatprintf(info,
-                "slave_priority:%d\r\n", server.slave_priority);
+                "slave_repl_offset:%lld\r\n"
+                "slave_lag_ms:%lld\r\n"
+                "slave_priority:%d\r\n"
+                "slave_reader_thread:%d\r\n"
+                "slave_readahead_bytes:%zu\r\n"
+                "master_link_compressed:%d\r\n"
+                "repl_decompress_in_bytes:%lld\r\n"
+                "repl_decompress_out_bytes:%lld\r\n"
+                "repl_decompress_ratio:%.2f\r\n"
+                "repl_decompress_cpu_ms:%lld\r\n",
+                replicationGetSlaveOffset(),
+                replicationGetSlaveLag(),
+                server.slave_priority,
+                replicationReaderThreadActive(),
+                replicationReaderThreadPending(),
+                server.repl_transfer_compressed,
+                server.stat_repl_decomp_in,
+                server.stat_repl_decomp_out,
+                server.stat_repl_decomp_in ?
+                    (double)server.stat_repl_decomp_out/
+                            server.stat_repl_decomp_in : 0,
+                server.stat_repl_decomp_usec/1000);
         }
         info = sdscatprintf(info,
-            "connected_slaves:%lu\r\n",
-            listLength(server.slaves));
+            "connected_slaves:%lu\r\n"
+            "master_repl_offset:%lld\r\n"
+            "repl_compress_in_bytes:%lld\r\n"
+            "repl_compress_out_bytes:%lld\r\n"
+            "repl_compress_ratio:%.2f\r\n"
+            "repl_compress_cpu_ms:%lld\r\n",
+            listLength(server.slaves),
+            server.master_repl_offset,
+            server.stat_repl_comp_in,
+            server.stat_repl_comp_out,
+            server.stat_repl_comp_out ?
+                (double)server.stat_repl_comp_in/server.stat_repl_comp_out : 0,
+            server.stat_repl_comp_usec/1000);
         if (listLength(server.slaves)) {
             int slaveid = 0;
             listNode *ln;
@@ -2115,10 +2471,11 @@ sds genRedisInfoString(char *section) {
             while((ln = listNext(&li))) {
                 redisClient *slave = listNodeValue(ln);
                 char *state = NULL;
-                char ip[32];
+                char ip[REDIS_IP_STR_LEN];
                 int port;
 
-                if (anetPeerToString(slave->fd,ip,&port) == -1) continue;
+                if (anetPeerToString(slave->fd,ip,sizeof(ip),&port) == -1)
+                    continue;
                 switch(slave->replstate) {
                 case REDIS_REPL_WAIT_BGSAVE_START:
                 case REDIS_REPL_WAIT_BGSAVE_END:
@@ -2132,8 +2489,13 @@ sds genRedisInfoString(char *section) {
                     break;
                 }
                 if (state == NULL) continue;
-                info = sdscatprintf(info,"slave%d:%s,%d,%s\r\n",
-                    slaveid,ip,slave->slave_listening_port,state);
+                /* The last two fields are the offset acknowledged by the
+                 * slave with REPLCONF ACK, and the seconds since the last
+                 * ACK was received. */
+                info = sdscatprintf(info,"slave%d:%s,%d,%s,%lld,%ld\r\n",
+                    slaveid,ip,slave->slave_listening_port,state,
+                    slave->repl_ack_off,
+                    (long)(server.unixtime-slave->repl_ack_time));
                 slaveid++;
             }
         }
@@ -2216,30 +2578,17 @@ void monitorCommand(redisClient *c) {
     if (c->flags & REDIS_SLAVE) return;
 
     c->flags |= (REDIS_SLAVE|REDIS_MONITOR);
-    c->slaveseldb = 0;
     listAddNodeTail(server.monitors,c);
     addReply(c,shared.ok);
 }
 
 /* ============================ Maxmemory directive  ======================== */
 
-/* This function gets called when 'maxmemory' is set on the config file to limit
- * the max memory used by the server, before processing a command.
- *
- * The goal of the function is to free enough memory to keep Redis under the
- * configured memory limit.
- *
- * The function starts calculating how many bytes should be freed to keep
- * Redis under the limit, and enters a loop selecting the best keys to
- * evict accordingly to the configured policy.
- *
- * If all the bytes needed to return back under the limit were freed the
- * function returns REDIS_OK, otherwise REDIS_ERR is returned, and the caller
- * should block the execution of commands that will result in more memory
- * used by the server.
- */
-int freeMemoryIfNeeded(void) {
-    size_t mem_used, mem_tofree, mem_freed;
+/* Return the memory used by the server as counted against maxmemory: the
+ * slaves output buffers, the AOF buffers and the blocks retained in the
+ * reply pool are not considered. */
+size_t getMaxmemoryUsedMemory(void) {
+    size_t mem_used;
     int slaves = listLength(server.slaves);
 
     /* Remove the size of slaves output buffers and AOF buffer from the
@@ -2264,15 +2613,52 @@ int freeMemoryIfNeeded(void) {
         mem_used -= aofRewriteBufferSize();
     }
 
+    /* Blocks retained in the reply pool are released in a few seconds if
+     * unused, there is no reason to evict keys because of them. */
+    mem_used -= replyPoolRetainedBytes();
+    return mem_used;
+}
+
+/* This function gets called when 'maxmemory' is set on the config file to limit
+ * the max memory used by the server, before processing a command.
+ *
+ * The goal of the function is to free enough memory to keep Redis under the
+ * configured memory limit.
+ *
+ * The function starts calculating how many bytes should be freed to keep
+ * Redis under the limit, and enters a loop selecting the best keys to
+ * evict accordingly to the configured policy. With the clients-first
+ * maxmemory-clients-policy the clients using more memory are closed before
+ * evicting any key.
+ *
+ * If all the bytes needed to return back under the limit were freed the
+ * function returns REDIS_OK, otherwise REDIS_ERR is returned, and the caller
+ * should block the execution of commands that will result in more memory
+ * used by the server.
+ */
+int freeMemoryIfNeeded(void) {
+    size_t mem_used, mem_tofree, mem_freed;
+    int slaves = listLength(server.slaves);
+
     /* Check if we are over the memory limit. */
+    mem_used = getMaxmemoryUsedMemory();
     if (mem_used <= server.maxmemory) return REDIS_OK;
 
-    if (server.maxmemory_policy == REDIS_MAXMEMORY_NO_EVICTION)
-        return REDIS_ERR; /* We need to free memory, but policy forbids. */
-
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - server.maxmemory;
     mem_freed = 0;
+
+    /* Clients with big query or output buffers are closed before touching
+     * the dataset if the clients-first policy is configured. */
+    if (server.maxmemory_clients_policy == REDIS_MAXMEMORY_CLIENTS_FIRST) {
+        mem_freed = freeClientsMemory(mem_tofree,
+                        REDIS_MAXMEMORY_CLIENTS_MIN_USAGE,"maxmemory");
+        if (mem_freed >= mem_tofree) return REDIS_OK;
+    }
+
+    if (server.maxmemory_policy == REDIS_MAXMEMORY_NO_EVICTION)
+        return REDIS_ERR; /* We need to free memory, but policy forbids. */
+
     while (mem_freed < mem_tofree) {
         int j, k, keys_freed = 0;
 
@@ -2444,7 +2830,8 @@ void usage() {
     fprintf(stderr,"       ./redis-server - (read config from stdin)\n");
     fprintf(stderr,"       ./redis-server -v or --version\n");
     fprintf(stderr,"       ./redis-server -h or --help\n");
-    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n\n");
+    fprintf(stderr,"       ./redis-server --test-memory <megabytes>\n");
+    fprintf(stderr,"       ./redis-server --test-parser <file> [iterations]\n\n");
     fprintf(stderr,"Examples:\n");
     fprintf(stderr,"       ./redis-server (run the server with default conf)\n");
     fprintf(stderr,"       ./redis-server /etc/redis/6379.conf\n");
@@ -2581,6 +2968,16 @@ int main(int argc, char **argv) {
                 exit(1);
             }
         }
+        if (strcmp(argv[1], "--test-parser") == 0) {
+            if (argc == 3 || argc == 4) {
+                parserBenchmark(argv[2],argc == 4 ? atoi(argv[3]) : 10);
+                exit(0);
+            } else {
+                fprintf(stderr,"Please specify a file containing Redis protocol, like an AOF.\n");
+                fprintf(stderr,"Example: ./redis-server --test-parser appendonly.aof 10\n\n");
+                exit(1);
+            }
+        }
 
         /* First argument is the config file name? */
         if (argv[j][0] != '-' || argv[j][1] != '-')
@@ -2620,7 +3017,7 @@ int main(int argc, char **argv) {
         linuxOvercommitMemoryWarning();
     #endif
         loadDataFromDisk();
-        if (server.ipfd > 0)
+        if (server.ipfd_count > 0)
             redisLog(REDIS_NOTICE,"The server is now ready to accept connections on port %d", server.port);
         if (server.sofd > 0)
             redisLog(REDIS_NOTICE,"The server is now ready to accept connections at %s", server.unixsocket);
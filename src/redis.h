@@ -32,6 +32,7 @@
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
+#include "crc16.h"   /* CRC16 and cluster hash slots */
 
 /* Error codes */
 #define REDIS_OK                0
@@ -46,29 +47,48 @@
 #define REDIS_EXPIRELOOKUPS_PER_CRON    10 /* lookup 10 expires per loop */
 #define REDIS_EXPIRELOOKUPS_TIME_PERC   25 /* CPU max % for keys collection */
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
+/* Max number of reply chunks sent with a single writev() call. */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define REDIS_IOV_MAX IOV_MAX
+#else
+#define REDIS_IOV_MAX 1024
+#endif
 #define REDIS_SHARED_SELECT_CMDS 10
 #define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
 #define REDIS_MAX_LOGMSG_LEN    1024 /* Default maximum length of syslog messages */
 #define REDIS_AOF_REWRITE_PERC  100
 #define REDIS_AOF_REWRITE_MIN_SIZE (1024*1024)
+#define REDIS_RDB_SAVE_FSYNC_BYTES (1024*1024*32) /* fsync every 32MB */
 #define REDIS_AOF_REWRITE_ITEMS_PER_CMD 64
 #define REDIS_SLOWLOG_LOG_SLOWER_THAN 10000
 #define REDIS_SLOWLOG_MAX_LEN 128
+#define REDIS_TRACKING_TABLE_MAX_KEYS 1000000
 #define REDIS_MAX_CLIENTS 10000
 #define REDIS_AUTHPASS_MAX_LEN 512
 #define REDIS_DEFAULT_SLAVE_PRIORITY 100
 #define REDIS_REPL_TIMEOUT 60
 #define REDIS_REPL_PING_SLAVE_PERIOD 10
+#define REDIS_REPL_HEARTBEAT_PERIOD 100 /* Milliseconds between heartbeats */
+#define REDIS_REPL_FRAME_LEN (1024*64) /* Max data in a compressed frame */
 #define REDIS_RUN_ID_SIZE 40
 #define REDIS_OPS_SEC_SAMPLES 16
 
 /* Protocol and I/O related defines */
 #define REDIS_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
+#define REDIS_MAX_ACCEPTS_PER_CALL 1000 /* Connections accepted per event */
+#define REDIS_BINDADDR_MAX 16   /* Max number of addresses in 'bind' */
+#define REDIS_IP_STR_LEN ANET_IP_STR_LEN /* Max length of IPv6 addresses */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+/* Reply blocks are sds strings of REDIS_REPLY_CHUNK_BYTES bytes, header
+ * included, so that they fit exactly an allocator size class. */
+#define REDIS_REPLY_BLOCK_BYTES (REDIS_REPLY_CHUNK_BYTES-sizeof(struct sdshdr)-1)
+#define REDIS_REPLY_POOL_MAX 1024 /* Max reply blocks retained in the pool */
+#define REDIS_REPLY_COPY_MAX_BYTES 1024 /* Bigger objects are referenced */
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
+#define REDIS_ARGV_REUSE_MAX    1024 /* Bigger argv arrays are not reused */
 
 /* Hash table parameters */
 #define REDIS_HT_MINFILL        10      /* Minimal hash table fill 10% */
@@ -138,6 +158,15 @@
 #define REDIS_AOF_ON 1              /* AOF is on */
 #define REDIS_AOF_WAIT_REWRITE 2    /* AOF waits rewrite to start appending */
 
+/* Child info pipe, see childinfo.c */
+#define REDIS_CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
+#define REDIS_CHILD_INFO_TYPE_RDB 0
+#define REDIS_CHILD_INFO_TYPE_AOF 1
+
+/* Kind of RDB file produced by the saving child. */
+#define REDIS_RDB_CHILD_TYPE_FULL 0
+#define REDIS_RDB_CHILD_TYPE_DELTA 1
+
 /* Client flags */
 #define REDIS_SLAVE 1       /* This client is a slave server */
 #define REDIS_MASTER 2      /* This client is a master server */
@@ -151,6 +180,14 @@
 #define REDIS_LUA_CLIENT 512 /* This is a non connected client used by Lua */
 #define REDIS_ASKING 1024   /* Client issued the ASKING command */
 #define REDIS_CLOSE_ASAP 2048 /* Close this client ASAP */
+#define REDIS_TRACKING 4096 /* Client enabled keys tracking for caching */
+#define REDIS_READONLY 8192 /* Client issued READONLY, see max_staleness */
+#define REDIS_MASTER_FORCE_REPLY 16384 /* Queue reply even if it's a master */
+
+/* Client block type (btype field in client structure)
+ * if REDIS_BLOCKED flag is set. */
+#define REDIS_BLOCKED_LIST 1    /* BLPOP & co. */
+#define REDIS_BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
 
 /* Client request types */
 #define REDIS_REQ_INLINE 1
@@ -232,6 +269,13 @@
 #define REDIS_MAXMEMORY_ALLKEYS_RANDOM 4
 #define REDIS_MAXMEMORY_NO_EVICTION 5
 
+/* Clients eviction on maxmemory: with clients-first the normal clients using
+ * at least REDIS_MAXMEMORY_CLIENTS_MIN_USAGE bytes are closed, biggest
+ * first, before evicting keys. */
+#define REDIS_MAXMEMORY_CLIENTS_KEYS_ONLY 0
+#define REDIS_MAXMEMORY_CLIENTS_FIRST 1
+#define REDIS_MAXMEMORY_CLIENTS_MIN_USAGE (1024*1024)
+
 /* Scripting */
 #define REDIS_LUA_TIME_LIMIT 5000 /* milliseconds */
 
@@ -300,6 +344,8 @@ typedef struct redisDb {
     dict *expires;              /* Timeout of keys with a timeout set */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP) */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
+    dict *delta_keys;           /* Keys modified since the last RDB save */
+    dict *delta_saving_keys;    /* Keys being saved by a delta BGSAVE */
     int id;
 } redisDb;
 
@@ -323,37 +369,54 @@ typedef struct blockingState {
                              * is >= timeout then the operation timed out. */
     robj *target;           /* The key that should receive the element,
                              * for BRPOPLPUSH. */
+
+    /* REDIS_BLOCKED_WAIT */
+    int numreplicas;        /* Number of replicas we are waiting for ACK. */
+    long long reploffset;   /* Replication offset to reach. */
+    long long reptimeout;   /* WAIT timeout as unix time in milliseconds,
+                             * or 0 to wait forever. */
 } blockingState;
 
 /* With multiplexing we need to take per-clinet state.
  * Clients are taken in a liked list. */
 typedef struct redisClient {
+    unsigned long id;       /* Client incremental unique ID */
     int fd;
+    int resp;               /* RESP protocol version, 2 or 3 (HELLO) */
     redisDb *db;
     int dictid;
     sds querybuf;
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size */
+    size_t qb_pos;          /* Offset of the unprocessed data in querybuf */
     int argc;
     robj **argv;
+    int argv_len;           /* Size of the argv array, reused across commands */
     struct redisCommand *cmd, *lastcmd;
     int reqtype;
     int multibulklen;       /* number of multi bulk arguments left to read */
     long bulklen;           /* length of bulk argument in multi bulk request */
     list *reply;
-    unsigned long reply_bytes; /* Tot bytes of objects in reply list */
+    unsigned long reply_bytes; /* Memory used by the reply list */
+    size_t mem_usage;       /* Client memory in server.clients_mem_usage */
     int sentlen;
     time_t ctime;           /* Client creation time */
     time_t lastinteraction; /* time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
     int flags;              /* REDIS_SLAVE | REDIS_MONITOR | REDIS_MULTI ... */
-    int slaveseldb;         /* slave selected db, if this client is a slave */
     int authenticated;      /* when requirepass is non-NULL */
     int replstate;          /* replication state if this is a slave */
     int repldbfd;           /* replication DB file descriptor */
     long repldboff;         /* replication DB file offset */
     off_t repldbsize;       /* replication DB file size */
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
+    long long max_staleness; /* READONLY reads bound, in ms. 0 = unbounded. */
+    long long repl_ack_off; /* replication ack offset, if this is a slave */
+    int repl_compression;   /* Stream sent to this slave is compressed */
+    sds repl_frame;         /* Compressed frame being sent to this slave */
+    size_t repl_frame_pos;  /* Bytes of repl_frame already sent */
+    time_t repl_ack_time;   /* replication ack time, if this is a slave */
     multiState mstate;      /* MULTI/EXEC state */
+    int btype;              /* Type of blocking op if REDIS_BLOCKED. */
     blockingState bpop;   /* blocking state */
     list *io_keys;          /* Keys this client is waiting to be loaded from the
                              * swap file in order to continue. */
@@ -441,12 +504,14 @@ typedef struct redisOpArray {
  * Redis cluster data structures
  *----------------------------------------------------------------------------*/
 
-#define REDIS_CLUSTER_SLOTS 4096
 #define REDIS_CLUSTER_OK 0          /* Everything looks ok */
 #define REDIS_CLUSTER_FAIL 1        /* The cluster can't work */
 #define REDIS_CLUSTER_NEEDHELP 2    /* The cluster works, but needs some help */
 #define REDIS_CLUSTER_NAMELEN 40    /* sha1 hex length */
 #define REDIS_CLUSTER_PORT_INCR 10000 /* Cluster port = baseport + PORT_INCR */
+#define REDIS_MIGRATE_SOCKET_CACHE_ITEMS 64 /* Max cached MIGRATE connections */
+#define REDIS_MIGRATE_SOCKET_TTL 10 /* Close idle MIGRATE connections (sec) */
+#define REDIS_CLUSTER_MIN_GOSSIP 3  /* Min nodes in the PING gossip section */
 
 struct clusterNode;
 
@@ -456,6 +521,7 @@ typedef struct clusterLink {
     sds sndbuf;                 /* Packet send buffer */
     sds rcvbuf;                 /* Packet reception buffer */
     struct clusterNode *node;   /* Node related to this link if any, or NULL */
+    uint64_t peer_slots_digest; /* Digest of our slots as known by the peer */
 } clusterLink;
 
 /* Node flags */
@@ -480,7 +546,7 @@ struct clusterNode {
     time_t pong_received;   /* Unix time we received the pong */
     char *configdigest;         /* Configuration digest of this node */
     time_t configdigest_ts;     /* Configuration digest timestamp */
-    char ip[16];                /* Latest known IP address of this node */
+    char ip[REDIS_IP_STR_LEN];  /* Latest known IP address of this node */
     int port;                   /* Latest known port of this node */
     clusterLink *link;          /* TCP/IP link with this node */
 };
@@ -495,7 +561,10 @@ typedef struct {
     clusterNode *migrating_slots_to[REDIS_CLUSTER_SLOTS];
     clusterNode *importing_slots_from[REDIS_CLUSTER_SLOTS];
     clusterNode *slots[REDIS_CLUSTER_SLOTS];
-    zskiplist *slots_to_keys;
+    dict *slots_to_keys[REDIS_CLUSTER_SLOTS]; /* Keys of every slot */
+    int todo_save_config; /* Config changed, save it before sleeping */
+    int save_config_err;  /* Set by the bio thread if saving failed */
+    int save_config_errno; /* errno of the failed save */
 } clusterState;
 
 /* Redis cluster messages header */
@@ -517,7 +586,7 @@ typedef struct {
     char nodename[REDIS_CLUSTER_NAMELEN];
     uint32_t ping_sent;
     uint32_t pong_received;
-    char ip[16];    /* IP address last time it was seen */
+    char ip[REDIS_IP_STR_LEN]; /* IP address last time it was seen */
     uint16_t port;  /* port last time it was seen */
     uint16_t flags;
     uint32_t notused; /* for 64 bit alignment */
@@ -527,6 +596,19 @@ typedef struct {
     char nodename[REDIS_CLUSTER_NAMELEN];
 } clusterMsgDataFail;
 
+/* Slots of the sender, appended to PONG packets after the gossip section
+ * only if the receiver does not already know them. Usually a master serves
+ * a few contiguous ranges of slots, so a list of ranges is sent, unless the
+ * bitmap is smaller. */
+#define CLUSTERMSG_SLOTS_NONE 0     /* Slots unchanged, nothing appended */
+#define CLUSTERMSG_SLOTS_RANGES 1   /* 'slots_count' clusterMsgSlotRange */
+#define CLUSTERMSG_SLOTS_BITMAP 2   /* REDIS_CLUSTER_SLOTS/8 bytes bitmap */
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;       /* Inclusive */
+} clusterMsgSlotRange;
+
 typedef struct {
     uint32_t channel_len;
     uint32_t message_len;
@@ -556,12 +638,16 @@ typedef struct {
     uint16_t type;      /* Message type */
     uint16_t count;     /* Only used for some kind of messages. */
     char sender[REDIS_CLUSTER_NAMELEN]; /* Name of the sender node */
-    unsigned char myslots[REDIS_CLUSTER_SLOTS/8];
     char slaveof[REDIS_CLUSTER_NAMELEN];
     char configdigest[32];
+    uint64_t slots_digest; /* PING and MEET: CRC64 of the receiver slots as
+                              known by the sender, so that the PONG can omit
+                              them if they are unchanged. */
     uint16_t port;      /* Sender TCP base port */
     unsigned char state; /* Cluster state from the POV of the sender */
-    unsigned char notused[5]; /* Reserved for future use. For alignment. */
+    unsigned char slots_encoding; /* PONG: CLUSTERMSG_SLOTS_... */
+    uint16_t slots_count; /* Number of ranges with CLUSTERMSG_SLOTS_RANGES */
+    unsigned char notused[2]; /* Reserved for future use. For alignment. */
     union clusterMsgData data;
 } clusterMsg;
 
@@ -586,15 +672,34 @@ struct redisServer {
     int sentinel_mode;          /* True if this instance is a Sentinel. */
     /* Networking */
     int port;                   /* TCP listening port */
-    char *bindaddr;             /* Bind address or NULL */
+    char *bindaddr[REDIS_BINDADDR_MAX]; /* Addresses we should bind to */
+    int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd;                   /* TCP socket file descriptor */
+    int tcp_reuseport;          /* Listen using SO_REUSEPORT */
+    int ipfd[REDIS_BINDADDR_MAX]; /* TCP socket file descriptors */
+    int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
-    int cfd;                    /* Cluster bus lisetning socket */
+    int cfd[REDIS_BINDADDR_MAX];/* Cluster bus listening socket */
+    int cfd_count;              /* Used slots in cfd[] */
     list *clients;              /* List of active clients */
+    unsigned long next_client_id; /* Next client unique ID */
+    sds shared_querybuf;        /* Query buffer used to read from clients */
+    redisClient *reading_client; /* Client processing the input just read,
+                                    set to NULL if freed meanwhile. */
+    robj **reply_pool;          /* Free reply blocks shared by all clients */
+    unsigned long reply_pool_len;     /* Number of blocks in the pool */
+    unsigned long reply_pool_min_len; /* Min pool length since last cron */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
+    robj *repl_block;           /* Reply block shared by the slaves, where the
+                                   replication stream is appended. */
+    int slaveseldb;             /* Last SELECTed DB in replication stream */
+    long long master_repl_offset; /* Bytes fed to the replication stream */
+    sds repl_proxy_pending;     /* Stream received from our master, still
+                                   to proxy to our slaves. */
+    sds repl_comp_pending;      /* Stream still to compress for the slaves
+                                   using a compressed link. */
     redisClient *current_client; /* Current client, only used on crash report */
     char neterr[ANET_ERR_LEN];  /* Error buffer for anet.c */
     /* RDB / AOF loading information */
@@ -610,11 +715,22 @@ struct redisServer {
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedclients;  /* Clients closed for maxmemory-clients */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latets fork() */
+    size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
+    size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
+    long long stat_reply_pool_hits;   /* Reply blocks taken from the pool */
+    long long stat_reply_pool_misses; /* Reply blocks allocated */
+    long long stat_repl_comp_in;    /* Stream bytes compressed for slaves */
+    long long stat_repl_comp_out;   /* Compressed bytes sent to slaves */
+    long long stat_repl_comp_usec;  /* CPU time used to compress */
+    long long stat_repl_decomp_in;  /* Compressed bytes received from master */
+    long long stat_repl_decomp_out; /* Bytes they were decompressed to */
+    long long stat_repl_decomp_usec; /* CPU time used to decompress */
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -662,11 +778,33 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_key_index;              /* Append a key index to the RDB file? */
+    off_t rdb_save_fsync_bytes;     /* fsync() the RDB every N bytes, 0 = off. */
+    int rdb_save_drop_cache;        /* Drop the saved RDB from page cache. */
+    long long rdb_save_rate_limit;  /* Max BGSAVE write speed, bytes/sec. */
+    uint64_t rdb_save_cksum;        /* Checksum of the last RDB file saved. */
+    int rdb_child_type;             /* REDIS_RDB_CHILD_TYPE_* */
+    uint64_t rdb_child_cksum;       /* Checksum received from the child. */
+    int rdb_child_cksum_received;   /* True if rdb_child_cksum is valid. */
+    int rdb_delta_tracking;         /* Track keys modified since last save. */
+    int rdb_delta_need_full;        /* A full save is needed before a delta. */
+    uint64_t rdb_delta_base_cksum;  /* Checksum of the base of the deltas. */
+    long long rdb_delta_seq;        /* Sequence number of the last delta. */
+    long long rdb_child_delta_seq;  /* Sequence of the delta being saved. */
+    uint64_t rdb_child_delta_base;  /* Base of the delta being saved. */
     time_t lastsave;                /* Unix time of last save succeeede */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
     time_t rdb_save_time_start;     /* Current RDB save start time. */
     int lastbgsave_status;          /* REDIS_OK or REDIS_ERR */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
+    /* Pipe and data structures for child -> parent info sharing. */
+    int child_info_pipe[2];         /* Pipe used to write the child_info_data. */
+    struct {
+        int process_type;           /* REDIS_CHILD_INFO_TYPE_* */
+        size_t cow_size;            /* Copy on write size. */
+        unsigned long long rdb_cksum; /* Checksum of the RDB file saved. */
+        unsigned long long magic;   /* Magic value to make sure data is valid. */
+    } child_info_data;
     /* Propagation of commands in AOF / replication */
     redisOpArray also_propagate;    /* Additional command to propagate. */
     /* Logging */
@@ -692,16 +830,33 @@ struct redisServer {
     time_t repl_transfer_lastio; /* Unix time of the latest read, for timeout */
     int repl_serve_stale_data; /* Serve stale data when link is down? */
     int repl_slave_ro;          /* Slave is read only? */
+    int repl_compression;       /* Use a LZF compressed replication link? */
+    int repl_transfer_compressed; /* Link with our master is compressed */
+    int slave_reader_thread;    /* Read the master stream in a thread? */
+    sds repl_transfer_frame;    /* Compressed frame being read from master */
     time_t repl_down_since; /* Unix time at which link with master went down */
+    long long slave_repl_read;  /* Stream bytes read from the current master */
+    long long slave_repl_base;  /* Master offset of the first byte read */
+    long long slave_repl_data_time; /* Master time of our data (ms), 0 if
+                                       no heartbeat was received yet. */
     int slave_priority;             /* Reported in INFO and used by Sentinel. */
     /* Limits */
     unsigned int maxclients;        /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key evition */
     int maxmemory_samples;          /* Pricision of random sampling */
+    unsigned long long maxmemory_clients; /* Max memory used by all clients */
+    int maxmemory_clients_policy;   /* Close clients before evicting keys? */
+    size_t clients_mem_usage;       /* Memory used by all the normal clients */
+    unsigned long clients_big_mem;  /* Normal clients using at least
+                                       REDIS_MAXMEMORY_CLIENTS_MIN_USAGE */
     /* Blocked clients */
-    unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
+    unsigned int bpop_blocked_clients; /* Number of clients blocked by lists
+                                          or by WAIT */
     list *unblocked_clients; /* list of clients to unblock before next loop */
+    list *clients_waiting_acks; /* Clients waiting in WAIT command. */
+    int get_ack_from_slaves;    /* If true, ask the slaves for an ACK in
+                                   beforeSleep(). */
     /* Sort parameters - qsort_r() is only available under BSD so we
      * have to take this state global, in order to pass it to sortCompare() */
     int sort_dontsort;
@@ -717,12 +872,20 @@ struct redisServer {
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     time_t unixtime;        /* Unix time sampled every second. */
+    /* Client side caching */
+    dict *tracking_table;       /* Key -> set of IDs of clients caching it */
+    dict *tracking_clients;     /* ID -> client, clients with tracking on */
+    unsigned long tracking_table_max_keys; /* Max keys in tracking_table */
+    list *tracking_pending_keys; /* Invalidations for the current client */
+    int tracking_pending_flush; /* Flush invalidation for current client */
+    unsigned long tracking_pending_id; /* Client of the pending messages */
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
     list *pubsub_patterns;  /* A list of pubsub_patterns */
     /* Cluster */
     int cluster_enabled;    /* Is cluster enabled? */
     clusterState cluster;   /* State of the cluster */
+    dict *migrate_cached_sockets; /* MIGRATE cached sockets, by host:port */
     /* Scripting */
     lua_State *lua; /* The Lua interpreter. We use just one for all clients */
     redisClient *lua_client;   /* The "fake client" to query Redis from Lua */
@@ -836,6 +999,10 @@ extern struct sharedObjectsStruct shared;
 extern dictType setDictType;
 extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
+extern dictType migrateCacheDictType;
+extern dictType slotToKeyDictType;
+extern dictType clientIdDictType;
+extern dictType trackingTableDictType;
 extern dictType dbDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
@@ -856,7 +1023,11 @@ redisClient *createClient(int fd);
 void closeTimedoutClients(void);
 void freeClient(redisClient *c);
 void resetClient(redisClient *c);
+void parserBenchmark(char *filename, int iterations);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void processEventsWhileBlocked(void);
+int clientHasPendingReplies(redisClient *c);
+int prepareClientToWrite(redisClient *c);
 void addReply(redisClient *c, robj *obj);
 void *addDeferredMultiBulkLength(redisClient *c);
 void setDeferredMultiBulkLength(redisClient *c, void *node, long length);
@@ -877,15 +1048,30 @@ void addReplyStatus(redisClient *c, char *status);
 void addReplyDouble(redisClient *c, double d);
 void addReplyLongLong(redisClient *c, long long ll);
 void addReplyMultiBulkLen(redisClient *c, long length);
+void addReplyMapLen(redisClient *c, long length);
+void addReplyPushLen(redisClient *c, long length);
+void addReplyNull(redisClient *c);
 void copyClientOutputBuffer(redisClient *dst, redisClient *src);
+void releaseReplyObject(void *o);
+robj *createReplyBlock(void);
+void addReplySharedBlock(redisClient *c, robj *block);
+size_t replyPoolRetainedBytes(void);
+void replyPoolCron(void);
 void *dupClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 sds getClientInfoString(redisClient *client);
 sds getAllClientsInfoString(void);
 void rewriteClientCommandVector(redisClient *c, int argc, ...);
+void replaceClientCommandVector(redisClient *c, int argc, robj **argv);
 void rewriteClientCommandArgument(redisClient *c, int i, robj *newval);
 unsigned long getClientOutputBufferMemoryUsage(redisClient *c);
+size_t getClientMemoryUsage(redisClient *c);
+void updateClientMemUsage(redisClient *c);
+void evictClientsIfNeeded(void);
+size_t freeClientsMemory(size_t tofree, size_t min_usage, char *reason);
+int listenToPort(int port, int *fds, int *count);
+void closeListeningSockets(void);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(redisClient *c);
 int getClientLimitClassByName(char *name);
@@ -976,6 +1162,23 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
 void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr);
 void replicationCron(void);
+void replicationFeedHeartbeat(void);
+long long replicationGetSlaveOffset(void);
+long long replicationGetSlaveLag(void);
+void replicationSendAck(void);
+void replicationProxyMasterStream(int dictid, int newdictid);
+void replicationFlushCompressedStream(void);
+void replicationStopReaderThread(void);
+int replicationReaderThreadActive(void);
+size_t replicationReaderThreadPending(void);
+void processClientsWaitingReplicas(void);
+void unblockClientWaitingReplicas(redisClient *c);
+
+/* Child info */
+void openChildInfoPipe(void);
+void closeChildInfoPipe(void);
+void sendChildInfo(int process_type, size_t cow_size);
+void receiveChildInfo(void);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
@@ -996,6 +1199,7 @@ int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
 void aofRewriteBufferReset(void);
 unsigned long aofRewriteBufferSize(void);
+sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv);
 
 /* Sorted sets data type */
 
@@ -1019,6 +1223,7 @@ void zsetConvert(robj *zobj, int encoding);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+size_t getMaxmemoryUsedMemory(void);
 int processCommand(redisClient *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1073,6 +1278,14 @@ robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key);
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(redisClient *c, int notify);
 int pubsubUnsubscribeAllPatterns(redisClient *c, int notify);
+/* Keys tracking for client side caching */
+void enableTracking(redisClient *c);
+void disableTracking(redisClient *c);
+void trackingRememberKey(redisClient *c, robj *key);
+void trackingInvalidateKey(robj *key);
+void trackingInvalidateAll(void);
+void trackingHandlePendingKeys(void);
+
 void freePubsubPattern(void *p);
 int listMatchPubsubPattern(void *a, void *b);
 int pubsubPublishMessage(robj *channel, robj *message);
@@ -1103,7 +1316,8 @@ long long emptyDb();
 int selectDb(redisClient *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
-unsigned int GetKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
+unsigned int GetKeysInSlot(unsigned int hashslot, sds *keys, unsigned int count);
+unsigned int CountKeysInSlot(unsigned int hashslot);
 
 /* API to get key arguments from commands */
 #define REDIS_GETKEYS_ALL 0
@@ -1116,13 +1330,16 @@ int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *num
 
 /* Cluster */
 void clusterInit(void);
-unsigned short crc16(const char *buf, int len);
-unsigned int keyHashSlot(char *key, int keylen);
 clusterNode *createClusterNode(char *nodename, int flags);
 int clusterAddNode(clusterNode *node);
 void clusterCron(void);
+void clusterBeforeSleep(void);
+void clusterSaveConfigLater(void);
+void clusterWriteConfigFile(char *filename, sds config);
+void clusterFlushConfig(void);
 clusterNode *getNodeByQuery(redisClient *c, struct redisCommand *cmd, robj **argv, int argc, int *hashslot, int *ask);
 void clusterPropagatePublish(robj *channel, robj *message);
+void migrateCloseTimedoutSockets(void);
 
 /* Sentinel */
 void initSentinelConfig(void);
@@ -1140,6 +1357,7 @@ char *redisGitDirty(void);
 /* Commands prototypes */
 void authCommand(redisClient *c);
 void pingCommand(redisClient *c);
+void helloCommand(redisClient *c);
 void echoCommand(redisClient *c);
 void setCommand(redisClient *c);
 void setnxCommand(redisClient *c);
@@ -1275,6 +1493,9 @@ void timeCommand(redisClient *c);
 void bitopCommand(redisClient *c);
 void bitcountCommand(redisClient *c);
 void replconfCommand(redisClient *c);
+void readonlyCommand(redisClient *c);
+void readwriteCommand(redisClient *c);
+void waitCommand(redisClient *c);
 
 #if defined(__GNUC__)
 void *calloc(size_t count, size_t size) __attribute__ ((deprecated));
@@ -0,0 +1,2 @@
+#define REDIS_GIT_SHA1 "cca98ba4"
+#define REDIS_GIT_DIRTY "190"
@@ -1,53 +1,655 @@
 #include "redis.h"
+#include "lzf.h"
+#include "endianconv.h"
 
 #include <sys/time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <pthread.h>
 
 /* ---------------------------------- MASTER -------------------------------- */
 
-void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
+/* Slaves waiting for a BGSAVE to start don't receive the replication stream:
+ * their initial state will be the one of the next RDB file. */
+#define slaveNeedsStream(slave) \
+    ((slave)->replstate != REDIS_REPL_WAIT_BGSAVE_START)
+#define slaveNeedsPlainStream(slave) \
+    (slaveNeedsStream(slave) && !(slave)->repl_compression)
+
+/* ----------------------- COMPRESSED REPLICATION LINK ---------------------- */
+
+/* When a slave asks for it with REPLCONF COMPRESSION LZF, the RDB payload
+ * and the replication stream are sent to the slave as a sequence of frames:
+ *
+ *  <data length> <compressed length> <payload>
+ *
+ * The two lengths are 32 bit little endian integers. The data length is
+ * at most REDIS_REPL_FRAME_LEN bytes, and a compressed length of zero means
+ * that the data did not compress, so the payload is the data itself. The
+ * "$<count>\r\n" line announcing the RDB payload is not framed, and the
+ * count is the size of the uncompressed file. */
+#define REDIS_REPL_FRAME_HDR 8
+
+/* Return the total length of the frame starting with the header 'hdr', or
+ * -1 if the header is not valid. */
+static ssize_t replFrameLen(char *hdr) {
+    uint32_t rawlen, complen;
+
+    memcpy(&rawlen,hdr,4);
+    memcpy(&complen,hdr+4,4);
+    rawlen = intrev32ifbe(rawlen);
+    complen = intrev32ifbe(complen);
+    if (rawlen == 0 || rawlen > REDIS_REPL_FRAME_LEN || complen >= rawlen)
+        return -1;
+    return REDIS_REPL_FRAME_HDR+(complen ? complen : rawlen);
+}
+
+/* Append to 'frames' the frames encoding 'len' bytes at 'p'. */
+static sds replEncodeFrames(sds frames, char *p, size_t len) {
+    long long start = ustime();
+    size_t origlen = sdslen(frames);
+
+    server.stat_repl_comp_in += len;
+    while(len) {
+        uint32_t rawlen = (len > REDIS_REPL_FRAME_LEN) ?
+                          REDIS_REPL_FRAME_LEN : len;
+        uint32_t complen, hdr[2];
+        char *payload;
+
+        frames = sdsMakeRoomFor(frames,REDIS_REPL_FRAME_HDR+rawlen);
+        payload = frames+sdslen(frames)+REDIS_REPL_FRAME_HDR;
+        complen = lzf_compress(p,rawlen,payload,rawlen-1);
+        if (complen == 0) memcpy(payload,p,rawlen);
+        hdr[0] = intrev32ifbe(rawlen);
+        hdr[1] = intrev32ifbe(complen);
+        memcpy(frames+sdslen(frames),hdr,REDIS_REPL_FRAME_HDR);
+        sdsIncrLen(frames,REDIS_REPL_FRAME_HDR+(complen ? complen : rawlen));
+        p += rawlen;
+        len -= rawlen;
+    }
+    server.stat_repl_comp_out += sdslen(frames)-origlen;
+    server.stat_repl_comp_usec += ustime()-start;
+    return frames;
+}
+
+/* Decode the complete frames at the start of '*frames', appending the data
+ * to '*out'. The decoded frames are removed from '*frames'. REDIS_ERR is
+ * returned if a corrupted frame is found.
+ *
+ * The bytes decoded, the bytes produced and the time used are added to the
+ * counters 'inbytes', 'outbytes' and 'usec': this is also called by the
+ * thread reading the stream, that can't update the server stats. */
+static int replDecodeFrames(sds *frames, sds *out, long long *inbytes,
+                            long long *outbytes, long long *usec)
+{
+    long long start = ustime();
+    size_t pos = 0, len = sdslen(*frames);
+    int retval = REDIS_OK;
+
+    while(len-pos >= REDIS_REPL_FRAME_HDR) {
+        char *hdr = *frames+pos;
+        ssize_t framelen = replFrameLen(hdr);
+        uint32_t rawlen;
+
+        if (framelen == -1) {
+            retval = REDIS_ERR;
+            break;
+        }
+        if (len-pos < (size_t)framelen) break;
+
+        memcpy(&rawlen,hdr,4);
+        rawlen = intrev32ifbe(rawlen);
+        *out = sdsMakeRoomFor(*out,rawlen);
+        if (framelen-REDIS_REPL_FRAME_HDR == (ssize_t)rawlen) {
+            memcpy(*out+sdslen(*out),hdr+REDIS_REPL_FRAME_HDR,rawlen);
+        } else if (lzf_decompress(hdr+REDIS_REPL_FRAME_HDR,
+                                  framelen-REDIS_REPL_FRAME_HDR,
+                                  *out+sdslen(*out),rawlen) != rawlen)
+        {
+            retval = REDIS_ERR;
+            break;
+        }
+        sdsIncrLen(*out,rawlen);
+        *inbytes += framelen;
+        *outbytes += rawlen;
+        pos += framelen;
+    }
+    if (pos) *frames = sdsrange(*frames,pos,-1);
+    *usec += ustime()-start;
+    return retval;
+}
+
+/* Compress the stream accumulated for the slaves using a compressed link,
+ * and append the frames to their output buffers. The frames are produced
+ * once for all these slaves.
+ *
+ * This is called before sleeping, so that all the stream produced in an
+ * event loop iteration is compressed together, and every time the set of
+ * slaves receiving the stream is going to change. */
+void replicationFlushCompressedStream(void) {
+    sds pending = server.repl_comp_pending;
+    robj *frames;
+    listNode *ln;
+    listIter li;
+
+    if (sdslen(pending) == 0) return;
+    frames = createObject(REDIS_STRING,
+        replEncodeFrames(sdsempty(),pending,sdslen(pending)));
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (slaveNeedsStream(slave) && slave->repl_compression)
+            addReply(slave,frames);
+    }
+    decrRefCount(frames);
+
+    if (sdsAllocSize(pending) > REDIS_REPL_FRAME_LEN) {
+        sdsfree(pending);
+        server.repl_comp_pending = sdsempty();
+    } else {
+        sdsclear(pending);
+    }
+}
+
+/* Read from the master the next frame of the compressed RDB payload into
+ * server.repl_transfer_frame. No more than the frame is read, so that the
+ * stream following the payload is left in the socket. Returns -1 on error,
+ * 0 if the frame is still incomplete, 1 once it is complete. */
+static int replReadBulkFrame(int fd) {
+    sds frame = server.repl_transfer_frame;
+    size_t have = sdslen(frame), need;
+    ssize_t framelen = REDIS_REPL_FRAME_HDR, nread;
+
+    if (have >= REDIS_REPL_FRAME_HDR &&
+        (framelen = replFrameLen(frame)) == -1) return -1;
+    need = framelen-have;
+    frame = server.repl_transfer_frame = sdsMakeRoomFor(frame,need);
+    nread = read(fd,frame+have,need);
+    if (nread <= 0) return -1;
+    sdsIncrLen(frame,nread);
+    have += nread;
+    if (have < REDIS_REPL_FRAME_HDR) return 0;
+    if ((framelen = replFrameLen(frame)) == -1) return -1;
+    return have == (size_t)framelen;
+}
+
+/* Process the 'nread' bytes of stream just appended to the query buffer of
+ * our master. */
+static void processMasterInput(redisClient *c, size_t nread) {
+    server.slave_repl_read += nread;
+    c->lastinteraction = server.unixtime;
+    server.current_client = c;
+    processInputBuffer(c);
+    server.current_client = NULL;
+}
+
+/* Readable handler of our master when the link is compressed: the frames
+ * are decoded into the query buffer, and processed as usually. */
+static void readCompressedStreamFromMaster(aeEventLoop *el, int fd,
+                                           void *privdata, int mask)
+{
+    redisClient *c = privdata;
+    size_t qblen = sdslen(c->querybuf);
+    ssize_t nread;
+    sds frames;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    frames = sdsMakeRoomFor(server.repl_transfer_frame,REDIS_IOBUF_LEN);
+    server.repl_transfer_frame = frames;
+    nread = read(fd,frames+sdslen(frames),REDIS_IOBUF_LEN);
+    if (nread == -1) {
+        if (errno == EAGAIN) return;
+        redisLog(REDIS_VERBOSE,"Reading from MASTER: %s",strerror(errno));
+        freeClient(c);
+        return;
+    } else if (nread == 0) {
+        redisLog(REDIS_VERBOSE,"MASTER closed connection");
+        freeClient(c);
+        return;
+    }
+    sdsIncrLen(frames,nread);
+
+    if (replDecodeFrames(&server.repl_transfer_frame,&c->querybuf,
+            &server.stat_repl_decomp_in,&server.stat_repl_decomp_out,
+            &server.stat_repl_decomp_usec) == REDIS_ERR)
+    {
+        redisLog(REDIS_WARNING,"Corrupted compressed frame from MASTER");
+        freeClient(c);
+        return;
+    }
+    processMasterInput(c,sdslen(c->querybuf)-qblen);
+}
+
+/* ------------------------- MASTER STREAM READER THREAD -------------------- */
+
+/* With slave-reader-thread enabled the socket of our master is read by a
+ * thread, that also decodes the frames of a compressed link, while the main
+ * thread only executes the commands. This way the socket is drained even
+ * while the main thread is busy applying a burst of writes: the backlog is
+ * kept in our memory instead of growing the output buffer of the master,
+ * where it could reach the client-output-buffer-limit of the slaves.
+ *
+ * The thread appends the stream to replReader.data, and writes a byte in
+ * the notification pipe every time data is added to an empty buffer. When
+ * the pipe is readable the main thread processes at most REDIS_IOBUF_LEN
+ * bytes, like when reading the socket itself, so that a big backlog can't
+ * block the event loop: if more data is waiting it writes in the pipe again
+ * to be called at the next iteration. Once more than
+ * REDIS_REPL_READAHEAD_MAX bytes are waiting the thread stops reading,
+ * leaving the master to deal with the backlog as usually. */
+#define REDIS_REPL_READAHEAD_MAX (1024*1024*256)
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t consumed;    /* Signaled when the main thread took data. */
+    int active;                 /* Is the thread running? */
+    int fd;                     /* Socket of our master. */
+    int notify[2];              /* Thread -> main thread notification pipe. */
+    int compressed;             /* Decode frames of a compressed link? */
+    /* The following fields are protected by 'lock'. */
+    sds data;                   /* Stream read by the thread. */
+    size_t pos;                 /* Bytes of 'data' taken by the main thread. */
+    int eof;                    /* Connection closed or error. */
+    int stop;                   /* Main thread asks the thread to exit. */
+    long long decomp_in, decomp_out, decomp_usec; /* Decompression stats. */
+} replReader;
+
+static void *replReaderThreadMain(void *arg) {
+    char buf[REDIS_IOBUF_LEN];
+    sds frames = sdsempty(), decoded = sdsempty();
+    long long in = 0, out = 0, usec = 0;
+    REDIS_NOTUSED(arg);
+
+    while(1) {
+        struct pollfd pfd;
+        ssize_t nread;
+        char *p = buf;
+        size_t len;
+        int eof = 0;
+
+        pthread_mutex_lock(&replReader.lock);
+        while(!replReader.stop &&
+              sdslen(replReader.data)-replReader.pos >=
+                REDIS_REPL_READAHEAD_MAX)
+            pthread_cond_wait(&replReader.consumed,&replReader.lock);
+        if (replReader.stop) {
+            pthread_mutex_unlock(&replReader.lock);
+            break;
+        }
+        pthread_mutex_unlock(&replReader.lock);
+
+        /* The socket is non blocking: wait for data. The main thread uses
+         * shutdown(2) to wake us up when we have to exit. */
+        pfd.fd = replReader.fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd,1,-1) == -1 && errno != EINTR) eof = 1;
+
+        nread = eof ? 0 : read(replReader.fd,buf,sizeof(buf));
+        if (nread == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (nread <= 0) eof = 1;
+        len = eof ? 0 : (size_t)nread;
+
+        if (!eof && replReader.compressed) {
+            frames = sdscatlen(frames,buf,nread);
+            if (replDecodeFrames(&frames,&decoded,&in,&out,&usec)
+                == REDIS_ERR) eof = 1;
+            p = decoded;
+            len = sdslen(decoded);
+        }
+
+        pthread_mutex_lock(&replReader.lock);
+        if (len) {
+            if (sdslen(replReader.data) == replReader.pos &&
+                write(replReader.notify[1],"x",1) != 1)
+            {
+                /* The pipe is full: the main thread will read anyway. */
+            }
+            replReader.data = sdscatlen(replReader.data,p,len);
+        }
+        replReader.decomp_in += in;
+        replReader.decomp_out += out;
+        replReader.decomp_usec += usec;
+        in = out = usec = 0;
+        if (eof) {
+            replReader.eof = 1;
+            if (write(replReader.notify[1],"x",1) != 1) {
+                /* Nothing to do, see above. */
+            }
+        }
+        pthread_mutex_unlock(&replReader.lock);
+        sdsclear(decoded);
+        if (eof) break;
+    }
+    sdsfree(frames);
+    sdsfree(decoded);
+    return NULL;
+}
+
+/* Readable handler of the notification pipe: take a chunk of the stream
+ * read by the thread and process it. */
+static void replReaderNotified(aeEventLoop *el, int fd, void *privdata,
+                               int mask)
+{
+    redisClient *c = server.master;
+    char tmp[64];
+    size_t len, left;
+    int eof;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(privdata);
+    REDIS_NOTUSED(mask);
+
+    while(read(fd,tmp,sizeof(tmp)) > 0);
+    pthread_mutex_lock(&replReader.lock);
+    len = sdslen(replReader.data)-replReader.pos;
+    if (len > REDIS_IOBUF_LEN) len = REDIS_IOBUF_LEN;
+    if (c && len)
+        c->querybuf = sdscatlen(c->querybuf,replReader.data+replReader.pos,len);
+    replReader.pos += len;
+    left = sdslen(replReader.data)-replReader.pos;
+    /* Discard the consumed part once it is the biggest, so that the cost
+     * of moving the data left is amortized. */
+    if (left == 0) {
+        sdsclear(replReader.data);
+        replReader.pos = 0;
+    } else if (replReader.pos > left) {
+        sdsrange(replReader.data,replReader.pos,-1);
+        replReader.pos = 0;
+    }
+    eof = replReader.eof;
+    server.stat_repl_decomp_in += replReader.decomp_in;
+    server.stat_repl_decomp_out += replReader.decomp_out;
+    server.stat_repl_decomp_usec += replReader.decomp_usec;
+    replReader.decomp_in = replReader.decomp_out = 0;
+    replReader.decomp_usec = 0;
+    pthread_cond_signal(&replReader.consumed);
+    pthread_mutex_unlock(&replReader.lock);
+
+    /* More data is waiting: make sure we are called again. */
+    if (left && write(replReader.notify[1],"x",1) != 1) {
+        /* The pipe is full: we'll be called again anyway. */
+    }
+    if (c == NULL) return;
+    if (len) processMasterInput(c,len);
+    if (eof && left == 0 && server.master == c) {
+        redisLog(REDIS_NOTICE,"Connection with MASTER lost");
+        freeClient(c);
+    }
+}
+
+/* Start reading the stream of our master 'c' in a thread. On error
+ * REDIS_ERR is returned, and the caller should read the socket from the
+ * main thread as usually. */
+static int replicationStartReaderThread(redisClient *c) {
+    if (pipe(replReader.notify) == -1) return REDIS_ERR;
+    if (anetNonBlock(NULL,replReader.notify[0]) == ANET_ERR ||
+        anetNonBlock(NULL,replReader.notify[1]) == ANET_ERR ||
+        aeCreateFileEvent(server.el,replReader.notify[0],AE_READABLE,
+            replReaderNotified,NULL) == AE_ERR)
+    {
+        close(replReader.notify[0]);
+        close(replReader.notify[1]);
+        return REDIS_ERR;
+    }
+    pthread_mutex_init(&replReader.lock,NULL);
+    pthread_cond_init(&replReader.consumed,NULL);
+    replReader.fd = c->fd;
+    replReader.compressed = server.repl_transfer_compressed;
+    replReader.data = sdsempty();
+    replReader.pos = 0;
+    replReader.eof = replReader.stop = 0;
+    replReader.decomp_in = replReader.decomp_out = 0;
+    replReader.decomp_usec = 0;
+    if (pthread_create(&replReader.thread,NULL,replReaderThreadMain,NULL)
+        != 0)
+    {
+        aeDeleteFileEvent(server.el,replReader.notify[0],AE_READABLE);
+        close(replReader.notify[0]);
+        close(replReader.notify[1]);
+        sdsfree(replReader.data);
+        return REDIS_ERR;
+    }
+    aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+    replReader.active = 1;
+    return REDIS_OK;
+}
+
+/* Stop the thread reading from our master, if any. Called when the master
+ * client is freed, before its socket is closed. The stream read but not
+ * yet processed is discarded, like the query buffer of the client. */
+void replicationStopReaderThread(void) {
+    if (!replReader.active) return;
+    pthread_mutex_lock(&replReader.lock);
+    replReader.stop = 1;
+    pthread_cond_signal(&replReader.consumed);
+    pthread_mutex_unlock(&replReader.lock);
+    shutdown(replReader.fd,SHUT_RDWR);
+    pthread_join(replReader.thread,NULL);
+
+    aeDeleteFileEvent(server.el,replReader.notify[0],AE_READABLE);
+    close(replReader.notify[0]);
+    close(replReader.notify[1]);
+    sdsfree(replReader.data);
+    pthread_mutex_destroy(&replReader.lock);
+    pthread_cond_destroy(&replReader.consumed);
+    replReader.active = 0;
+}
+
+/* Is the stream of our master currently read by the thread? */
+int replicationReaderThreadActive(void) {
+    return replReader.active;
+}
+
+/* Return the number of bytes of the stream read by the thread, and not
+ * yet processed by the main thread. */
+size_t replicationReaderThreadPending(void) {
+    size_t pending;
+
+    if (!replReader.active) return 0;
+    pthread_mutex_lock(&replReader.lock);
+    pending = sdslen(replReader.data)-replReader.pos;
+    pthread_mutex_unlock(&replReader.lock);
+    return pending;
+}
+
+/* ------------------------------ STREAM FEEDING ---------------------------- */
+
+/* Append 'len' bytes to the replication stream.
+ *
+ * The stream is written once in server.repl_block, a reply block that is
+ * referenced by the output buffer of every slave: slaves only hold a
+ * reference to the block and the offset of the data already sent, so the
+ * memory used and the work done to feed them does not grow with the number
+ * of slaves. Data can be appended to the block only while it is the last
+ * object in the output buffer of all the slaves, otherwise (a slave was
+ * just added, or got other replies) a new block is started. Slaves that
+ * already sent the whole block keep it in their output buffer, so they are
+ * still attached to it until it is full. */
+static void replicationFeedStream(list *slaves, char *p, size_t len) {
+    int plain = 0, compressed = 0;
     listNode *ln;
     listIter li;
-    int j;
 
     listRewind(slaves,&li);
     while((ln = listNext(&li))) {
         redisClient *slave = ln->value;
 
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) continue;
+        if (!slaveNeedsStream(slave)) continue;
+        if (slave->repl_compression) compressed++; else plain++;
+    }
+    if (!plain && !compressed) return;
+    server.master_repl_offset += len;
+
+    /* Slaves using a compressed link receive the stream later, see
+     * replicationFlushCompressedStream(). */
+    if (compressed)
+        server.repl_comp_pending = sdscatlen(server.repl_comp_pending,p,len);
+    if (!plain) return;
+
+    while(len) {
+        robj *block = server.repl_block;
+        int attached = 1;
+        size_t n;
+
+        listRewind(slaves,&li);
+        while((ln = listNext(&li))) {
+            redisClient *slave = ln->value;
+
+            if (!slaveNeedsPlainStream(slave)) continue;
+            if (block == NULL || listLength(slave->reply) == 0 ||
+                listNodeValue(listLast(slave->reply)) != block) attached = 0;
+            /* The slave may have sent the whole block already. */
+            else prepareClientToWrite(slave);
+        }
+
+        if (block == NULL || sdsavail(block->ptr) == 0 || !attached) {
+            if (block && block->refcount == 1) {
+                /* Nobody else is referencing the block, reuse it. */
+                sdsclear(block->ptr);
+            } else {
+                if (block) decrRefCount(block);
+                server.repl_block = block = createReplyBlock();
+            }
+            listRewind(slaves,&li);
+            while((ln = listNext(&li))) {
+                redisClient *slave = ln->value;
+
+                if (slaveNeedsPlainStream(slave))
+                    addReplySharedBlock(slave,block);
+            }
+        }
 
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the intial SYNC completes),
-         * or are already in sync with the master. */
-        if (slave->slaveseldb != dictid) {
-            robj *selectcmd;
+        n = sdsavail(block->ptr);
+        if (n > len) n = len;
+        block->ptr = sdscatlen(block->ptr,p,n);
+        p += n;
+        len -= n;
+    }
+}
 
+void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
+    sds cmd = sdsempty();
+    listNode *ln;
+    listIter li;
+
+    listRewind(slaves,&li);
+    while((ln = listNext(&li))) {
+        if (slaveNeedsStream((redisClient*)ln->value)) break;
+    }
+    if (ln == NULL) return;
+
+    /* Emit the SELECT command if the DB is not the one of the last command
+     * sent to the slaves. */
+    if (server.slaveseldb != dictid) {
+        if (dictid >= 0 && dictid < REDIS_SHARED_SELECT_CMDS) {
+            cmd = sdscatlen(cmd,shared.select[dictid]->ptr,
+                            sdslen(shared.select[dictid]->ptr));
+        } else {
+            cmd = sdscatprintf(cmd,"select %d\r\n",dictid);
+        }
+        server.slaveseldb = dictid;
+    }
+
+    /* Encode the command only once for all the slaves. */
+    cmd = catAppendOnlyGenericCommand(cmd,argc,argv);
+    replicationFeedStream(slaves,cmd,sdslen(cmd));
+    sdsfree(cmd);
+}
+
+/* Proxy to our slaves the stream received from our master for the command
+ * just processed, that was accumulated by the query buffer parser.
+ *
+ * The bytes are sent exactly as received, without encoding the command
+ * again: the slaves of a slave cost just a copy of the stream. Heartbeats
+ * and PINGs of the master are proxied as well, so the offsets and the age
+ * of the data of our slaves are the ones of the top level master.
+ *
+ * 'dictid' is the DB the command was executed against, and 'newdictid'
+ * the one selected after its execution (they differ for SELECT): a SELECT
+ * is emitted first if the slaves may have a different DB selected, as it
+ * happens after a new slave attached. */
+void replicationProxyMasterStream(int dictid, int newdictid) {
+    sds pending = server.repl_proxy_pending;
+
+    if (sdslen(pending) == 0) return;
+    if (listLength(server.slaves)) {
+        if (server.slaveseldb != dictid) {
             if (dictid >= 0 && dictid < REDIS_SHARED_SELECT_CMDS) {
-                selectcmd = shared.select[dictid];
-                incrRefCount(selectcmd);
+                sds select = shared.select[dictid]->ptr;
+
+                replicationFeedStream(server.slaves,select,sdslen(select));
             } else {
-                selectcmd = createObject(REDIS_STRING,
-                    sdscatprintf(sdsempty(),"select %d\r\n",dictid));
+                sds select = sdscatprintf(sdsempty(),"select %d\r\n",dictid);
+
+                replicationFeedStream(server.slaves,select,sdslen(select));
+                sdsfree(select);
             }
-            addReply(slave,selectcmd);
-            decrRefCount(selectcmd);
-            slave->slaveseldb = dictid;
         }
-        addReplyMultiBulkLen(slave,argc);
-        for (j = 0; j < argc; j++) addReplyBulk(slave,argv[j]);
+        replicationFeedStream(server.slaves,pending,sdslen(pending));
+        server.slaveseldb = newdictid;
+    }
+
+    /* Don't hold the memory used to proxy a big argument. */
+    if (sdsAllocSize(pending) > REDIS_MBULK_BIG_ARG) {
+        sdsfree(pending);
+        server.repl_proxy_pending = sdsempty();
+    } else {
+        sdsclear(pending);
     }
 }
 
+/* Return the REPLCONF HEARTBEAT <offset> <mstime> command. The offset is the
+ * one of the stream just after the command itself, formatted with a fixed
+ * width so that the length of the command does not depend on it. */
+static sds replicationHeartbeatCommand(long long offset, long long datatime) {
+    char ts[32];
+    int tslen = ll2string(ts,sizeof(ts),datatime);
+
+    return sdscatprintf(sdsempty(),
+        "*4\r\n$8\r\nREPLCONF\r\n$9\r\nHEARTBEAT\r\n"
+        "$20\r\n%020lld\r\n$%d\r\n%s\r\n", offset, tslen, ts);
+}
+
+/* Feed the slaves with an heartbeat carrying the offset of the stream and
+ * the time of the data we are sending. Slaves use it to know how stale
+ * their data is.
+ *
+ * If we are a slave ourselves the heartbeats of our master are proxied to
+ * our slaves, so nothing is sent while the link is up. Otherwise we send
+ * the offset and the time of our own data, so that our slaves still see
+ * the staleness from the top level master growing. */
+void replicationFeedHeartbeat(void) {
+    long long datatime, offset;
+    sds cmd;
+
+    if (server.masterhost) {
+        if (server.repl_state == REDIS_REPL_CONNECTED) return;
+        datatime = server.slave_repl_data_time;
+        offset = replicationGetSlaveOffset();
+    } else {
+        datatime = mstime();
+        cmd = replicationHeartbeatCommand(0,datatime);
+        offset = server.master_repl_offset + sdslen(cmd);
+        sdsfree(cmd);
+    }
+
+    cmd = replicationHeartbeatCommand(offset,datatime);
+    replicationFeedStream(server.slaves,cmd,sdslen(cmd));
+    sdsfree(cmd);
+}
+
 void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **argv, int argc) {
     listNode *ln;
     listIter li;
-    int j, port;
+    int j;
     sds cmdrepr = sdsnew("+");
     robj *cmdobj;
-    char ip[32];
+    char peer[ANET_ADDR_STR_LEN];
     struct timeval tv;
 
     gettimeofday(&tv,NULL);
@@ -55,8 +657,8 @@ void replicationFeedMonitors(redisClient *c, list *monitors, int dictid, robj **
     if (c->flags & REDIS_LUA_CLIENT) {
         cmdrepr = sdscatprintf(cmdrepr,"[%d lua] ", dictid);
     } else {
-        anetPeerToString(c->fd,ip,&port);
-        cmdrepr = sdscatprintf(cmdrepr,"[%d %s:%d] ", dictid,ip,port);
+        anetFormatPeer(c->fd,peer,sizeof(peer));
+        cmdrepr = sdscatprintf(cmdrepr,"[%d %s] ", dictid,peer);
     }
 
     for (j = 0; j < argc; j++) {
@@ -101,6 +703,8 @@ void syncCommand(redisClient *c) {
     }
 
     redisLog(REDIS_NOTICE,"Slave ask for synchronization");
+    /* The slaves receiving the stream are going to change. */
+    replicationFlushCompressedStream();
     /* Here we need to check if there is a background saving operation
      * in progress, or if it is required to start one */
     if (server.rdb_child_pid != -1) {
@@ -114,7 +718,10 @@ void syncCommand(redisClient *c) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             slave = ln->value;
-            if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END) break;
+            /* The output buffer can only be copied from a slave using
+             * the same kind of link. */
+            if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END &&
+                slave->repl_compression == c->repl_compression) break;
         }
         if (ln) {
             /* Perfect, the server is already registering differences for
@@ -137,10 +744,12 @@ void syncCommand(redisClient *c) {
             return;
         }
         c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
+        server.slaveseldb = -1; /* The new slave needs a SELECT first. */
     }
     c->repldbfd = -1;
     c->flags |= REDIS_SLAVE;
-    c->slaveseldb = 0;
+    c->repl_ack_off = 0;
+    c->repl_ack_time = server.unixtime;
     listAddNodeTail(server.slaves,c);
     return;
 }
@@ -156,10 +765,53 @@ void syncCommand(redisClient *c) {
  *
  * In the future the same command can be used in order to configure
  * the replication to initiate an incremental replication instead of a
- * full resync. */
+ * full resync.
+ *
+ * REPLCONF HEARTBEAT <offset> <mstime> is instead sent by the master to
+ * the slaves, as part of the replication stream: see
+ * replicationFeedHeartbeat(). */
 void replconfCommand(redisClient *c) {
     int j;
 
+    if (c->argc == 4 && !strcasecmp(c->argv[1]->ptr,"heartbeat")) {
+        long long offset, datatime;
+        size_t unprocessed;
+
+        if (!(c->flags & REDIS_MASTER)) {
+            addReplyError(c,"REPLCONF HEARTBEAT is only accepted from the master");
+            return;
+        }
+        if (getLongLongFromObject(c->argv[2],&offset) != REDIS_OK ||
+            getLongLongFromObject(c->argv[3],&datatime) != REDIS_OK) return;
+
+        /* The offset is the one just after this command: the bytes still in
+         * the query buffer were not processed yet. */
+        unprocessed = sdslen(c->querybuf)-c->qb_pos;
+        server.slave_repl_base = offset-(server.slave_repl_read-unprocessed);
+        server.slave_repl_data_time = datatime;
+
+        /* Acknowledge the offset to the master right away, so that clients
+         * blocked in WAIT are served within one round trip. */
+        replicationSendAck();
+        return;
+    }
+
+    if (c->argc == 3 && !strcasecmp(c->argv[1]->ptr,"ack")) {
+        long long offset;
+
+        /* REPLCONF ACK is sent by slaves to report the replication offset
+         * they processed. It is never replied, the master is not reading
+         * the slave connection for replies. */
+        if (!(c->flags & REDIS_SLAVE)) {
+            addReplyError(c,"REPLCONF ACK is only accepted from slaves");
+            return;
+        }
+        if (getLongLongFromObject(c->argv[2],&offset) != REDIS_OK) return;
+        if (offset > c->repl_ack_off) c->repl_ack_off = offset;
+        c->repl_ack_time = server.unixtime;
+        return;
+    }
+
     if ((c->argc % 2) == 0) {
         /* Number of arguments must be odd to make sure that every
          * option has a corresponding value. */
@@ -176,6 +828,17 @@ void replconfCommand(redisClient *c) {
                     &port,NULL) != REDIS_OK))
                 return;
             c->slave_listening_port = port;
+        } else if (!strcasecmp(c->argv[j]->ptr,"compression")) {
+            if (strcasecmp(c->argv[j+1]->ptr,"lzf")) {
+                addReplyErrorFormat(c,"Unsupported compression: %s",
+                    (char*)c->argv[j+1]->ptr);
+                return;
+            }
+            if (!server.repl_compression) {
+                addReplyError(c,"Replication link compression is disabled");
+                return;
+            }
+            c->repl_compression = 1;
         } else {
             addReplyErrorFormat(c,"Unrecognized REPLCONF option: %s",
                 (char*)c->argv[j]->ptr);
@@ -209,24 +872,58 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
         sdsfree(bulkcount);
     }
-    lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
-    buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
-    if (buflen <= 0) {
-        redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
-            (buflen == 0) ? "premature EOF" : strerror(errno));
-        freeClient(slave);
-        return;
-    }
-    if ((nwritten = write(fd,buf,buflen)) == -1) {
-        redisLog(REDIS_VERBOSE,"Write error sending DB to slave: %s",
-            strerror(errno));
-        freeClient(slave);
-        return;
+    if (slave->repl_compression) {
+        if (slave->repl_frame == NULL) slave->repl_frame = sdsempty();
+        /* Compressed link: a new chunk of the file is read and encoded
+         * only once the previous frame was completely written. */
+        if (slave->repl_frame_pos == sdslen(slave->repl_frame)) {
+            lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
+            buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
+            if (buflen <= 0) {
+                redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
+                    (buflen == 0) ? "premature EOF" : strerror(errno));
+                freeClient(slave);
+                return;
+            }
+            sdsclear(slave->repl_frame);
+            slave->repl_frame = replEncodeFrames(slave->repl_frame,buf,buflen);
+            slave->repl_frame_pos = 0;
+            slave->repldboff += buflen;
+        }
+        if ((nwritten = write(fd,slave->repl_frame+slave->repl_frame_pos,
+            sdslen(slave->repl_frame)-slave->repl_frame_pos)) == -1)
+        {
+            redisLog(REDIS_VERBOSE,"Write error sending DB to slave: %s",
+                strerror(errno));
+            freeClient(slave);
+            return;
+        }
+        slave->repl_frame_pos += nwritten;
+        if (slave->repl_frame_pos != sdslen(slave->repl_frame)) return;
+    } else {
+        lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
+        buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
+        if (buflen <= 0) {
+            redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
+                (buflen == 0) ? "premature EOF" : strerror(errno));
+            freeClient(slave);
+            return;
+        }
+        if ((nwritten = write(fd,buf,buflen)) == -1) {
+            redisLog(REDIS_VERBOSE,"Write error sending DB to slave: %s",
+                strerror(errno));
+            freeClient(slave);
+            return;
+        }
+        slave->repldboff += nwritten;
     }
-    slave->repldboff += nwritten;
     if (slave->repldboff == slave->repldbsize) {
         close(slave->repldbfd);
         slave->repldbfd = -1;
+        if (slave->repl_frame) {
+            sdsfree(slave->repl_frame);
+            slave->repl_frame = NULL;
+        }
         aeDeleteFileEvent(server.el,slave->fd,AE_WRITABLE);
         slave->replstate = REDIS_REPL_ONLINE;
         if (aeCreateFileEvent(server.el, slave->fd, AE_WRITABLE,
@@ -249,6 +946,8 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
     int startbgsave = 0;
     listIter li;
 
+    /* The slaves receiving the stream are going to change. */
+    replicationFlushCompressedStream();
     listRewind(server.slaves,&li);
     while((ln = listNext(&li))) {
         redisClient *slave = ln->value;
@@ -256,6 +955,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr) {
         if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
             startbgsave = 1;
             slave->replstate = REDIS_REPL_WAIT_BGSAVE_END;
+            server.slaveseldb = -1; /* The new slave needs a SELECT first. */
         } else if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_END) {
             struct redis_stat buf;
 
@@ -307,14 +1007,16 @@ void replicationAbortSyncTransfer(void) {
     close(server.repl_transfer_fd);
     unlink(server.repl_transfer_tmpfile);
     zfree(server.repl_transfer_tmpfile);
+    sdsclear(server.repl_transfer_frame);
     server.repl_state = REDIS_REPL_CONNECT;
 }
 
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
-    char buf[4096];
-    ssize_t nread, readlen;
+    char buf[4096], *p = buf;
+    sds data = NULL;
+    ssize_t nread, nwritten, readlen;
     off_t left;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(privdata);
@@ -354,16 +1056,44 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     /* Read bulk data */
     left = server.repl_transfer_size - server.repl_transfer_read;
-    readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);
-    nread = read(fd,buf,readlen);
-    if (nread <= 0) {
-        redisLog(REDIS_WARNING,"I/O error trying to sync with MASTER: %s",
-            (nread == -1) ? strerror(errno) : "connection lost");
-        replicationAbortSyncTransfer();
-        return;
+    if (server.repl_transfer_compressed) {
+        int ret = replReadBulkFrame(fd);
+
+        if (ret == -1) {
+            redisLog(REDIS_WARNING,
+                "I/O error or bad frame trying to sync with MASTER");
+            replicationAbortSyncTransfer();
+            return;
+        }
+        server.repl_transfer_lastio = server.unixtime;
+        if (ret == 0) return;
+        data = sdsempty();
+        if (replDecodeFrames(&server.repl_transfer_frame,&data,
+                &server.stat_repl_decomp_in,&server.stat_repl_decomp_out,
+                &server.stat_repl_decomp_usec) == REDIS_ERR ||
+            (off_t)sdslen(data) > left)
+        {
+            redisLog(REDIS_WARNING,"Corrupted compressed frame from MASTER");
+            sdsfree(data);
+            replicationAbortSyncTransfer();
+            return;
+        }
+        p = data;
+        nread = sdslen(data);
+    } else {
+        readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);
+        nread = read(fd,buf,readlen);
+        if (nread <= 0) {
+            redisLog(REDIS_WARNING,"I/O error trying to sync with MASTER: %s",
+                (nread == -1) ? strerror(errno) : "connection lost");
+            replicationAbortSyncTransfer();
+            return;
+        }
+        server.repl_transfer_lastio = server.unixtime;
     }
-    server.repl_transfer_lastio = server.unixtime;
-    if (write(server.repl_transfer_fd,buf,nread) != nread) {
+    nwritten = write(server.repl_transfer_fd,p,nread);
+    if (data) sdsfree(data);
+    if (nwritten != nread) {
         redisLog(REDIS_WARNING,"Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
         goto error;
     }
@@ -406,8 +1136,22 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         close(server.repl_transfer_fd);
         server.master = createClient(server.repl_transfer_s);
         server.master->flags |= REDIS_MASTER;
+        if (server.slave_reader_thread &&
+            replicationStartReaderThread(server.master) == REDIS_ERR)
+        {
+            redisLog(REDIS_WARNING,"Can't start the thread reading from MASTER, reading from the main thread");
+        }
+        if (!replReader.active && server.repl_transfer_compressed) {
+            aeDeleteFileEvent(server.el,server.master->fd,AE_READABLE);
+            aeCreateFileEvent(server.el,server.master->fd,AE_READABLE,
+                readCompressedStreamFromMaster,server.master);
+        }
         server.master->authenticated = 1;
         server.repl_state = REDIS_REPL_CONNECTED;
+        server.slave_repl_read = 0;
+        server.slave_repl_base = 0;
+        server.slave_repl_data_time = 0;
+        sdsclear(server.repl_proxy_pending);
         redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
         /* Restart the AOF subsystem now that we finished the sync. This
          * will trigger an AOF rewrite, and when done will start appending
@@ -525,6 +1269,20 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
+    /* Ask for a compressed link if enabled. The master accepts only if
+     * compression is enabled on its side as well. */
+    server.repl_transfer_compressed = 0;
+    sdsclear(server.repl_transfer_frame);
+    if (server.repl_compression) {
+        err = sendSynchronousCommand(fd,"REPLCONF","compression","lzf",NULL);
+        if (err) {
+            redisLog(REDIS_NOTICE,"(non critical): Master refused a compressed link: %s", err);
+            sdsfree(err);
+        } else {
+            server.repl_transfer_compressed = 1;
+        }
+    }
+
     /* Issue the SYNC command */
     if (syncWrite(fd,"SYNC\r\n",6,server.repl_syncio_timeout*1000) == -1) {
         redisLog(REDIS_WARNING,"I/O error writing to MASTER: %s",
@@ -647,6 +1405,181 @@ void slaveofCommand(redisClient *c) {
     addReply(c,shared.ok);
 }
 
+/* Return the offset of the master replication stream processed so far, as
+ * known from the last heartbeat received. */
+long long replicationGetSlaveOffset(void) {
+    long long processed = server.slave_repl_read;
+
+    if (server.master)
+        processed -= sdslen(server.master->querybuf)-server.master->qb_pos;
+    return server.slave_repl_base+processed;
+}
+
+/* Return how old is the data of this slave in milliseconds, that is the
+ * time elapsed since our master (or the top level master of a chain of
+ * slaves) sent the last heartbeat we processed. The clocks of the master
+ * and the slaves should be synchronized, for instance with NTP.
+ *
+ * If no heartbeat was received from the current master -1 is returned. */
+long long replicationGetSlaveLag(void) {
+    long long lag;
+
+    if (server.slave_repl_data_time == 0) return -1;
+    lag = mstime()-server.slave_repl_data_time;
+    return lag < 0 ? 0 : lag;
+}
+
+/* READONLY [max-staleness-ms]
+ *
+ * Declare that the connection is used to scale reads on a slave. If a
+ * staleness bound is given, reads are refused with a -STALE error, that
+ * includes the address of the master, once the data of the slave is older
+ * than the bound. READWRITE reverts the connection to the default mode. */
+void readonlyCommand(redisClient *c) {
+    long long max_staleness = 0;
+
+    if (c->argc > 2) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 2) {
+        if (getLongLongFromObjectOrReply(c,c->argv[1],&max_staleness,NULL)
+            != REDIS_OK) return;
+        if (max_staleness < 0) {
+            addReplyError(c,"max-staleness can't be negative");
+            return;
+        }
+    }
+    c->flags |= REDIS_READONLY;
+    c->max_staleness = max_staleness;
+    addReply(c,shared.ok);
+}
+
+void readwriteCommand(redisClient *c) {
+    c->flags &= ~REDIS_READONLY;
+    c->max_staleness = 0;
+    addReply(c,shared.ok);
+}
+
+/* ------------------ SYNCHRONOUS REPLICATION (WAIT) ------------------------ */
+
+/* Send REPLCONF ACK <offset> to our master. Nothing is sent if we don't
+ * know the master offset yet, since no heartbeat was received so far. */
+void replicationSendAck(void) {
+    redisClient *c = server.master;
+    char buf[32];
+    int len;
+
+    if (c == NULL || server.slave_repl_data_time == 0) return;
+    len = ll2string(buf,sizeof(buf),replicationGetSlaveOffset());
+    c->flags |= REDIS_MASTER_FORCE_REPLY;
+    addReplyMultiBulkLen(c,3);
+    addReplyBulkCString(c,"REPLCONF");
+    addReplyBulkCString(c,"ACK");
+    addReplyBulkCBuffer(c,buf,len);
+    c->flags &= ~REDIS_MASTER_FORCE_REPLY;
+}
+
+/* Return the number of online slaves that acknowledged at least the
+ * specified replication offset. */
+static int replicationCountAcksByOffset(long long offset) {
+    listIter li;
+    listNode *ln;
+    int count = 0;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        redisClient *slave = ln->value;
+
+        if (slave->replstate != REDIS_REPL_ONLINE) continue;
+        if (slave->repl_ack_off >= offset) count++;
+    }
+    return count;
+}
+
+/* WAIT numslaves timeout
+ *
+ * Block the client until the writes performed so far are acknowledged by
+ * at least 'numslaves' slaves, or until 'timeout' milliseconds elapsed
+ * (0 means to wait forever). The number of slaves that acknowledged the
+ * writes is returned in both cases. */
+void waitCommand(redisClient *c) {
+    long long numreplicas, timeout;
+    long long offset = server.master_repl_offset;
+    int ackreplicas;
+
+    if (server.masterhost) {
+        addReplyError(c,"WAIT cannot be used with slave instances");
+        return;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[1],&numreplicas,NULL)
+        != REDIS_OK) return;
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&timeout,NULL)
+        != REDIS_OK) return;
+    if (numreplicas < 0 || timeout < 0) {
+        addReplyError(c,"numslaves and timeout can't be negative");
+        return;
+    }
+
+    /* Reply ASAP if we already have enough ACKs, or if we are in the
+     * context of MULTI/EXEC or a script, where we can't block. */
+    ackreplicas = replicationCountAcksByOffset(offset);
+    if (ackreplicas >= numreplicas ||
+        c->flags & (REDIS_MULTI|REDIS_LUA_CLIENT))
+    {
+        addReplyLongLong(c,ackreplicas);
+        return;
+    }
+
+    /* Otherwise block the client, it will be served by
+     * processClientsWaitingReplicas() as ACKs are received. */
+    c->bpop.numreplicas = numreplicas;
+    c->bpop.reploffset = offset;
+    c->bpop.reptimeout = timeout ? mstime()+timeout : 0;
+    c->flags |= REDIS_BLOCKED;
+    c->btype = REDIS_BLOCKED_WAIT;
+    server.bpop_blocked_clients++;
+    listAddNodeTail(server.clients_waiting_acks,c);
+
+    /* Make sure the slaves will send an ACK ASAP, see beforeSleep(). */
+    server.get_ack_from_slaves = 1;
+}
+
+/* Unblock a client blocked in WAIT, without replying. The reply is up to
+ * the caller, unless the client is being freed. */
+void unblockClientWaitingReplicas(redisClient *c) {
+    listNode *ln = listSearchKey(server.clients_waiting_acks,c);
+
+    redisAssert(ln != NULL);
+    listDelNode(server.clients_waiting_acks,ln);
+    c->flags &= ~REDIS_BLOCKED;
+    c->flags |= REDIS_UNBLOCKED;
+    c->btype = 0;
+    server.bpop_blocked_clients--;
+    listAddNodeTail(server.unblocked_clients,c);
+}
+
+/* Called from beforeSleep(): serve the clients blocked in WAIT that now
+ * have enough ACKs, or that reached their timeout. */
+void processClientsWaitingReplicas(void) {
+    long long now = mstime();
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients_waiting_acks,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = ln->value;
+        int ackreplicas = replicationCountAcksByOffset(c->bpop.reploffset);
+
+        if (ackreplicas >= c->bpop.numreplicas ||
+            (c->bpop.reptimeout && c->bpop.reptimeout <= now))
+        {
+            addReplyLongLong(c,ackreplicas);
+            unblockClientWaitingReplicas(c);
+        }
+    }
+}
+
 /* --------------------------- REPLICATION CRON  ---------------------------- */
 
 void replicationCron(void) {
@@ -674,6 +1607,11 @@ void replicationCron(void) {
         freeClient(server.master);
     }
 
+    /* Send an ACK to the master every second, in addition to the ones sent
+     * for every heartbeat received. */
+    if (server.masterhost && server.repl_state == REDIS_REPL_CONNECTED)
+        replicationSendAck();
+
     /* Check if we should connect to a MASTER */
     if (server.repl_state == REDIS_REPL_CONNECT) {
         redisLog(REDIS_NOTICE,"Connecting to MASTER...");
@@ -685,10 +1623,14 @@ void replicationCron(void) {
     /* If we have attached slaves, PING them from time to time.
      * So slaves can implement an explicit timeout to masters, and will
      * be able to detect a link disconnection even if the TCP connection
-     * will not actually go down. */
-    if (!(server.cronloops % (server.repl_ping_slave_period*10))) {
+     * will not actually go down. When we are a connected slave the PINGs
+     * of our master are already proxied to our slaves. */
+    if (!(server.cronloops % (server.repl_ping_slave_period*10)) &&
+        !(server.masterhost && server.repl_state == REDIS_REPL_CONNECTED))
+    {
         listIter li;
         listNode *ln;
+        int ping = 0;
 
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
@@ -698,8 +1640,14 @@ void replicationCron(void) {
              * with the master for first synchronization. */
             if (slave->replstate == REDIS_REPL_SEND_BULK) continue;
             if (slave->replstate == REDIS_REPL_ONLINE) {
-                /* If the slave is online send a normal ping */
-                addReplySds(slave,sdsnew("*1\r\n$4\r\nPING\r\n"));
+                /* If the slave is online send a normal ping. It is part of
+                 * the replication stream so that it is accounted in the
+                 * offset, like any other command. */
+                if (!ping) {
+                    replicationFeedStream(server.slaves,
+                        "*1\r\n$4\r\nPING\r\n",14);
+                    ping = 1;
+                }
             } else {
                 /* Otherwise we are in the pre-synchronization stage.
                  * Just a newline will do the work of refreshing the
@@ -15,8 +15,12 @@
 #include "fmacros.h"
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include "rio.h"
 #include "util.h"
+#include "config.h"
 
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 
@@ -41,9 +45,57 @@ static off_t rioBufferTell(rio *r) {
     return r->io.buffer.pos;
 }
 
+static long long rioUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Sleep as needed in order to write no more than 'ratelimit' bytes per
+ * second. The check is performed every time a tenth of the limit is
+ * written, so the writes are spread over the whole second instead of
+ * happening in a single burst. */
+static void rioFileThrottle(rio *r, size_t len) {
+    long long elapsed, expected;
+
+    r->io.file.rl_bytes += len;
+    if (r->io.file.rl_bytes < r->io.file.ratelimit/10) return;
+    elapsed = rioUstime()-r->io.file.rl_start;
+    expected = r->io.file.rl_bytes*1000000/r->io.file.ratelimit;
+    if (elapsed < expected) usleep(expected-elapsed);
+    r->io.file.rl_start = rioUstime();
+    r->io.file.rl_bytes = 0;
+}
+
 /* Returns 1 or 0 for success/failure. */
 static size_t rioFileWrite(rio *r, const void *buf, size_t len) {
-    return fwrite(buf,len,1,r->io.file.fp);
+    size_t retval;
+
+    retval = fwrite(buf,len,1,r->io.file.fp);
+    if (r->io.file.ratelimit) rioFileThrottle(r,len);
+    r->io.file.buffered += len;
+
+    if (r->io.file.autosync &&
+        r->io.file.buffered >= r->io.file.autosync)
+    {
+        fflush(r->io.file.fp);
+        aof_fsync(fileno(r->io.file.fp));
+#ifdef HAVE_FADVISE
+        if (r->io.file.dropcache) {
+            /* Data is on disk now, so the pages are clean and the kernel
+             * can discard them right away instead of evicting the page
+             * cache of other processes. */
+            off_t pos = ftello(r->io.file.fp);
+
+            posix_fadvise(fileno(r->io.file.fp),r->io.file.synced,
+                pos-r->io.file.synced,POSIX_FADV_DONTNEED);
+            r->io.file.synced = pos;
+        }
+#endif
+        r->io.file.buffered = 0;
+    }
+    return retval;
 }
 
 /* Returns 1 or 0 for success/failure. */
@@ -77,6 +129,13 @@ static const rio rioFileIO = {
 void rioInitWithFile(rio *r, FILE *fp) {
     *r = rioFileIO;
     r->io.file.fp = fp;
+    r->io.file.buffered = 0;
+    r->io.file.autosync = 0;
+    r->io.file.dropcache = 0;
+    r->io.file.synced = 0;
+    r->io.file.ratelimit = 0;
+    r->io.file.rl_start = 0;
+    r->io.file.rl_bytes = 0;
 }
 
 void rioInitWithBuffer(rio *r, sds s) {
@@ -85,6 +144,28 @@ void rioInitWithBuffer(rio *r, sds s) {
     r->io.buffer.pos = 0;
 }
 
+/* Set the file-based rio object to auto-fsync every 'bytes' file written.
+ * By default this is set to zero that means no automatic file sync is
+ * performed. If 'dropcache' is true the data already synced is also
+ * removed from the page cache, when supported by the OS.
+ *
+ * This feature is useful in a few contexts since when we rely on OS write
+ * buffers sometimes the OS buffers way too much, resulting in too many
+ * disk I/O concentrated in very little time. When we fsync in an explicit
+ * way instead the I/O pressure is more distributed across time. */
+void rioSetAutoSync(rio *r, off_t bytes, int dropcache) {
+    r->io.file.autosync = bytes;
+    r->io.file.dropcache = dropcache;
+}
+
+/* Limit the write speed of a file-based rio object to 'bytes_per_sec'.
+ * Zero (the default) means no limit. */
+void rioSetRateLimit(rio *r, long long bytes_per_sec) {
+    r->io.file.ratelimit = bytes_per_sec;
+    r->io.file.rl_start = rioUstime();
+    r->io.file.rl_bytes = 0;
+}
+
 /* This function can be installed both in memory and file streams when checksum
  * computation is needed. */
 void rioGenericUpdateChecksum(rio *r, const void *buf, size_t len) {
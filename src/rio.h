@@ -29,6 +29,13 @@ struct _rio {
         } buffer;
         struct {
             FILE *fp;
+            off_t buffered;     /* Bytes written since last fsync. */
+            off_t autosync;     /* fsync after 'autosync' bytes written. */
+            int dropcache;      /* Drop synced data from the page cache. */
+            off_t synced;       /* Bytes already synced and dropped. */
+            long long ratelimit;    /* Max bytes per second, 0 = no limit. */
+            long long rl_start;     /* Start of the rate limit period (us). */
+            long long rl_bytes;     /* Bytes written in the current period. */
         } file;
     } io;
 };
@@ -58,6 +65,8 @@ static inline off_t rioTell(rio *r) {
 
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
+void rioSetAutoSync(rio *r, off_t bytes, int dropcache);
+void rioSetRateLimit(rio *r, long long bytes_per_sec);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
@@ -423,7 +423,7 @@ void luaMaskCountHook(lua_State *lua, lua_Debug *ar) {
          aeDeleteFileEvent(server.el, server.lua_caller->fd, AE_READABLE);
     }
     if (server.lua_timedout)
-        aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        processEventsWhileBlocked();
     if (server.lua_kill) {
         redisLog(REDIS_WARNING,"Lua script killed by user with SCRIPT KILL.");
         lua_pushstring(lua,"Script killed by user with SCRIPT KILL...");
@@ -933,7 +933,11 @@ void evalGenericCommand(redisClient *c, int evalsha) {
 
     // 执行成功时的处理语句
     if (delhook) lua_sethook(lua,luaMaskCountHook,0,0); /* Disable hook */
-    server.lua_timedout = 0;
+    if (server.lua_timedout) {
+        server.lua_timedout = 0;
+        /* Restore the readable handler, like in the error path above. */
+        aeCreateFileEvent(server.el,c->fd,AE_READABLE,readQueryFromClient,c);
+    }
     server.lua_caller = NULL;
     selectDb(c,server.lua_client->db->id); /* set DB ID from Lua client */
 
@@ -802,6 +802,7 @@ void blockForKeys(redisClient *c, robj **keys, int numkeys, time_t timeout, robj
     }
     /* Mark the client as a blocked client */
     c->flags |= REDIS_BLOCKED;
+    c->btype = REDIS_BLOCKED_LIST;
     server.bpop_blocked_clients++;
 }
 
@@ -0,0 +1,225 @@
+/* Keys tracking for client side caching.
+ *
+ * Clients that enable tracking with CLIENT TRACKING ON are remembered as
+ * caching every key they read: the tracking table maps key names to the set
+ * of IDs of the clients that read them. When a key is modified, deleted,
+ * expired or evicted, every client in its set receives an invalidation
+ * message, and the key is removed from the table: clients will read it
+ * again from the server, tracking it again, if they still need it.
+ *
+ * Invalidation messages are RESP3 push messages, so tracking requires the
+ * client to switch protocol with HELLO 3:
+ *
+ *  >2
+ *  $10
+ *  invalidate
+ *  *1
+ *  $<keylen>
+ *  <key>
+ *
+ * When a whole database is flushed a single message with a null instead
+ * of the array of keys is sent, meaning that all the keys are invalidated.
+ *
+ * The table is not per database, like for Pub/Sub the same key name in
+ * different databases is a single entry: this may only cause a few
+ * additional invalidation messages.
+ *
+ * Copyright (c) 2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+
+/* Client IDs are stored directly in the dictionary key pointer. */
+#define idToKey(id) ((void*)(uintptr_t)(id))
+#define keyToId(key) ((unsigned long)(uintptr_t)(key))
+
+/*-----------------------------------------------------------------------------
+ * Tracking low level API
+ *----------------------------------------------------------------------------*/
+
+/* Send the invalidation message for 'key' to the client, or the message
+ * invalidating all the keys if 'key' is NULL. */
+static void sendTrackingMessage(redisClient *c, robj *key) {
+    addReplyPushLen(c,2);
+    addReplyBulkCBuffer(c,"invalidate",10);
+    if (key) {
+        addReplyMultiBulkLen(c,1);
+        addReplyBulk(c,key);
+    } else {
+        addReplyNull(c);
+    }
+}
+
+/* Invalidation messages for the client executing the current command are
+ * queued and sent after its reply, otherwise a push message could end in
+ * the middle of the reply (for instance of EXEC or EVAL). */
+static void queueTrackingMessage(redisClient *c, robj *key) {
+    if (listLength(server.tracking_pending_keys) == 0 &&
+        !server.tracking_pending_flush)
+    {
+        server.tracking_pending_id = c->id;
+    } else if (server.tracking_pending_id != c->id) {
+        trackingHandlePendingKeys();
+        server.tracking_pending_id = c->id;
+    }
+
+    if (key) {
+        incrRefCount(key);
+        listAddNodeTail(server.tracking_pending_keys,key);
+    } else {
+        server.tracking_pending_flush = 1;
+    }
+}
+
+static void trackingNotifyClient(unsigned long id, robj *key) {
+    dictEntry *de = dictFind(server.tracking_clients,idToKey(id));
+    redisClient *c;
+
+    if (de == NULL) return; /* Client gone or tracking disabled. */
+    c = dictGetVal(de);
+    if (c == server.current_client)
+        queueTrackingMessage(c,key);
+    else
+        sendTrackingMessage(c,key);
+}
+
+/* Remove 'key' from the tracking table, sending the invalidation message
+ * to the clients that were caching it. */
+static void trackingInvalidateEntry(dictEntry *de, robj *key) {
+    dict *ids = dictGetVal(de);
+    dictIterator *di = dictGetIterator(ids);
+    dictEntry *ide;
+
+    while((ide = dictNext(di)) != NULL)
+        trackingNotifyClient(keyToId(dictGetKey(ide)),key);
+    dictReleaseIterator(di);
+    dictDelete(server.tracking_table,dictGetKey(de));
+}
+
+/*-----------------------------------------------------------------------------
+ * Tracking API, used by the rest of the server
+ *----------------------------------------------------------------------------*/
+
+void enableTracking(redisClient *c) {
+    if (c->flags & REDIS_TRACKING) return;
+    c->flags |= REDIS_TRACKING;
+    dictAdd(server.tracking_clients,idToKey(c->id),c);
+}
+
+/* Stop tracking keys for the client. The entries of the tracking table
+ * still referencing the client are not removed now: they are discarded
+ * once the keys are invalidated, since the ID will not be found. */
+void disableTracking(redisClient *c) {
+    if (!(c->flags & REDIS_TRACKING)) return;
+    c->flags &= ~REDIS_TRACKING;
+    dictDelete(server.tracking_clients,idToKey(c->id));
+    if (server.tracking_pending_id == c->id) {
+        while(listLength(server.tracking_pending_keys))
+            listDelNode(server.tracking_pending_keys,
+                        listFirst(server.tracking_pending_keys));
+        server.tracking_pending_flush = 0;
+    }
+}
+
+/* Remember that the client may cache 'key' from now on. Called by
+ * lookupKeyRead() for clients with tracking enabled. */
+void trackingRememberKey(redisClient *c, robj *key) {
+    dictEntry *de;
+    dict *ids;
+
+    key = getDecodedObject(key);
+    de = dictFind(server.tracking_table,key->ptr);
+    if (de == NULL) {
+        ids = dictCreate(&clientIdDictType,NULL);
+        dictAdd(server.tracking_table,sdsdup(key->ptr),ids);
+    } else {
+        ids = dictGetVal(de);
+    }
+    dictAdd(ids,idToKey(c->id),NULL);
+    decrRefCount(key);
+
+    /* Don't let the table grow without limits: evict random keys sending
+     * the invalidation messages, clients will just read them again. */
+    while(server.tracking_table_max_keys &&
+          dictSize(server.tracking_table) > server.tracking_table_max_keys)
+    {
+        robj *evicted;
+
+        de = dictGetRandomKey(server.tracking_table);
+        evicted = createStringObject(dictGetKey(de),sdslen(dictGetKey(de)));
+        trackingInvalidateEntry(de,evicted);
+        decrRefCount(evicted);
+    }
+}
+
+/* Called every time a key is modified or deleted. */
+void trackingInvalidateKey(robj *key) {
+    dictEntry *de;
+
+    if (dictSize(server.tracking_table) == 0) return;
+    key = getDecodedObject(key);
+    de = dictFind(server.tracking_table,key->ptr);
+    if (de) trackingInvalidateEntry(de,key);
+    decrRefCount(key);
+}
+
+/* Called when a database is flushed: all the tracking clients are told to
+ * drop their whole cache, and the table is emptied. */
+void trackingInvalidateAll(void) {
+    dictIterator *di;
+    dictEntry *de;
+
+    if (dictSize(server.tracking_clients) == 0) return;
+    di = dictGetSafeIterator(server.tracking_clients);
+    while((de = dictNext(di)) != NULL)
+        trackingNotifyClient(keyToId(dictGetKey(de)),NULL);
+    dictReleaseIterator(di);
+    dictEmpty(server.tracking_table);
+}
+
+/* Send the invalidation messages queued for the client that executed the
+ * last command, now that its reply is complete. */
+void trackingHandlePendingKeys(void) {
+    dictEntry *de;
+    redisClient *c = NULL;
+
+    if (listLength(server.tracking_pending_keys) == 0 &&
+        !server.tracking_pending_flush) return;
+
+    de = dictFind(server.tracking_clients,idToKey(server.tracking_pending_id));
+    if (de) c = dictGetVal(de);
+    if (c && server.tracking_pending_flush) sendTrackingMessage(c,NULL);
+    while(listLength(server.tracking_pending_keys)) {
+        listNode *ln = listFirst(server.tracking_pending_keys);
+
+        if (c && !server.tracking_pending_flush)
+            sendTrackingMessage(c,listNodeValue(ln));
+        listDelNode(server.tracking_pending_keys,ln);
+    }
+    server.tracking_pending_flush = 0;
+}
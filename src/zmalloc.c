@@ -320,6 +320,47 @@ size_t zmalloc_get_rss(void) {
 }
 #endif
 
+/* Get the sum of the specified field (converted from kb to bytes) in
+ * /proc/self/smaps. The field must be specified with trailing ":" as it
+ * appears in the smaps output.
+ *
+ * Example: zmalloc_get_smap_bytes_by_field("Private_Dirty:");
+ */
+#if defined(HAVE_PROCFS)
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
+    char line[1024];
+    size_t bytes = 0;
+    FILE *fp = fopen("/proc/self/smaps","r");
+    int flen = strlen(field);
+
+    if (!fp) return 0;
+    while(fgets(line,sizeof(line),fp) != NULL) {
+        if (strncmp(line,field,flen) == 0) {
+            char *p = strchr(line,'k');
+            if (p) {
+                *p = '\0';
+                bytes += strtol(line+flen,NULL,10) * 1024;
+            }
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+#else
+size_t zmalloc_get_smap_bytes_by_field(char *field) {
+    ((void) field);
+    return 0;
+}
+#endif
+
+/* Return the amount of memory pages that are private to this process and
+ * were modified after being mapped. In a child created with fork() this is
+ * the amount of memory duplicated because of copy-on-write, since the
+ * parent and the child start sharing all the pages. */
+size_t zmalloc_get_private_dirty(void) {
+    return zmalloc_get_smap_bytes_by_field("Private_Dirty:");
+}
+
 /* Fragmentation = RSS / allocated-bytes */
 float zmalloc_get_fragmentation_ratio(void) {
     return (float)zmalloc_get_rss()/zmalloc_used_memory();
@@ -23,3 +23,102 @@ start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rd
 }
 }
 
+
+set server_path [tmpdir "server.rdb-key-index-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-key-index" "yes"]] {
+    test {RDB with key index can be loaded back} {
+        r set user:1:name foo
+        r rpush user:1:list a b c
+        r set user:2:name bar
+        r set 12345 intkey
+        r save
+        r debug reload
+        list [r dbsize] [r lrange user:1:list 0 -1]
+    } {4 {a b c}}
+
+    test {redis-rdb-extract restores only the selected keys} {
+        # FLUSHALL saves the (empty) dataset, so extract from a copy.
+        set rdb [file join [lindex [r config get dir] 1] extract.rdb]
+        file copy -force [file join [lindex [r config get dir] 1] dump.rdb] $rdb
+        r flushall
+        exec src/redis-rdb-extract --prefix user:1: $rdb 2>/dev/null | \
+            src/redis-cli -p [srv port] --pipe
+        exec src/redis-rdb-extract --key 12345 $rdb 2>/dev/null | \
+            src/redis-cli -p [srv port] --pipe
+        list [lsort [r keys *]] [r get 12345] [r lrange user:1:list 0 -1]
+    } {{12345 user:1:list user:1:name} intkey {a b c}}
+}
+
+set server_path [tmpdir "server.rdb-save-throttle-test"]
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {BGSAVE with incremental fsync and rate limit produces a valid RDB} {
+        r config set rdb-save-fsync-bytes 4096
+        r config set rdb-save-drop-cache yes
+        r config set rdb-save-rate-limit 10485760
+        r debug populate 10000
+        r bgsave
+        waitForBgsave r
+        r debug reload
+        r dbsize
+    } {10000}
+
+    test {CONFIG SET rdb-save-fsync-bytes and rdb-save-rate-limit accept units} {
+        r config set rdb-save-fsync-bytes 1mb
+        r config set rdb-save-rate-limit 32mb
+        catch {r config set rdb-save-rate-limit 32xb} e
+        assert_match {ERR*} $e
+        list [lindex [r config get rdb-save-fsync-bytes] 1] \
+             [lindex [r config get rdb-save-rate-limit] 1]
+    } {1048576 33554432}
+}
+
+set server_path [tmpdir "server.rdb-delta-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-tracking" "yes"]] {
+    test {BGSAVE DELTA requires a full save first} {
+        r debug populate 1000
+        catch {r bgsave delta} e
+        set e
+    } {*full BGSAVE*}
+
+    test {Base RDB plus deltas can be merged into a full RDB} {
+        r rpush mylist a b c
+        r bgsave
+        waitForBgsave r
+        r set key:1 changed
+        r del key:2
+        r lpush mylist z
+        r expire key:3 1000
+        r select 3
+        r set foo bar
+        r select 9
+        assert_equal [s rdb_delta_tracked_keys] 5
+        r bgsave delta
+        waitForBgsave r
+        r set key:1 again
+        r select 3
+        r del foo
+        r set bar foo
+        r select 9
+        r bgsave delta
+        waitForBgsave r
+        assert_equal [s rdb_delta_last_seq] 2
+        set digest [r debug digest]
+        set dir [lindex [r config get dir] 1]
+        exec src/redis-rdb-merge -o [file join $dir merged.rdb] \
+            [file join $dir dump.rdb] [file join $dir dump.rdb.delta-1] \
+            [file join $dir dump.rdb.delta-2] 2>/dev/null
+        start_server [list overrides [list "dir" $dir "dbfilename" "merged.rdb"]] {
+            assert_equal $digest [r debug digest]
+        }
+    }
+
+    test {Deltas must be merged in order} {
+        set dir [lindex [r config get dir] 1]
+        catch {exec src/redis-rdb-merge -o [file join $dir merged.rdb] \
+            [file join $dir dump.rdb] [file join $dir dump.rdb.delta-2]} e
+        set e
+    } {*expected delta number 1*}
+}
@@ -52,3 +52,42 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            start_server {} {
+                set master [srv -3 client]
+                set master_host [srv -3 host]
+                set master_port [srv -3 port]
+                set load_handle0 [start_bg_complex_data $master_host $master_port 9 100000]
+                set load_handle1 [start_bg_complex_data $master_host $master_port 11 100000]
+
+                test {Slaves attached at different times share the same stream} {
+                    for {set j 0} {$j < 3} {incr j} {
+                        r -$j slaveof $master_host $master_port
+                        after 1000
+                    }
+                    # Values bigger than a reply block are split between
+                    # more blocks of the replication stream.
+                    $master select 12
+                    $master set bigval [string repeat x 100000]
+                    after 2000
+                    stop_bg_complex_data $load_handle0
+                    stop_bg_complex_data $load_handle1
+                    set digest [$master debug digest]
+                    for {set j 0} {$j < 3} {incr j} {
+                        wait_for_condition 50 100 {
+                            [r -$j debug digest] eq $digest
+                        } else {
+                            fail "Slave $j is not consistent with the master"
+                        }
+                    }
+                    assert {[$master dbsize] > 0}
+                    [srv 0 client] select 12
+                    string length [[srv 0 client] get bigval]
+                } {100000}
+            }
+        }
+    }
+}
@@ -157,3 +157,371 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        set master [srv -1 client]
+        set slave [srv 0 client]
+
+        test {Slave tracks the offset of the master and the age of its data} {
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up} &&
+                [status $slave slave_lag_ms] != -1
+            } else {
+                fail "No heartbeat received from the master"
+            }
+            $master set foo bar
+            wait_for_condition 50 100 {
+                [status $master master_repl_offset] ==
+                [status $slave slave_repl_offset]
+            } else {
+                fail "Slave offset does not match the master one"
+            }
+            assert {[status $slave slave_lag_ms] < 1000}
+            $slave get foo
+        } {bar}
+
+        test {READONLY reads are refused over the staleness bound} {
+            $slave readonly 300
+            assert_equal bar [$slave get foo]
+            # Block the master, so that it stops sending heartbeats.
+            set rd [redis_deferring_client -1]
+            $rd debug sleep 1.5
+            after 800
+            catch {$slave get foo} e
+            assert_match "STALE * [srv -1 host]:[srv -1 port] *" $e
+            # Commands not accessing keys are still accepted.
+            assert_equal PONG [$slave ping]
+            $rd read
+            $rd close
+            wait_for_condition 50 100 {
+                [status $slave slave_lag_ms] < 300
+            } else {
+                fail "Slave lag still too high"
+            }
+            $slave get foo
+        } {bar}
+
+        test {READWRITE removes the staleness bound} {
+            $slave readonly 1
+            set rd [redis_deferring_client -1]
+            $rd debug sleep 0.5
+            after 200
+            catch {$slave get foo} e
+            assert_match {STALE*} $e
+            $slave readwrite
+            set v [$slave get foo]
+            $rd read
+            $rd close
+            set v
+        } {bar}
+    }
+}
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        set master [srv -1 client]
+        set slave [srv 0 client]
+
+        test {WAIT returns once the slave acknowledged the writes} {
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up} &&
+                [status $slave slave_lag_ms] != -1
+            } else {
+                fail "Replication not started"
+            }
+            $master set foo bar
+            $master incr counter
+            $master wait 1 5000
+        } {1}
+
+        test {WAIT 0 returns ASAP with the number of slaves acknowledging} {
+            $master wait 0 0
+        } {1}
+
+        test {WAIT times out when not enough slaves are connected} {
+            set start [clock milliseconds]
+            $master set foo baz
+            set acks [$master wait 2 300]
+            set elapsed [expr {[clock milliseconds]-$start}]
+            assert {$elapsed >= 300 && $elapsed < 3000}
+            set acks
+        } {1}
+
+        test {WAIT is refused by slaves} {
+            catch {$slave wait 1 0} e
+            set e
+        } {ERR*slave*}
+
+        test {INFO reports the offset acknowledged by the slaves} {
+            $master set foo bar
+            $master wait 1 5000
+            set offset [status $master master_repl_offset]
+            wait_for_condition 50 100 {
+                [string match "*slave0:*,online,*" [$master info replication]]
+            } else {
+                fail "Slave not reported"
+            }
+            regexp {slave0:[^,]*,[0-9]+,online,([0-9]+),([0-9]+)} \
+                [$master info replication] -> ackoff lag
+            assert {$ackoff >= $offset && $lag <= 2}
+        }
+
+        test {Blocked WAIT is unblocked when the slave catches up after a pause} {
+            set rd [redis_deferring_client -1]
+            $slave debug sleep 0.5
+            $rd set foo qux
+            $rd read
+            $rd wait 1 5000
+            assert_equal 1 [$rd read]
+            $rd close
+            $slave get foo
+        } {qux}
+    }
+}
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set middle [srv -1 client]
+            set slave [srv 0 client]
+
+            test {Chained slaves receive the stream of the master verbatim} {
+                $middle slaveof [srv -2 host] [srv -2 port]
+                wait_for_condition 50 100 {
+                    [status $middle master_link_status] eq {up}
+                } else {
+                    fail "Middle slave not connected"
+                }
+                # The test clients use DB 9: the middle slave has to emit
+                # the SELECT itself for the chained slave attached later.
+                $master set foo bar
+                $slave slaveof [srv -1 host] [srv -1 port]
+                wait_for_condition 50 100 {
+                    [status $slave master_link_status] eq {up}
+                } else {
+                    fail "Chained slave not connected"
+                }
+                $master set foo baz
+                $master set big [string repeat x 100000]
+                $master select 0
+                $master rpush list a b c
+                $slave select 0
+                wait_for_condition 50 100 {
+                    [$slave llen list] == 3
+                } else {
+                    fail "Writes not proxied to the chained slave"
+                }
+                # The chained slave sees the heartbeats of the top master,
+                # so its offset is the one of the top master stream.
+                wait_for_condition 50 100 {
+                    [status $master master_repl_offset] ==
+                    [status $slave slave_repl_offset]
+                } else {
+                    fail "Chained slave offset does not match the master one"
+                }
+                assert {[status $slave slave_lag_ms] != -1}
+                $slave select 9
+                list [$slave get foo] [$slave strlen big]
+            } {baz 100000}
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        set master [srv -1 client]
+        set slave [srv 0 client]
+
+        test {A stalled slave shares the stream blocks with the others} {
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            # A second slave that never reads what the master sends.
+            set fd [socket [srv -1 host] [srv -1 port]]
+            fconfigure $fd -translation binary
+            puts -nonewline $fd "SYNC\r\n"
+            flush $fd
+            set port [lindex [fconfigure $fd -sockname] 2]
+            wait_for_condition 50 100 {
+                [string match {*slave0:*,online*slave1:*,online*} \
+                    [$master info replication]]
+            } else {
+                fail "The stalled slave is not online"
+            }
+            proc stalled_slave_omem {master port} {
+                set line [lsearch -inline [split [$master client list] "\n"] \
+                    "*addr=*:$port *"]
+                regexp {omem=(\d+)} $line - omem
+                return $omem
+            }
+            # Fill the socket buffers of the stalled slave first.
+            $master set big [string repeat x 5000000]
+            wait_for_condition 50 100 {
+                [$slave strlen big] == 5000000
+            } else {
+                fail "Write not replicated"
+            }
+            after 100
+            set omem [stalled_slave_omem $master $port]
+            for {set j 0} {$j < 300} {incr j} {
+                $master set key:$j $j
+            }
+            wait_for_condition 50 100 {
+                [$slave get key:299] == 299
+            } else {
+                fail "Writes not replicated"
+            }
+            set delta [expr {[stalled_slave_omem $master $port]-$omem}]
+            close $fd
+            # The writes fit a couple of blocks: the stalled slave must not
+            # get a new block every time the other slave drained the last.
+            assert {$delta < 100000}
+        }
+    }
+}
+
+start_server {tags {"repl"} overrides {repl-compression yes}} {
+    start_server {overrides {repl-compression yes}} {
+        set master [srv -1 client]
+        set slave [srv 0 client]
+
+        test {Replication over a compressed link} {
+            $master debug populate 10000
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            for {set j 0} {$j < 1000} {incr j} {
+                $master set key:$j [string repeat "value $j " 10]
+            }
+            $master rpush biglist [string repeat x 100000]
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different data"
+            }
+            assert_equal 1 [status $slave master_link_compressed]
+            assert {[status $master repl_compress_ratio] > 1}
+            assert {[status $slave repl_decompress_ratio] > 1}
+            $slave llen biglist
+        } {1}
+
+        test {WAIT is not delayed by the compressed link} {
+            # The ACK request must be compressed and sent in the same event
+            # loop iteration, not a serverCron period later.
+            set start [clock milliseconds]
+            for {set j 0} {$j < 50} {incr j} {
+                $master incr waitcounter
+                assert_equal 1 [$master wait 1 1000]
+            }
+            set elapsed [expr {[clock milliseconds]-$start}]
+            assert {$elapsed < 250}
+        }
+
+        test {No compression if the master has it disabled} {
+            $master config set repl-compression no
+            $slave slaveof no one
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            $master set foo bar
+            wait_for_condition 50 100 {
+                [$slave get foo] eq {bar}
+            } else {
+                fail "Write not replicated"
+            }
+            status $slave master_link_compressed
+        } {0}
+    }
+}
+
+start_server {tags {"repl"} overrides {repl-compression yes}} {
+    start_server {overrides {slave-reader-thread yes repl-compression yes}} {
+        set master [srv -1 client]
+        set slave [srv 0 client]
+
+        test {Slave reading the master stream from a thread} {
+            $master debug populate 10000
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            for {set j 0} {$j < 1000} {incr j} {
+                $master set key:$j [string repeat "value $j " 10]
+            }
+            $master rpush biglist [string repeat x 100000]
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different data"
+            }
+            assert {[status $slave repl_decompress_ratio] > 1}
+            status $slave slave_reader_thread
+        } {1}
+
+        test {Slave reader thread reads ahead while the slave is busy} {
+            set rd [redis_deferring_client]
+            set rd_info [redis_deferring_client]
+            $rd debug sleep 3
+            after 100
+            # INFO is served as soon as the slave wakes up, while the stream
+            # read ahead is still being processed a chunk at a time.
+            $rd_info info replication
+            # Writes big enough to overflow the socket buffers.
+            set val [string repeat x 10000]
+            for {set j 0} {$j < 3000} {incr j} {
+                $master set readahead:$j $val
+            }
+            wait_for_condition 50 10 {
+                [regexp {flags=S [^\n]* omem=0 } [$master client list]]
+            } else {
+                fail "The stream is kept in the master output buffer"
+            }
+            assert_equal OK [$rd read]
+            set info [$rd_info read]
+            regexp {slave_readahead_bytes:(\d+)} $info - readahead
+            assert {$readahead > 0}
+            $rd close
+            $rd_info close
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different data"
+            }
+        }
+
+        test {Slave reader thread is restarted on resync} {
+            $slave slaveof no one
+            $master config set repl-compression no
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [status $slave master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            $master incr counter
+            $master del key:1
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different data"
+            }
+            list [status $slave slave_reader_thread] \
+                 [status $slave master_link_compressed]
+        } {1 0}
+    }
+}
@@ -154,6 +154,17 @@ proc ::redis::redis_multi_bulk_read fd {
     return $l
 }
 
+proc ::redis::redis_map_read fd {
+    set count [redis_read_line $fd]
+    set d {}
+    for {set i 0} {$i < $count} {incr i} {
+        set k [redis_read_reply $fd]
+        set v [redis_read_reply $fd]
+        dict set d $k $v
+    }
+    return $d
+}
+
 proc ::redis::redis_read_line fd {
     string trim [gets $fd]
 }
@@ -165,7 +176,10 @@ proc ::redis::redis_read_reply fd {
         + {redis_read_line $fd}
         - {return -code error [redis_read_line $fd]}
         $ {redis_bulk_read $fd}
-        * {redis_multi_bulk_read $fd}
+        * -
+        > {redis_multi_bulk_read $fd}
+        % {redis_map_read $fd}
+        _ {redis_read_line $fd}
         default {return -code error "Bad protocol, '$type' as reply type byte"}
     }
 }
@@ -230,7 +230,7 @@ proc start_server {options {code undefined}} {
     # setup properties to be able to initialize a client object
     set host $::host
     set port $::port
-    if {[dict exists $config bind]} { set host [dict get $config bind] }
+    if {[dict exists $config bind]} { set host [lindex [dict get $config bind] 0] }
     if {[dict exists $config port]} { set port [dict get $config port] }
 
     # setup config dict
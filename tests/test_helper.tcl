@@ -23,6 +23,7 @@ set ::all_tests {
     unit/sort
     unit/expire
     unit/other
+    unit/cluster
     unit/cas
     unit/quit
     unit/aofrw
@@ -42,6 +43,7 @@ set ::all_tests {
     unit/obuf-limits
     unit/dump
     unit/bitops
+    unit/tracking
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
@@ -116,8 +118,10 @@ proc reconnect {args} {
     set client [redis $host $port]
     dict set srv "client" $client
 
-    # select the right db when we don't have to authenticate
-    if {![dict exists $config "requirepass"]} {
+    # select the right db when we don't have to authenticate (in cluster
+    # mode only DB 0 is available)
+    if {![dict exists $config "requirepass"] &&
+        ![dict exists $config "cluster-enabled"]} {
         $client select 9
     }
 
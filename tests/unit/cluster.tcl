@@ -0,0 +1,189 @@
+start_server {tags {"cluster"} overrides {cluster-enabled yes}} {
+    set slots {}
+    for {set j 0} {$j < 4096} {incr j} {lappend slots $j}
+    r cluster addslots {*}$slots
+    wait_for_condition 50 100 {
+        [string match {*cluster_state:ok*} [r cluster info]]
+    } else {
+        fail "Cluster state is not ok"
+    }
+
+    test {CLUSTER COUNTKEYSINSLOT and GETKEYSINSLOT} {
+        for {set j 0} {$j < 1000} {incr j} {r set key:$j $j}
+        set slot [r cluster keyslot key:1]
+        set count 0
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[r cluster keyslot key:$j] == $slot} {incr count}
+        }
+        assert_equal $count [r cluster countkeysinslot $slot]
+        assert {[lsearch [r cluster getkeysinslot $slot 1000] key:1] != -1}
+        llength [r cluster getkeysinslot $slot 1]
+    } {1}
+
+    test {Keys are removed from their slot when deleted or expired} {
+        set slot [r cluster keyslot key:1]
+        set count [r cluster countkeysinslot $slot]
+        r del key:1
+        assert_equal [expr {$count-1}] [r cluster countkeysinslot $slot]
+        assert {[lsearch [r cluster getkeysinslot $slot 1000] key:1] == -1}
+        set slot [r cluster keyslot key:2]
+        set count [r cluster countkeysinslot $slot]
+        r pexpire key:2 1
+        after 10
+        r get key:2
+        expr {$count-[r cluster countkeysinslot $slot]}
+    } {1}
+
+    test {Slots to keys mapping survives DEBUG RELOAD and FLUSHALL} {
+        set slot [r cluster keyslot key:3]
+        set count [r cluster countkeysinslot $slot]
+        r debug reload
+        assert_equal $count [r cluster countkeysinslot $slot]
+        r flushall
+        assert_equal 0 [r cluster countkeysinslot $slot]
+        r set key:3 foo
+        r cluster getkeysinslot $slot 10
+    } {key:3}
+
+    test {Cluster config is saved in background after slots changes} {
+        set conf [file join [lindex [r config get dir] 1] nodes.conf]
+        wait_for_condition 50 100 {
+            [string match {*myself* 0-4095*} [exec cat $conf]]
+        } else {
+            fail "Cluster config file not updated"
+        }
+        r cluster delslots 4095
+        wait_for_condition 50 100 {
+            [string match {*myself* 0-4094*} [exec cat $conf]]
+        } else {
+            fail "Cluster config file not updated"
+        }
+        r cluster addslots 4095
+        wait_for_condition 50 100 {
+            [string match {*myself* 0-4095*} [exec cat $conf]]
+        } else {
+            fail "Cluster config file not updated"
+        }
+        # The rename happens after the write, give the job time to finish.
+        wait_for_condition 50 100 {
+            [glob -nocomplain [file join [lindex [r config get dir] 1] \
+                nodes.conf.tmp-*]] eq {}
+        } else {
+            fail "Temporary cluster config file left on disk"
+        }
+    }
+
+    start_server {overrides {cluster-enabled yes}} {
+        test {Slots are announced to the nodes joining the cluster} {
+            set master [srv -1 client]
+            set id [lindex [$master cluster nodes] 0]
+            r cluster meet [srv -1 host] [srv -1 port]
+            wait_for_condition 100 100 {
+                [string match "*$id * 0-4095*" [r cluster nodes]] &&
+                [string match {*cluster_state:ok*} [r cluster info]]
+            } else {
+                fail "Slots of the master not received"
+            }
+            # The slots are not sent again once known: the state must
+            # survive a few more PING / PONG exchanges.
+            set line [lsearch -inline [split [r cluster nodes] "\n"] "$id *"]
+            set pong [lindex $line 5]
+            wait_for_condition 50 100 {
+                [lindex [lsearch -inline [split [r cluster nodes] "\n"] \
+                    "$id *"] 5] > $pong+1
+            } else {
+                fail "No PONG received from the master"
+            }
+            string match "*$id * 0-4095*" [r cluster nodes]
+        } {1}
+    }
+}
+
+start_server {tags {"cluster"} overrides {cluster-enabled yes}} {
+    start_server {overrides {cluster-enabled yes}} {
+        set a [srv -1 port]
+        set b [srv 0 port]
+        set slots_a {}
+        set slots_b {}
+        for {set j 0} {$j < 2048} {incr j} {lappend slots_a $j}
+        for {set j 2048} {$j < 4096} {incr j} {lappend slots_b $j}
+        [srv -1 client] cluster addslots {*}$slots_a
+        r cluster addslots {*}$slots_b
+        r cluster meet [srv -1 host] $a
+        wait_for_condition 100 100 {
+            [string match {*cluster_state:ok*} [r cluster info]] &&
+            [string match {*cluster_state:ok*} [[srv -1 client] cluster info]]
+        } else {
+            fail "Cluster state is not ok"
+        }
+
+        test {redis-cli -c sends commands to the node serving the key} {
+            # Find a key served by the second node.
+            for {set j 0} {[r cluster keyslot key:$j] < 2048} {incr j} {}
+            [srv -1 client] config resetstat
+            exec src/redis-cli -c -p $a set key:$j foo
+            assert_equal foo [exec src/redis-cli -p $b get key:$j]
+            # The command was not sent to the first node at all.
+            string match {*cmdstat_set*} [[srv -1 client] info commandstats]
+        } {0}
+
+        test {redis-benchmark --cluster spreads the requests among nodes} {
+            set out [exec src/redis-benchmark -p $a --cluster \
+                -n 1000 -r 1000 -t set,mset]
+            # Nodes are reported in the CLUSTER NODES order, that is random.
+            assert_match "*127.0.0.1:$a: * requests*" $out
+            assert_match "*127.0.0.1:$b: * requests*" $out
+            assert {![string match {*redirected*} $out]}
+            assert {[exec src/redis-cli -p $a dbsize] > 0}
+            expr {[exec src/redis-cli -p $b dbsize] > 0}
+        } {1}
+
+        test {redis-benchmark --cluster fails when a node has no key} {
+            # With a single key one of the two nodes can't be benchmarked.
+            catch {exec src/redis-benchmark -p $a --cluster \
+                -n 1000 -r 1 -t set} err
+            set err
+        } {*No key of the keyspace hashes to a slot served by*}
+
+        test {redis-benchmark --cluster does not account redirected requests} {
+            foreach line [split [[srv -1 client] cluster nodes] "\n"] {
+                if {[string match {*myself*} $line]} {
+                    set id_a [lindex $line 0]
+                }
+            }
+            # Empty slots migrating away reply with -ASK to every write.
+            for {set j 2048} {$j < 2560} {incr j} {
+                r cluster setslot $j migrating $id_a
+            }
+            set out [exec src/redis-benchmark -p $a --cluster \
+                -n 1000 -r 100000 -t set]
+            for {set j 2048} {$j < 2560} {incr j} {
+                r cluster setslot $j stable
+            }
+            assert_match {*requests redirected and not accounted*} $out
+            set total 0
+            foreach port [list $a $b] {
+                regexp "127.0.0.1:$port: (\\d+) requests" $out - count
+                incr total $count
+            }
+            set total
+        } {1000}
+
+        test {redis-cli -c follows -ASK redirections with ASKING} {
+            foreach {client var} [list [srv -1 client] id_a [srv 0 client] id_b] {
+                foreach line [split [$client cluster nodes] "\n"] {
+                    if {[string match {*myself*} $line]} {
+                        set $var [lindex $line 0]
+                    }
+                }
+            }
+            # Migrate the slot of a new key from the second node to the first.
+            for {set j 0} {[r cluster keyslot newkey:$j] < 2048} {incr j} {}
+            set slot [r cluster keyslot newkey:$j]
+            r cluster setslot $slot migrating $id_a
+            [srv -1 client] cluster setslot $slot importing $id_b
+            exec src/redis-cli -c -p $a set newkey:$j foo
+            [srv -1 client] cluster countkeysinslot $slot
+        } {1}
+    }
+}
@@ -129,4 +129,93 @@ start_server {tags {"dump"}} {
             assert_match {IOERR*} $e
         }
     }
+
+    test {MIGRATE with multiple keys migrate just existing ones} {
+        set first [srv 0 client]
+        r set key1 "v1"
+        r set key2 "v2"
+        r set key3 "v3"
+        r expire key3 100
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys nokey-1 nokey-2 nokey-2]
+            assert {$ret eq {NOKEY}}
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys nokey-1 key1 nokey-2 key2 nokey-3 key3]
+            assert {$ret eq {OK}}
+            assert {[$first exists key1] == 0}
+            assert {[$first exists key2] == 0}
+            assert {[$first exists key3] == 0}
+            assert {[$second get key1] eq {v1}}
+            assert {[$second get key2] eq {v2}}
+            assert {[$second get key3] eq {v3}}
+            assert {[$second ttl key3] >= 90 && [$second ttl key3] <= 100}
+        }
+    }
+
+    test {MIGRATE with multiple keys: stress command rewriting} {
+        set first [srv 0 client]
+        r flushdb
+        r lpush list1 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+        r lpush list2 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys list1 list2]
+
+            assert {[$first dbsize] == 0}
+            assert {[$second dbsize] == 2}
+        }
+    }
+
+    test {MIGRATE with multiple keys: delete just ack keys} {
+        set first [srv 0 client]
+        r flushdb
+        r lpush list1 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+        r lpush list2 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            $second select 9
+            $second lpush list2 a b c
+            catch {r -1 migrate $second_host $second_port "" 9 5000 keys list1 list2} e
+            assert_match {*busy*} $e
+            assert {[$first exists list1] == 0}
+            assert {[$first llen list2] == 20}
+            assert {[$second llen list1] == 20}
+        }
+    }
+
+    test {MIGRATE reuses the connection with the target instance} {
+        set first [srv 0 client]
+        r flushdb
+        for {set j 0} {$j < 10} {incr j} {r set key$j $j}
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            for {set j 0} {$j < 10} {incr j} {
+                r -1 migrate $second_host $second_port key$j 9 5000
+            }
+            assert {[$first dbsize] == 0}
+            assert {[$second dbsize] == 10}
+            # The test client and a single MIGRATE connection (plus the
+            # one used by the test suite to check that the server is up).
+            assert_equal 3 [s total_connections_received]
+            assert_equal 2 [s connected_clients]
+        }
+    }
+
+    test {MIGRATE KEYS option requires an empty key argument} {
+        catch {r migrate 127.0.0.1 6379 key 9 5000 keys a b} e
+        set e
+    } {*empty string*}
 }
@@ -1,7 +1,7 @@
 start_server {tags {"introspection"}} {
     test {CLIENT LIST} {
         r client list
-    } {*addr=*:* fd=* age=* idle=* flags=N db=9 sub=0 psub=0 multi=-1 qbuf=0 qbuf-free=* obl=0 oll=0 omem=0 events=r cmd=client*}
+    } {*addr=*:* fd=* age=* idle=* flags=N db=9 sub=0 psub=0 multi=-1 qbuf=0 qbuf-free=* obl=0 oll=0 omem=0 tot-mem=* events=r cmd=client*}
 
     test {MONITOR can log executed commands} {
         set rd [redis_deferring_client]
@@ -19,4 +19,16 @@ start_server {tags {"introspection"}} {
         assert_match {*eval*} [$rd read]
         assert_match {*lua*"set"*"foo"*"bar"*} [$rd read]
     }
+
+    test {Reply blocks are reused across pipelined replies} {
+        r config resetstat
+        r del mylist
+        for {set j 0} {$j < 5000} {incr j} {r rpush mylist $j}
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 20} {incr j} {$rd lrange mylist 0 -1}
+        for {set j 0} {$j < 20} {incr j} {$rd read}
+        $rd close
+        assert {[status r reply_pool_misses] > 0}
+        assert {[status r reply_pool_hits] > 0}
+    }
 }
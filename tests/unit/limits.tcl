@@ -14,3 +14,39 @@ start_server {tags {"limits"} overrides {maxclients 10}} {
         set e
     } {*ERR max*reached*}
 }
+
+start_server {tags {"limits"} overrides {tcp-reuseport yes}} {
+    test {Connections opened at the same time are all accepted} {
+        set clients {}
+        for {set j 0} {$j < 200} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        foreach rd $clients {$rd ping}
+        set pongs 0
+        foreach rd $clients {
+            if {[$rd read] eq {PONG}} {incr pongs}
+            $rd close
+        }
+        list $pongs [lindex [r config get tcp-reuseport] 1]
+    } {200 yes}
+}
+
+# The server can't start if ::1 is not available, as when IPv6 is disabled:
+# skip these tests in that case.
+if {![catch {close [socket -server list -myaddr ::1 0]}]} {
+    start_server {tags {"limits"} overrides {bind {127.0.0.1 ::1}}} {
+        test {Multiple bind addresses are all listened} {
+            set fd [socket ::1 [srv 0 port]]
+            fconfigure $fd -translation binary
+            puts -nonewline $fd "PING\r\n"
+            flush $fd
+            assert_equal "+PONG" [string trim [gets $fd]]
+            close $fd
+            r ping
+        } {PONG}
+
+        test {CONFIG GET bind returns all the addresses} {
+            lindex [r config get bind] 1
+        } {127.0.0.1 ::1}
+    }
+}
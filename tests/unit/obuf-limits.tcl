@@ -70,4 +70,76 @@ start_server {tags {"obuf-limits"}} {
         assert {$omem >= 100000 && $time_elapsed < 6}
         $rd1 close
     }
+
+    test {CLIENT LIST reports the total memory used by the client} {
+        set rd1 [redis_deferring_client]
+        $rd1 ping
+        $rd1 read
+        set c [lindex [split [r client list] "\r\n"] 1]
+        assert {[regexp {omem=([0-9]+) tot-mem=([0-9]+)} $c - omem totmem]}
+        # At least the client structure with its static reply buffer.
+        assert {$totmem > 16384 && $totmem >= $omem}
+        $rd1 close
+    }
+
+    test {maxmemory-clients closes the clients using more memory first} {
+        r config set client-output-buffer-limit {pubsub 0 0 0}
+        r config set maxmemory-clients 2097152
+        set evicted [s evicted_clients]
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        $rd1 subscribe foo
+        $rd1 read
+        $rd2 ping
+        $rd2 read
+
+        # Nobody reads the messages, the output buffer of rd1 only grows.
+        set payload [string repeat x 1000]
+        for {set j 0} {$j < 5000} {incr j} {
+            if {[catch {r publish foo $payload} n] || $n == 0} break
+        }
+        wait_for_condition 50 100 {
+            [s evicted_clients] == $evicted+1
+        } else {
+            fail "No client was evicted"
+        }
+        # The subscriber was closed, the other clients are still there.
+        $rd2 ping
+        assert_equal PONG [$rd2 read]
+        assert {[s clients_used_memory] < 2*1024*1024}
+        r config set maxmemory-clients 0
+        $rd1 close
+        $rd2 close
+    }
+
+    test {maxmemory clients-first policy closes clients before evicting keys} {
+        r flushall
+        r set foo bar
+        r config set maxmemory-policy allkeys-random
+        r config set maxmemory-clients-policy clients-first
+        r config set maxmemory [expr {[s used_memory]+1048576}]
+        set evicted [s evicted_clients]
+
+        # A never completed 10MB argument makes the query buffer grow.
+        set rd [redis_deferring_client]
+        $rd write "*2\r\n\$3\r\nget\r\n\$10000000\r\n"
+        set payload [string repeat x 100000]
+        catch {
+            for {set j 0} {$j < 50} {incr j} {
+                $rd write $payload
+                $rd flush
+            }
+        }
+        wait_for_condition 50 100 {
+            [s evicted_clients] == $evicted+1
+        } else {
+            fail "The client filling the query buffer was not closed"
+        }
+        set res [list [r get foo] [s evicted_keys]]
+        r config set maxmemory 0
+        r config set maxmemory-clients-policy keys-only
+        r config set maxmemory-policy volatile-lru
+        catch {$rd close}
+        set res
+    } {bar 0}
 }
@@ -49,6 +49,13 @@ start_server {tags {"other"}} {
         r get x
     } {10}
 
+    test {BGSAVE reports copy-on-write size in INFO} {
+        waitForBgsave r
+        r bgsave
+        waitForBgsave r
+        string is integer -strict [status r rdb_last_cow_size]
+    } {1}
+
     test {SELECT an out of range DB} {
         catch {r select 1000000} err
         set _ $err
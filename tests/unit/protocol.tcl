@@ -6,6 +6,45 @@ start_server {tags {"protocol"}} {
         assert_equal "PONG" [r ping]
     }
 
+    test "Pipelined inline and multibulk commands" {
+        reconnect
+        r write "PING\r\n*2\r\n\$4\r\nECHO\r\n\$3\r\nfoo\r\nECHO bar\r\n"
+        r flush
+        list [r read] [r read] [r read]
+    } {PONG foo bar}
+
+    test "Commands split across reads are executed" {
+        reconnect
+        r write "*3\r\n\$3\r\nSET\r\n\$3\r\nfoo"
+        r flush
+        after 100
+        r write "\r\n\$3\r\nbar\r\n*2\r\n\$3\r\nGET\r"
+        r flush
+        after 100
+        r write "\n\$3\r\nfoo\r\n"
+        r flush
+        list [r read] [r read]
+    } {OK bar}
+
+    test "Idle clients don't hold a query buffer" {
+        reconnect
+        r write "*3\r\n\$3\r\nSET\r\n\$3\r\nfoo"
+        r flush
+        after 100
+        r write "\r\n\$3\r\nbar\r\n"
+        r flush
+        r read
+        set rd [redis_deferring_client]
+        $rd client list
+        set clients [$rd read]
+        $rd close
+        foreach client [split [string trim $clients] "\n"] {
+            if {[string match {*cmd=set*} $client]} {
+                assert_match {*qbuf=0 qbuf-free=0 *} $client
+            }
+        }
+    }
+
     test "Negative multibulk length" {
         reconnect
         r write "*-10\r\n"
@@ -107,3 +146,23 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    test "Big shared values in the reply list are sent unmodified" {
+        set big [string repeat x 100000]
+        r set big $big
+        r zadd z 1 $big
+        set rd [redis_deferring_client]
+        $rd get big
+        $rd echo small
+        $rd zrangebyscore z 0 1
+        $rd append big y
+        $rd get big
+        set res [list [$rd read] [$rd read] [$rd read] [$rd read]]
+        set last [$rd read]
+        $rd close
+        list [expr {[lindex $res 0] eq $big}] [lindex $res 1] \
+             [expr {[lindex $res 2] eq [list $big]}] [lindex $res 3] \
+             [string length $last]
+    } {1 small 1 100001 100001}
+}
@@ -282,6 +282,37 @@ start_server {tags {"scripting"}} {
 # Start a new server since the last test in this stanza will kill the
 # instance at all.
 start_server {tags {"scripting"}} {
+    test {The client running a timedout script keeps its query buffer} {
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        puts -nonewline $fd "*2\r\n\$6\r\nselect\r\n\$1\r\n9\r\n"
+        flush $fd
+        assert_equal "+OK" [string trim [gets $fd]]
+        r config set lua-time-limit 10
+        puts -nonewline $fd "*3\r\n\$4\r\neval\r\n\$17\r\nwhile true do end\r\n\$1\r\n0\r\n"
+        flush $fd
+        after 200
+        # Other clients are served while the script runs.
+        r script kill
+        assert_match {-ERR*} [gets $fd]
+        # A command bigger than the shared query buffer, split in two
+        # writes, from the client that ran the script.
+        puts -nonewline $fd "*3\r\n\$3\r\nset\r\n\$3\r\nbig\r\n\$20000\r\n"
+        puts -nonewline $fd [string repeat x 10000]
+        flush $fd
+        after 100
+        r set foo bar
+        puts -nonewline $fd "[string repeat x 10000]\r\n"
+        flush $fd
+        assert_equal "+OK" [string trim [gets $fd]]
+        puts -nonewline $fd "PING\r\n"
+        flush $fd
+        assert {[string trim [gets $fd]] eq "+PONG"}
+        close $fd
+        assert {[r get big] eq [string repeat x 20000]}
+        r get foo
+    } {bar}
+
     test {Timedout read-only scripts can be killed by SCRIPT KILL} {
         set rd [redis_deferring_client]
         r config set lua-time-limit 10
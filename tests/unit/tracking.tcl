@@ -0,0 +1,164 @@
+start_server {tags {"tracking"}} {
+    test {HELLO without arguments keeps RESP2} {
+        set reply [r hello]
+        list [dict get $reply server] [dict get $reply proto]
+    } {redis 2}
+
+    test {HELLO rejects unsupported protocol versions} {
+        catch {r hello 4} e
+        set e
+    } {NOPROTO*}
+
+    test {CLIENT TRACKING requires RESP3} {
+        catch {r client tracking on} e
+        set e
+    } {*RESP3*}
+
+    test {HELLO 3 replies with a map and switches protocol} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        set reply [$rd read]
+        $rd close
+        list [dict get $reply proto] [dict get $reply mode] \
+             [dict get $reply role]
+    } {3 standalone master}
+
+    test {Keys read by a tracking client are invalidated when modified} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        assert_equal OK [$rd read]
+        r set tracked:key 1
+        $rd get tracked:key
+        assert_equal 1 [$rd read]
+        r set tracked:key 2
+        assert_equal {invalidate tracked:key} [$rd read]
+        # The key is no longer tracked after the invalidation.
+        r set tracked:key 3
+        $rd ping
+        assert_equal PONG [$rd read]
+        $rd close
+    }
+
+    test {Tracking client receives its own invalidations after the reply} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        $rd get tracked:own
+        $rd read
+        $rd set tracked:own bar
+        assert_equal OK [$rd read]
+        assert_equal {invalidate tracked:own} [$rd read]
+        $rd close
+    }
+
+    test {Deleted and expired keys are invalidated} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        r set tracked:del 1
+        r set tracked:exp 1
+        r pexpire tracked:exp 100
+        $rd mget tracked:del tracked:exp
+        $rd read
+        r del tracked:del
+        assert_equal {invalidate tracked:del} [$rd read]
+        after 200
+        r get tracked:exp
+        assert_equal {invalidate tracked:exp} [$rd read]
+        $rd close
+    }
+
+    test {FLUSHALL sends a single null invalidation} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        r set tracked:a 1
+        $rd get tracked:a
+        $rd read
+        r flushall
+        assert_equal {invalidate {}} [$rd read]
+        $rd ping
+        assert_equal PONG [$rd read]
+        $rd close
+    }
+
+    test {DEBUG RELOAD invalidates the tracked keys} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        r set tracked:a 1
+        $rd get tracked:a
+        $rd read
+        r debug reload
+        assert_equal {invalidate {}} [$rd read]
+        $rd close
+    }
+
+    test {Keys read by a script after it timed out are tracked} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        r set tracked:script 1
+        r config set lua-time-limit 10
+        # Other clients are served once the script timed out, then the
+        # script reads the key.
+        $rd eval {
+            local t = redis.call('time')
+            local start = t[1]*1000000+t[2]
+            while true do
+                t = redis.call('time')
+                if t[1]*1000000+t[2]-start > 500000 then break end
+            end
+            return redis.call('get',KEYS[1])
+        } 1 tracked:script
+        after 200
+        catch {r ping} e
+        assert_match {BUSY*} $e
+        assert_equal 1 [$rd read]
+        r config set lua-time-limit 5000
+        r set tracked:script 2
+        assert_equal {invalidate tracked:script} [$rd read]
+        $rd close
+    }
+
+    test {The tracking table is bounded by tracking-table-max-keys} {
+        r config set tracking-table-max-keys 10
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        $rd read
+        for {set j 0} {$j < 20} {incr j} {
+            $rd get tracked:many:$j
+        }
+        $rd ping
+        set invalidations 0
+        while {[set reply [$rd read]] ne {PONG}} {
+            if {[lindex $reply 0] eq {invalidate}} {incr invalidations}
+        }
+        assert_equal 10 $invalidations
+        assert_equal 10 [s tracking_total_keys]
+        r config set tracking-table-max-keys 1000000
+        $rd close
+    }
+
+    test {Tracking clients are removed when disconnected} {
+        wait_for_condition 50 100 {
+            [s tracking_clients] == 0
+        } else {
+            fail "Tracking clients still registered"
+        }
+    }
+}
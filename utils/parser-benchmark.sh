@@ -0,0 +1,31 @@
+#!/bin/sh
+# Benchmark the protocol parser of redis-server with captured pipelined
+# traffic. The commands sent by redis-benchmark (-P 16) are captured using
+# the append only file of a temporary instance, then the capture is parsed
+# with redis-server --test-parser. Run it from the root of the source tree:
+#
+#   ./utils/parser-benchmark.sh [port] [iterations]
+
+PORT=${1:-7798}
+ITERATIONS=${2:-20}
+REQUESTS=100000
+SRC=./src
+DIR=/tmp/redis-parser-benchmark-$PORT
+
+rm -rf $DIR
+mkdir -p $DIR || exit 1
+$SRC/redis-server --port $PORT --daemonize yes --save "" --dir $DIR \
+    --appendonly yes --appendfsync no || exit 1
+sleep 1
+
+# Small arguments, a few MSETs, and some bigger values.
+$SRC/redis-benchmark -p $PORT -P 16 -n $REQUESTS -r 100000 -q \
+    -t set,incr,lpush,sadd > /dev/null
+$SRC/redis-benchmark -p $PORT -P 16 -n $((REQUESTS/10)) -q -t mset > /dev/null
+$SRC/redis-benchmark -p $PORT -P 16 -n $((REQUESTS/10)) -r 100000 -q \
+    -d 1000 -t set > /dev/null
+$SRC/redis-cli -p $PORT shutdown nosave > /dev/null 2>&1
+sleep 1
+
+$SRC/redis-server --test-parser $DIR/appendonly.aof $ITERATIONS
+rm -rf $DIR
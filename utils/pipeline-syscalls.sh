@@ -0,0 +1,29 @@
+#!/bin/sh
+# Count the write(2)/writev(2) calls performed by redis-server while serving
+# pipelined benchmarks (redis-benchmark -P 100), using the syscw counter of
+# /proc/<pid>/io. Linux only. Run it from the root of the source tree:
+#
+#   ./utils/pipeline-syscalls.sh [port]
+
+PORT=${1:-7799}
+REQUESTS=200000
+SRC=./src
+
+$SRC/redis-server --port $PORT --daemonize yes --save "" \
+    --pidfile /tmp/redis-syscalls-$PORT.pid || exit 1
+sleep 1
+PID=$(cat /tmp/redis-syscalls-$PORT.pid)
+
+# Populate the list used by the LRANGE tests.
+$SRC/redis-benchmark -p $PORT -P 100 -n 100000 -q -t lpush > /dev/null
+
+for test in get lrange_100 lrange_300
+do
+    before=$(awk '/^syscw/ {print $2}' /proc/$PID/io)
+    result=$($SRC/redis-benchmark -p $PORT -P 100 -n $REQUESTS -q -t $test | \
+             tr '\r' '\n' | grep -v '^$' | tail -1)
+    after=$(awk '/^syscw/ {print $2}' /proc/$PID/io)
+    echo "$result, write calls: $((after-before))"
+done
+
+$SRC/redis-cli -p $PORT shutdown nosave > /dev/null 2>&1